@@ -37,6 +37,7 @@
 #include "net/ipv6/uip-ds6.h"
 #include "net/ip/uip-udp-packet.h"
 #include "net/rpl/rpl.h"
+#include "net/rpl/rpl-private.h"
 #include "sys/ctimer.h"
 #ifdef WITH_COMPOWER
 #include "powertrace.h"
@@ -48,6 +49,7 @@
 #include "net/rime/rimeaddr.h"
 #include "common-hdr.h"
 #include "udp-app.h"
+#include "traffic-gen.h"
 
 #ifdef BUTTON_INTERFERENCE
 #include "dev/button-sensor.h"
@@ -67,6 +69,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #define UDP_CLIENT_PORT 8765
 #define UDP_SERVER_PORT 5678
@@ -78,6 +81,9 @@
 
 #define UDP_EXAMPLE_ID  190
 
+/* Packets a flow sends at most at once when it falls behind */
+#define FLOW_MAX_BURST 16
+
 #ifndef PERIOD
 #define PERIOD 300
 #endif
@@ -103,8 +109,12 @@ app_stat_t g_stats;
 dpkt_stat_t  g_pktstat;
 
 static struct uip_udp_conn *client_conn;
+static struct uip_udp_conn *echo_conn;
 static uip_ipaddr_t server_ipaddr;
 
+static traffic_flow_t g_flows[TRAFFIC_MAX_FLOWS];
+static int g_flow_num;
+
 /*---------------------------------------------------------------------------*/
 PROCESS(udp_client_process, "UDP client process");
 AUTOSTART_PROCESSES(&udp_client_process, &collect_common_process);
@@ -175,48 +185,119 @@ collect_common_net_print(void)
     PRINT6ADDR(&r->ipaddr);
     PRINTF("\n");
   }
+  {
+    int i;
+
+    /* Join time distribution, buckets below 0.5 s, 1 s, 2 s, ... */
+    PRINTF("Joins: %lu, join times:", (unsigned long)rpl_counters->joins);
+    for(i = 0; i < RPL_COUNTER_JOIN_TIME_NUM; i++) {
+      PRINTF(" %lu", (unsigned long)rpl_counters->join_time[i]);
+    }
+    PRINTF("\n");
+    PRINTF("DIO intervals: %lu, sent %lu, suppressed %lu, heard %lu\n",
+           (unsigned long)rpl_counters->dio_intervals,
+           (unsigned long)rpl_counters->dio_intervals_sent,
+           (unsigned long)rpl_counters->dio_intervals_suppressed,
+           (unsigned long)rpl_counters->dio_heard);
+  }
+#if RPL_CONF_STATS
+  PRINTF("Repairs: local %u, detached %lu, bounded %lu, global %u\n",
+         rpl_stats.local_repairs, (unsigned long)rpl_stats.detaches,
+         (unsigned long)rpl_stats.bounded_repairs, rpl_stats.global_repairs);
+#endif /* RPL_CONF_STATS */
   PRINTF("---\n");
 
 }
 /*---------------------------------------------------------------------------*/
+/* Round trip time of a reply, and the upward latency the sink measured */
+static latency_hist_t g_uphist;
+static long g_minup;
+static long g_maxup;
+
+static void
+add_latency(dpkt_t *pkt, long rtt)
+{
+  latency_hist_add(&g_pktstat.latency, rtt);
+  if(pkt->upLatency > 0) {
+    latency_hist_add(&g_uphist, pkt->upLatency);
+    if(g_minup == 0 || pkt->upLatency < g_minup) {
+      g_minup = pkt->upLatency;
+    }
+    if(pkt->upLatency > g_maxup) {
+      g_maxup = pkt->upLatency;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Answers a flow of another client, as the sink does; clients all send
+   from UDP_CLIENT_PORT */
+static void
+echo_handler(void)
+{
+  dpkt_t *pkt;
+
+  if(!uip_newdata() || uip_datalen() < sizeof(dpkt_t)) {
+    return;
+  }
+  pkt = (dpkt_t *)uip_appdata;
+  pkt->upLatency = dpkt_latency_time(&(pkt->sendTime));
+  uip_udp_packet_sendto(echo_conn, pkt, sizeof(dpkt_t),
+                        &UIP_IP_BUF->srcipaddr, UIP_HTONS(UDP_CLIENT_PORT));
+}
+/*---------------------------------------------------------------------------*/
 static void
 tcpip_handler(void)
 {
   dpkt_t *pkt;
+  dpkt_stat_t *fs;
   long curpktlatency;
+  int cls;
+
+  if(uip_udp_conn == echo_conn) {
+    echo_handler();
+    return;
+  }
 
   if(uip_newdata()) {
     pkt = (dpkt_t *)uip_appdata;
-	    
-	    if (!g_pktstat.lastseq){
-	      g_pktstat.lastseq = pkt->seq;
-	      g_pktstat.rcvcnt++;
-	      g_pktstat.leastLatency = g_pktstat.maxLatency = curpktlatency = dpkt_latency_time(&(pkt->sendTime));
+	    if(uip_datalen() < sizeof(dpkt_t) || pkt->flow >= g_flow_num) {
+	      PRINTF("Dropping response of unknown flow\n");
 	      return;
 	    }
+	    fs = &g_flows[pkt->flow].stat;
+	    
+	    PRINTF("Recvd Response of flow[%u] with seq[%u] last rsp seq[%u]\n",
+	           pkt->flow, pkt->seq, fs->lastseq);
 	
-	    PRINTF("Recvd Response with seq[%u] last rsp seq[%u]\n",pkt->seq, g_pktstat.lastseq);
-	
-	    if (pkt->seq == g_pktstat.lastseq){
+	    /* Replies echo our sequence numbers and send times. Late ones,
+	       already counted lost, stay out of the received count. */
+	    cls = seq_window_update(&fs->window, pkt->seq, &(pkt->sendTime));
+	    if(cls == SEQ_WINDOW_DUPLICATE) {
 	      g_pktstat.dupcnt++;
-	    }
-	    else if(pkt->seq < g_pktstat.lastseq) {
-	      g_pktstat.unordered++;
-	      g_pktstat.rcvcnt++;
-	    }
-	    else{
-	      g_pktstat.lastseq = pkt->seq;
+	    } else if(cls != SEQ_WINDOW_LATE) {
 	      g_pktstat.rcvcnt++;
 	    }
+	    fs->lastseq = fs->window.highest;
+	    fs->rcvcnt = fs->window.received;
+	    fs->dupcnt = fs->window.duplicates;
+	    fs->unordered = fs->window.reordered;
+	    fs->dropcnt = fs->window.lost;
 	
 	    curpktlatency = dpkt_latency_time(&(pkt->sendTime));
-	    if (curpktlatency < g_pktstat.leastLatency){
+	    add_latency(pkt, curpktlatency);
+	    latency_hist_add(&fs->latency, curpktlatency);
+	    if (fs->leastLatency == 0 || curpktlatency < fs->leastLatency){
+	      fs->leastLatency = curpktlatency;
+	    }
+	    if (curpktlatency > fs->maxLatency){
+	      fs->maxLatency = curpktlatency;
+	    }
+	    if (g_pktstat.leastLatency == 0 || curpktlatency < g_pktstat.leastLatency){
 	      g_pktstat.leastLatency = curpktlatency;
-
-  }
-            if (curpktlatency > g_pktstat.maxLatency){
-	    g_pktstat.maxLatency = curpktlatency;
-}
+	    }
+	    if (curpktlatency > g_pktstat.maxLatency){
+	      g_pktstat.maxLatency = curpktlatency;
+	    }
 
 reply++;
 	    printf("DATA recv (s:%d, r:%d) end2nd latency[%lu] minlatency[%lu]\n", seq_id, reply, curpktlatency, g_pktstat.leastLatency);
@@ -227,25 +308,50 @@ reply++;
 	uint32_t g_payload_len=32;
 
 static void
-send_packet(void *ptr)
+send_packet(traffic_flow_t *f)
 {
   char buf[MAX_PAYLOAD_LEN];
   dpkt_t *pkt=(dpkt_t*)buf;
+  const uip_ipaddr_t *dest;
+  unsigned int len;
 
-  if(sizeof(buf) < sizeof(pkt)+g_payload_len) {
+  len = sizeof(dpkt_t) + f->nextLen;
+  if(len > sizeof(buf)) {
     printf("buffer size mismatch .. expect no UDP pkt\n");
     return;
   }
 
   seq_id++;
-  pkt->seq = seq_id;
+  f->seq++;
+  f->sent++;
+  memset(pkt, 0, sizeof(dpkt_t));
+  pkt->seq = f->seq;
+  pkt->flow = f->id;
   gettimeofday(&(pkt->sendTime), NULL);
 
-  PRINTF("DATA send to %d 'Hello %d' size-%lu\n",
-         server_ipaddr.u8[sizeof(server_ipaddr.u8) - 1], seq_id, sizeof(pkt)+g_payload_len);
+  dest = uip_is_addr_unspecified(&f->dest) ? &server_ipaddr : &f->dest;
+  PRINTF("DATA send flow %u to %d 'Hello %d' size-%u\n", f->id,
+         dest->u8[sizeof(dest->u8) - 1], f->seq, len);
 
-  uip_udp_packet_sendto(client_conn, buf, sizeof(pkt)+g_payload_len,
-                        &server_ipaddr, UIP_HTONS(UDP_SERVER_PORT));
+  uip_udp_packet_sendto(client_conn, buf, len,
+                        dest, UIP_HTONS(UDP_SERVER_PORT));
+}
+/*---------------------------------------------------------------------------*/
+/* Sends what is due of a flow, and sets its timer to the next packet */
+static void
+flow_timer(void *ptr)
+{
+  traffic_flow_t *f = ptr;
+  clock_time_t now;
+  int n;
+
+  now = clock_time();
+  for(n = 0; f->next <= now && n < FLOW_MAX_BURST; n++) {
+    send_packet(f);
+    traffic_gen_advance(f);
+  }
+  ctimer_set(&f->timer, f->next > now ? (clock_time_t)ceil(f->next - now) : 1,
+             flow_timer, f);
 }
 /*---------------------------------------------------------------------------*/
 void
@@ -382,36 +488,58 @@ set_global_address(void)
 	  char *ptr = getenv("UDPCLI_SEND_INT");
 	  if(!ptr){
 	    PRINTF("UDP_SEND_INT env var not found\n");
-	    return;
+	  } else {
+	    g_send_interval = (int)(atof(ptr)*CLOCK_SECOND);
 	  }
 	
-	  g_send_interval = (int)(atof(ptr)*CLOCK_SECOND);
-	
 	  char *ptr1 = getenv("AUTO_START");
 	  if(!ptr1){
 	    PRINTF("AUTO_START env var not found\n");
-	    return;
+	  } else {
+	    g_auto_start = (int)(atof(ptr1));
 	  }
 	
-	  g_auto_start = (int)(atof(ptr1));
-	
 	  ptr = getenv("UDP_PAYLOAD_LEN");
 	  if(ptr) g_payload_len = (int)atoi(ptr);
 		PRINTF("UDP g_send_interval:%d g_payload_len:%d\n", 
 	    g_send_interval, g_payload_len);
 	  
 	  memset(&g_pktstat, 0, sizeof(g_pktstat));
+
+	  /* Without UDP_FLOW<n>, UDPCLI_SEND_INT makes the one flow */
+	  g_flow_num = traffic_gen_init(g_flows);
+	  if(g_flow_num == 0 && g_send_interval > 0) {
+	    memset(&g_flows[0], 0, sizeof(g_flows[0]));
+	    g_flows[0].model = TRAFFIC_CBR;
+	    g_flows[0].rate = (double)CLOCK_SECOND / g_send_interval;
+	    g_flows[0].payloadLen = g_payload_len;
+	    g_flow_num = 1;
+	  }
+	  PRINTF("UDP flows:%d\n", g_flow_num);
 	}
 	
-	static struct etimer periodic;
 	int udp_started = 0;
 /*---------------------------------------------------------------------------*/
+static void
+start_flows(void)
+{
+  clock_time_t now;
+  int i;
+
+  if(udp_started || client_conn == NULL || !g_auto_start) {
+    return;
+  }
+  now = clock_time();
+  for(i = 0; i < g_flow_num; i++) {
+    traffic_gen_start(&g_flows[i], now);
+    ctimer_set(&g_flows[i].timer, (clock_time_t)ceil(g_flows[i].next - now),
+               flow_timer, &g_flows[i]);
+  }
+  udp_started = 1;
+}
+/*---------------------------------------------------------------------------*/
 PROCESS_THREAD(udp_client_process, ev, data)
 {
-  
-//static struct etimer periodic;
-  static struct ctimer backoff_timer;
-  unsigned long  backoff;
   PROCESS_BEGIN();
 
   PROCESS_PAUSE();
@@ -441,38 +569,23 @@ PROCESS_THREAD(udp_client_process, ev, data)
   PRINTF(" local/remote port %u/%u\n",
         UIP_HTONS(client_conn->lport), UIP_HTONS(client_conn->rport));
 
-backoff = g_send_interval/4 + (g_send_interval / 4 * (uint32_t)random_rand()) / RANDOM_RAND_MAX;
-	  PRINTF("Gnerated backoff[%lu]\n",backoff);
-	
-	  if(g_send_interval > 0){
-	    etimer_set(&periodic, g_send_interval);
-	    udp_started = 1;
-	  }
+  /* Flows of other clients may be sent here */
+  echo_conn = udp_new(NULL, 0, NULL);
+  if(echo_conn != NULL) {
+    udp_bind(echo_conn, UIP_HTONS(UDP_SERVER_PORT));
+  }
+
+	  start_flows();
 	  
 	  PRINTF("Will enter to while\n");
 
 
 
   while(1) {
-    PRINTF("Will call PROCESS Yield\n");
     PROCESS_YIELD();
-    PRINTF("PROCESS Yield exited\n");
     if(ev == tcpip_event) {
       tcpip_handler();
     }
-
-PRINTF("udp_started[%d]\n", udp_started);
-	    if(etimer_expired(&periodic)) {
-	      etimer_reset(&periodic);
-	      PRINTF("Timer Expired [%d]\n",g_auto_start);
-				//send_packet(NULL);
-	      if (g_auto_start){
-	       //ctimer_set(&backoff_timer, SEND_TIME, send_packet, NULL);
-	       backoff = g_send_interval/4 + (g_send_interval / 4 * (uint32_t)random_rand()) / RANDOM_RAND_MAX;
-	       ctimer_set(&backoff_timer, backoff, send_packet, NULL);
-		      }
-	
-	    }
 	  }
 	  PRINTF("Process Stopped\n");
 	  PROCESS_END();
@@ -481,22 +594,48 @@ PRINTF("udp_started[%d]\n", udp_started);
 	void start_udp_process()	
 	{	
 	  PRINTF("Need to start the UDP process\n ");	
-	  if(!g_auto_start && g_send_interval > 0){	
-	    udp_started = 1;	
+	  if(!g_auto_start && g_flow_num > 0){	
 	    g_auto_start = 1;	
-	    PRINTF("Started the UDP process[%d]\n", g_send_interval);	
+	    start_flows();
+	    PRINTF("Started the UDP process[%d flows]\n", g_flow_num);	
 	  }	
 	}
 
 void udp_get_app_stat(udpapp_stat_t *appstat)
 {
-  PRINTF("Stats Called on Node\n");
+  udpapp_flow_stat_t *fst;
+  traffic_flow_t *f;
+  int i;
 
+  PRINTF("Stats Called on Node\n");
   appstat->totalpktsent = seq_id;
   appstat->totalpktrecvd = g_pktstat.rcvcnt;
   appstat->totalduppkt = g_pktstat.dupcnt;
   appstat->minroudtriptime = g_pktstat.leastLatency;
   appstat->maxroundtriptime = g_pktstat.maxLatency; 
+  appstat->minupwardtime = g_minup;
+  appstat->maxupwardtime = g_maxup;
+  appstat->roundtriphist = g_pktstat.latency;
+  appstat->upwardhist = g_uphist;
+  latency_hist_percentiles(&g_pktstat.latency, appstat->roundtrippct);
+  latency_hist_percentiles(&g_uphist, appstat->upwardpct);
+
+  appstat->flowcnt = g_flow_num;
+  for(i = 0; i < g_flow_num; i++) {
+    f = &g_flows[i];
+    fst = &appstat->flow[i];
+    fst->model = f->model;
+    fst->payloadlen = f->payloadLen;
+    fst->rate = traffic_gen_mean_rate(f);
+    fst->pktsent = f->sent;
+    fst->pktrecvd = f->stat.rcvcnt;
+    fst->duppkt = f->stat.dupcnt;
+    fst->reorderedpkt = f->stat.unordered;
+    fst->lostpkt = f->stat.dropcnt;
+    fst->minroundtriptime = f->stat.leastLatency;
+    fst->maxroundtriptime = f->stat.maxLatency;
+    latency_hist_percentiles(&f->stat.latency, fst->roundtrippct);
+  }
 }
 
 /*---------------------------------------------------------------------------*/
@@ -41,6 +41,7 @@
 #include "dev/serial-line.h"
 #include "dev/leds.h"
 #include "collect-common.h"
+#include "sink-log.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -88,6 +89,10 @@ collect_common_recv(const rimeaddr_t *originator, uint8_t seqno, uint8_t hops,
   uint16_t data;
   int i;
 
+  if(sink_log_collect(originator, seqno, hops, payload, payload_len)) {
+    leds_blink();
+    return;
+  }
 
   printf("%u", 8 + payload_len / 2);
   /* Timestamp. Ignore time synch for now. */
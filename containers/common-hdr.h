@@ -4,10 +4,17 @@
 #include <stdint.h>
 #include <sys/time.h>
 #include <uip.h>
+#include "latency-hist.h"
+#include "seq-window.h"
+
+#define UIP_IP_BUF   ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
+
 typedef	struct _dpkt_
 {
   uint32_t seq;
   struct timeval sendTime;
+  int32_t upLatency; /* set by the sink in its reply, microseconds */
+  uint8_t flow;      /* of the sender, echoed in the reply */
   uint8_t buflen;
   uint8_t buf[1];
 }dpkt_t;
@@ -15,6 +22,7 @@ typedef	struct _dpkt_
 typedef struct _dpkt_stat_
 {
    uip_ipaddr_t ip;
+   uint8_t flow;
    uint32_t lastseq;
    uint32_t dropcnt;
    uint32_t unordered;
@@ -22,6 +30,9 @@ typedef struct _dpkt_stat_
    uint32_t dupcnt;
    long leastLatency;
    long maxLatency;
+   unsigned long lastSeen; /* clock_seconds() of the last packet */
+   latency_hist_t latency;
+   seq_window_t window;
 }dpkt_stat_t;
 
 #endif //	_COMMON_HDR_H_
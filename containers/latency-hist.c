@@ -0,0 +1,147 @@
+/**
+ * \file
+ *         Log-bucketed latency histograms, see latency-hist.h.
+ */
+
+#include "latency-hist.h"
+
+#include <string.h>
+/*---------------------------------------------------------------------------*/
+static unsigned
+bucket_of(uint32_t v)
+{
+  unsigned e;
+
+  if(v < LATENCY_HIST_SUB) {
+    return v;
+  }
+  /* e is the position of the highest bit, at least LATENCY_HIST_SUB_BITS */
+  for(e = LATENCY_HIST_SUB_BITS; e < 31 && (v >> (e + 1)) != 0; e++);
+  return (e - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB +
+    ((v >> (e - LATENCY_HIST_SUB_BITS)) & (LATENCY_HIST_SUB - 1));
+}
+/*---------------------------------------------------------------------------*/
+/* The middle of a bucket, as the value reported for its samples */
+static long
+bucket_value(unsigned i)
+{
+  unsigned shift;
+  uint32_t low;
+
+  if(i < LATENCY_HIST_SUB) {
+    return i;
+  }
+  shift = i / LATENCY_HIST_SUB - 1;
+  low = (uint32_t)(LATENCY_HIST_SUB + i % LATENCY_HIST_SUB) << shift;
+  return low + ((1UL << shift) >> 1);
+}
+/*---------------------------------------------------------------------------*/
+/* Halves the buckets, rounding up so that rare values stay visible */
+static void
+halve(latency_hist_t *h)
+{
+  unsigned i;
+
+  for(i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+    h->bucket[i] = (h->bucket[i] + 1) >> 1;
+  }
+  h->scale++;
+}
+/*---------------------------------------------------------------------------*/
+void
+latency_hist_add(latency_hist_t *h, long us)
+{
+  unsigned i;
+
+  if(us < 0) {
+    us = 0;
+  }
+  i = bucket_of(us > 0xffffffffL ? 0xffffffffUL : (uint32_t)us);
+  if((h->count++ & ((1UL << h->scale) - 1)) != 0) {
+    /* Not a sample of this scale */
+    return;
+  }
+  if(h->bucket[i] == LATENCY_HIST_MAX) {
+    halve(h);
+  }
+  h->bucket[i]++;
+}
+/*---------------------------------------------------------------------------*/
+void
+latency_hist_merge(latency_hist_t *dst, const latency_hist_t *src)
+{
+  uint32_t sum[LATENCY_HIST_BUCKETS];
+  uint32_t max;
+  unsigned shift;
+  unsigned i;
+
+  while(dst->scale < src->scale) {
+    halve(dst);
+  }
+  shift = dst->scale - src->scale;
+
+  max = 0;
+  for(i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+    sum[i] = dst->bucket[i];
+    if(src->bucket[i] != 0) {
+      sum[i] += ((uint32_t)src->bucket[i] + (1UL << shift) - 1) >> shift;
+    }
+    if(sum[i] > max) {
+      max = sum[i];
+    }
+  }
+  for(; max > LATENCY_HIST_MAX; max = (max + 1) >> 1) {
+    for(i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+      sum[i] = (sum[i] + 1) >> 1;
+    }
+    dst->scale++;
+  }
+  for(i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+    dst->bucket[i] = sum[i];
+  }
+  dst->count += src->count;
+}
+/*---------------------------------------------------------------------------*/
+/* The value below which permille/1000 of the samples fall, 0 if none */
+long
+latency_hist_percentile(const latency_hist_t *h, unsigned permille)
+{
+  uint64_t total;
+  uint64_t rank;
+  uint64_t seen;
+  unsigned i;
+
+  total = 0;
+  for(i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+    total += h->bucket[i];
+  }
+  if(total == 0) {
+    return 0;
+  }
+
+  /* The rank of the sample, rounded up, counting from 1 */
+  rank = (total * permille + 999) / 1000;
+  if(rank == 0) {
+    rank = 1;
+  }
+  seen = 0;
+  for(i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if(seen >= rank) {
+      return bucket_value(i);
+    }
+  }
+  return bucket_value(LATENCY_HIST_BUCKETS - 1);
+}
+/*---------------------------------------------------------------------------*/
+void
+latency_hist_percentiles(const latency_hist_t *h, long pct[LATENCY_PCT_NUM])
+{
+  static const unsigned permille[LATENCY_PCT_NUM] = LATENCY_PCT_PERMILLE;
+  unsigned i;
+
+  for(i = 0; i < LATENCY_PCT_NUM; i++) {
+    pct[i] = latency_hist_percentile(h, permille[i]);
+  }
+}
+/*---------------------------------------------------------------------------*/
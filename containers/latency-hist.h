@@ -0,0 +1,42 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+/*
+ * Log-bucketed latency histograms, in microseconds. Values below
+ * 2^LATENCY_HIST_SUB_BITS have a bucket each; above, every power of two
+ * is split in 2^LATENCY_HIST_SUB_BITS buckets, so a bucket is at most
+ * 1/4th of its values wide. Histograms of the same layout merge by
+ * adding their buckets, across flows or nodes.
+ *
+ * Buckets are 16 bits, as the sink keeps a histogram per flow. Once one
+ * would overflow, all of them are halved and scale goes up: from then on
+ * a bucket counts 2^scale samples and only every 2^scale-th sample added
+ * goes into the histogram. count stays the number of samples added.
+ */
+
+#include <stdint.h>
+
+#define LATENCY_HIST_SUB_BITS 2
+#define LATENCY_HIST_SUB      (1 << LATENCY_HIST_SUB_BITS)
+/* Up to 2^32 us, a bit more than an hour */
+#define LATENCY_HIST_BUCKETS  ((32 - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB)
+#define LATENCY_HIST_MAX      0xffff
+
+/* The percentiles reported, in per mille of the samples */
+#define LATENCY_PCT_NUM 4
+#define LATENCY_PCT_PERMILLE { 500, 900, 990, 999 }
+
+typedef struct _latency_hist_
+{
+  uint32_t count;
+  uint8_t scale;
+  uint16_t bucket[LATENCY_HIST_BUCKETS];
+}latency_hist_t;
+
+void latency_hist_add(latency_hist_t *h, long us);
+void latency_hist_merge(latency_hist_t *dst, const latency_hist_t *src);
+long latency_hist_percentile(const latency_hist_t *h, unsigned permille);
+void latency_hist_percentiles(const latency_hist_t *h,
+                              long pct[LATENCY_PCT_NUM]);
+
+#endif /* LATENCY_HIST_H */
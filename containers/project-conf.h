@@ -43,6 +43,8 @@
 #if WITH_NON_STORING
 #undef RPL_NS_CONF_LINK_NUM
 #define RPL_NS_CONF_LINK_NUM 40 /* Number of links maintained at the root. Can be set to 0 at non-root nodes. */
+#undef RPL_NS_CONF_DYNAMIC_STORAGE
+#define RPL_NS_CONF_DYNAMIC_STORAGE 1 /* Whitefield nodes run on Linux: let the root's link table grow */
 #undef UIP_CONF_MAX_ROUTES
 #define UIP_CONF_MAX_ROUTES 0 /* No need for routes */
 #undef RPL_CONF_MOP
@@ -51,6 +53,24 @@
 
 #define RPL_CONF_WITH_DCO 1
 
+/* Join quickly after mass reboots of the simulated network */
+#define RPL_CONF_DIS_FAST_JOIN 1
+
+/* Keep link failures local to the subtree below the failed link */
+#define RPL_CONF_LOCAL_REPAIR_BOUNDED 1
+
+/* Restarted node processes rejoin from their last saved state */
+#define RPL_CONF_SNAPSHOT 1
+
+/* A server started with BACKUP_ROOT=1 stands by for the root */
+#define RPL_CONF_ROOT_SYNC 1
+
+/* Collectors read the RPL counters from /dev/shm while nodes run */
+#define RPL_CONF_COUNTERS_SHM 1
+
+/* Binary tracepoints, decode with tools/rpl-trace-decode.py */
+#define RPL_CONF_TRACE 1
+
 #endif
 
 
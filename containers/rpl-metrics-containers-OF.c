@@ -128,6 +128,7 @@ calculate_rank(rpl_parent_t *p, rpl_rank_t base_rank)
     new_rank= INFINITE_RANK;
 
   PRINTF("RPL: METRICS: OF: new rank: %u\n",new_rank);
+  RPL_TRACE_EVENT(RPL_TRACE_RANK, new_rank, rpl_trace_parent(p), base_rank);
 
   return new_rank;
 }
@@ -317,5 +318,8 @@ static void
 update_metric_container(rpl_instance_t *instance)
 {
   rpl_metrics_update_metric_container(instance);
+  RPL_TRACE_EVENT(RPL_TRACE_METRIC_UPDATE, instance->current_dag->rank,
+                  rpl_trace_parent(instance->current_dag->preferred_parent),
+                  instance->mc.metric_and_const_obj);
 }
 
@@ -0,0 +1,145 @@
+/**
+ * \file
+ *         Sequence number window of a flow, see seq-window.h.
+ */
+
+#include "seq-window.h"
+
+#include <string.h>
+
+#define SLOT(s) (((s) % SEQ_WINDOW_SIZE) / 32)
+#define MASK(s) (1UL << ((s) % 32))
+/*---------------------------------------------------------------------------*/
+static void
+start(seq_window_t *w, uint32_t seq, const struct timeval *sent)
+{
+  w->first = seq;
+  w->highest = seq;
+  if(sent != NULL) {
+    w->highestTime = *sent;
+  } else {
+    timerclear(&w->highestTime);
+  }
+  memset(w->bits, 0, sizeof(w->bits));
+  w->bits[SLOT(seq)] |= MASK(seq);
+  w->started = 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Sequence numbers in the window that did not arrive (yet) */
+uint32_t
+seq_window_missing(const seq_window_t *w)
+{
+  uint32_t in_window;
+  uint32_t arrived;
+  uint32_t v;
+  int i;
+
+  if(!w->started) {
+    return 0;
+  }
+
+  in_window = w->highest - w->first + 1;
+  if(in_window > SEQ_WINDOW_SIZE) {
+    in_window = SEQ_WINDOW_SIZE;
+  }
+  /* Only bits of the window are ever set */
+  arrived = 0;
+  for(i = 0; i < SEQ_WINDOW_SIZE / 32; i++) {
+    for(v = w->bits[i]; v != 0; v &= v - 1) {
+      arrived++;
+    }
+  }
+  return in_window - arrived;
+}
+/*---------------------------------------------------------------------------*/
+/* Sequence numbers the sender used, so far */
+uint32_t
+seq_window_expected(const seq_window_t *w)
+{
+  if(!w->started) {
+    return w->expected;
+  }
+  return w->expected + (w->highest - w->first + 1);
+}
+/*---------------------------------------------------------------------------*/
+/* Moves the window up to seq; what leaves it missing is lost */
+static void
+advance(seq_window_t *w, uint32_t seq)
+{
+  uint32_t d;
+  uint32_t s;
+
+  d = seq - w->highest;
+  if(d > SEQ_WINDOW_SIZE) {
+    /* The whole window leaves, and what is in between never enters */
+    w->lost += seq_window_missing(w) + (d - SEQ_WINDOW_SIZE);
+    memset(w->bits, 0, sizeof(w->bits));
+  } else {
+    for(s = w->highest + 1; s != seq + 1; s++) {
+      /* s takes the slot of s - SEQ_WINDOW_SIZE */
+      if(s - w->first >= SEQ_WINDOW_SIZE &&
+         !(w->bits[SLOT(s)] & MASK(s))) {
+        w->lost++;
+      }
+      w->bits[SLOT(s)] &= ~MASK(s);
+    }
+  }
+  w->highest = seq;
+  w->bits[SLOT(seq)] |= MASK(seq);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Accounts for a packet with sequence number seq, sent at sent if known.
+ * Returns its class, SEQ_WINDOW_NEW and so on.
+ */
+int
+seq_window_update(seq_window_t *w, uint32_t seq, const struct timeval *sent)
+{
+  uint32_t behind;
+
+  if(!w->started) {
+    start(w, seq, sent);
+    w->received++;
+    return SEQ_WINDOW_NEW;
+  }
+
+  if(seq > w->highest) {
+    advance(w, seq);
+    if(sent != NULL) {
+      w->highestTime = *sent;
+    }
+    w->received++;
+    return SEQ_WINDOW_NEW;
+  }
+
+  behind = w->highest - seq;
+  if(sent != NULL ? timercmp(sent, &w->highestTime, >) :
+     (behind >= SEQ_WINDOW_SIZE && seq < SEQ_WINDOW_SIZE)) {
+    /* The sender started over; what it did not get through is lost */
+    w->lost += seq_window_missing(w);
+    w->expected += w->highest - w->first + 1;
+    w->restarts++;
+    start(w, seq, sent);
+    w->received++;
+    return SEQ_WINDOW_RESTART;
+  }
+
+  if(behind >= SEQ_WINDOW_SIZE) {
+    /* Lost or a duplicate, the window can no longer tell */
+    w->late++;
+    return SEQ_WINDOW_LATE;
+  }
+
+  if(seq < w->first) {
+    /* From before the first one we saw; the window starts there now */
+    w->first = seq;
+  } else if(w->bits[SLOT(seq)] & MASK(seq)) {
+    w->duplicates++;
+    return SEQ_WINDOW_DUPLICATE;
+  }
+  w->bits[SLOT(seq)] |= MASK(seq);
+  w->reordered++;
+  w->received++;
+  return SEQ_WINDOW_REORDERED;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,53 @@
+#ifndef SEQ_WINDOW_H
+#define SEQ_WINDOW_H
+
+/*
+ * Sequence number window of a flow. A bitmap remembers which of the last
+ * SEQ_WINDOW_SIZE sequence numbers arrived, so a packet is classified as
+ * new, duplicate or reordered, and a missing one counts as lost only
+ * once it leaves the window. A sender restart is recognized by a lower
+ * sequence number sent after the highest one, or, only without send
+ * times, by a sequence number that falls back below the window into its
+ * first SEQ_WINDOW_SIZE values.
+ *
+ * A packet that arrives below the window, already counted lost, is only
+ * counted in late: received and lost, and so the delivery ratio
+ * received / expected, leave it out.
+ */
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#define SEQ_WINDOW_SIZE 256 /* a multiple of 32 */
+
+/* Classes of a packet */
+#define SEQ_WINDOW_NEW       0 /* above all so far */
+#define SEQ_WINDOW_REORDERED 1 /* below the highest, within the window */
+#define SEQ_WINDOW_LATE      2 /* below the window, already counted lost */
+#define SEQ_WINDOW_DUPLICATE 3
+#define SEQ_WINDOW_RESTART   4 /* first of a restarted sender */
+
+typedef struct _seq_window_
+{
+  uint32_t first;       /* first sequence number since the (re)start */
+  uint32_t highest;
+  struct timeval highestTime; /* send time of the highest */
+  uint32_t bits[SEQ_WINDOW_SIZE / 32];
+  uint8_t started;
+
+  /* Counts over all restarts */
+  uint32_t received;    /* distinct packets */
+  uint32_t duplicates;
+  uint32_t reordered;
+  uint32_t late;        /* below the window, in no other count */
+  uint32_t lost;        /* missing when they left the window */
+  uint32_t restarts;
+  uint32_t expected;    /* sequence numbers before the last restart */
+}seq_window_t;
+
+int seq_window_update(seq_window_t *w, uint32_t seq,
+                      const struct timeval *sent);
+uint32_t seq_window_expected(const seq_window_t *w);
+uint32_t seq_window_missing(const seq_window_t *w);
+
+#endif /* SEQ_WINDOW_H */
@@ -32,6 +32,7 @@
 #include "contiki-net.h"
 #include "net/ip/uip.h"
 #include "net/rpl/rpl.h"
+#include "net/rpl/rpl-dag-root.h"
 #include "net/rime/rimeaddr.h"
 
 #include "net/netstack.h"
@@ -50,24 +51,26 @@
 #include "collect-view.h"
 #include "common-hdr.h"
 #include "udp-app.h"
+#include "sink-log.h"
 
 
 #define DEBUG DEBUG_PRINT
 #include "net/ip/uip-debug.h"
 
-#define UIP_IP_BUF   ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
-
 #define UDP_CLIENT_PORT 8765
 #define UDP_SERVER_PORT 5678
 
 #define UDP_EXAMPLE_ID  190
 
+/* Interval of the latency percentiles dump */
+#define STATS_DUMP_INTERVAL (60 * CLOCK_SECOND)
+
 static struct uip_udp_conn *server_conn;
+static struct ctimer dump_timer;
 
 PROCESS(udp_server_process, "UDP server process");
 AUTOSTART_PROCESSES(&udp_server_process,&collect_common_process);
 
-#define	MAX_NODES	1000
 	
 	#if 0
 	typedef struct _dpkt_stat_
@@ -82,24 +85,186 @@ AUTOSTART_PROCESSES(&udp_server_process,&collect_common_process);
 	}dpkt_stat_t;
 	#endif
 	
-	dpkt_stat_t g_dstats[MAX_NODES];
-	uint32_t g_ds_cnt;
+/*
+ * Per-flow statistics, in an open-addressed table keyed on the interface
+ * identifier of the source and its flow id, with linear probing. The table
+ * doubles when it gets 3/4 full, up to DSTATS_MAX_SIZE slots; from then
+ * on a new source takes the place of the one idle for the longest, if
+ * that one has been idle for DSTATS_IDLE_TIME.
+ */
+#define DSTATS_INIT_SIZE 64   /* slots, a power of two */
+#define DSTATS_MAX_SIZE  16384
+#define DSTATS_IDLE_TIME 600  /* seconds */
 
-	
-	dpkt_stat_t *get_dpkt_stat(uip_ipaddr_t *srcip)
-	{
-		int i;
-		dpkt_stat_t *ds;
-	
-		for(i=0;i<g_ds_cnt;i++) {
-			ds = &(g_dstats[i]);
-			if(uip_ipaddr_cmp(srcip, &ds->ip)) {
-				return ds;
-			}
-		}
-		return NULL;
-	}
-	
+typedef struct _dstat_slot_
+{
+  uint64_t iid;
+  uint8_t flow;
+  uint8_t used;
+  dpkt_stat_t stat;
+}dstat_slot_t;
+
+static dstat_slot_t *g_dstats;
+static uint32_t g_ds_size;
+uint32_t g_ds_cnt;
+/*---------------------------------------------------------------------------*/
+static uint64_t
+dstat_iid(const uip_ipaddr_t *ip)
+{
+  uint64_t iid;
+
+  memcpy(&iid, &ip->u8[8], sizeof(iid));
+  return iid;
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t
+dstat_home(uint64_t iid, uint8_t flow)
+{
+  /* Fibonacci hashing spreads the sequential IIDs of a simulation */
+  return (uint32_t)(((iid ^ flow) * 0x9e3779b97f4a7c15ULL) >> 32) &
+    (g_ds_size - 1);
+}
+/*---------------------------------------------------------------------------*/
+static dstat_slot_t *
+dstat_lookup(uint64_t iid, uint8_t flow)
+{
+  uint32_t i;
+
+  if(g_ds_size == 0) {
+    return NULL;
+  }
+  for(i = dstat_home(iid, flow); g_dstats[i].used;
+      i = (i + 1) & (g_ds_size - 1)) {
+    if(g_dstats[i].iid == iid && g_dstats[i].flow == flow) {
+      return &g_dstats[i];
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns the free slot for iid and flow, which must not be in the table */
+static dstat_slot_t *
+dstat_free_slot(uint64_t iid, uint8_t flow)
+{
+  uint32_t i;
+
+  for(i = dstat_home(iid, flow); g_dstats[i].used;
+      i = (i + 1) & (g_ds_size - 1));
+  return &g_dstats[i];
+}
+/*---------------------------------------------------------------------------*/
+static int
+dstat_grow(void)
+{
+  dstat_slot_t *old;
+  uint32_t old_size;
+  uint32_t i;
+
+  old = g_dstats;
+  old_size = g_ds_size;
+  g_ds_size = old_size ? old_size * 2 : DSTATS_INIT_SIZE;
+  g_dstats = calloc(g_ds_size, sizeof(dstat_slot_t));
+  if(g_dstats == NULL) {
+    g_dstats = old;
+    g_ds_size = old_size;
+    return 0;
+  }
+
+  for(i = 0; i < old_size; i++) {
+    if(old[i].used) {
+      *dstat_free_slot(old[i].iid, old[i].flow) = old[i];
+    }
+  }
+  free(old);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Removes a slot, shifting back the slots that probed past it */
+static void
+dstat_remove(dstat_slot_t *slot)
+{
+  uint32_t hole;
+  uint32_t i;
+  uint32_t home;
+
+  hole = slot - g_dstats;
+  g_dstats[hole].used = 0;
+  g_ds_cnt--;
+
+  for(i = (hole + 1) & (g_ds_size - 1); g_dstats[i].used;
+      i = (i + 1) & (g_ds_size - 1)) {
+    home = dstat_home(g_dstats[i].iid, g_dstats[i].flow);
+    /* Can the entry at i move to the hole, i.e. is its home not
+       cyclically in (hole, i]? */
+    if(((i - home) & (g_ds_size - 1)) >= ((i - hole) & (g_ds_size - 1))) {
+      g_dstats[hole] = g_dstats[i];
+      g_dstats[i].used = 0;
+      hole = i;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+dstat_evict_idle(void)
+{
+  dstat_slot_t *oldest;
+  unsigned long now;
+  uint32_t i;
+
+  oldest = NULL;
+  for(i = 0; i < g_ds_size; i++) {
+    if(g_dstats[i].used &&
+       (oldest == NULL || g_dstats[i].stat.lastSeen < oldest->stat.lastSeen)) {
+      oldest = &g_dstats[i];
+    }
+  }
+
+  now = clock_seconds();
+  if(oldest == NULL || now - oldest->stat.lastSeen < DSTATS_IDLE_TIME) {
+    return 0;
+  }
+  PRINTF("dstats: evicting [%d/%u], idle for %lu s\n",
+         oldest->stat.ip.u8[sizeof(oldest->stat.ip.u8) - 1], oldest->flow,
+         now - oldest->stat.lastSeen);
+  dstat_remove(oldest);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+dpkt_stat_t *
+get_dpkt_stat(uip_ipaddr_t *srcip, uint8_t flow)
+{
+  dstat_slot_t *slot;
+
+  slot = dstat_lookup(dstat_iid(srcip), flow);
+  return slot != NULL ? &slot->stat : NULL;
+}
+/*---------------------------------------------------------------------------*/
+static dpkt_stat_t *
+add_dpkt_stat(uip_ipaddr_t *srcip, uint8_t flow)
+{
+  dstat_slot_t *slot;
+  uint64_t iid;
+
+  if((g_ds_cnt + 1) * 4 > g_ds_size * 3) {
+    if(g_ds_size >= DSTATS_MAX_SIZE || !dstat_grow()) {
+      if(!dstat_evict_idle()) {
+        return NULL;
+      }
+    }
+  }
+
+  iid = dstat_iid(srcip);
+  slot = dstat_free_slot(iid, flow);
+  memset(slot, 0, sizeof(dstat_slot_t));
+  slot->iid = iid;
+  slot->flow = flow;
+  slot->used = 1;
+  slot->stat.ip = *srcip;
+  slot->stat.flow = flow;
+  g_ds_cnt++;
+  return &slot->stat;
+}
+/*---------------------------------------------------------------------------*/
 	long dpkt_latency_time(struct timeval *tv)
 	
 	{
@@ -159,6 +324,7 @@ collect_common_net_init(void)
   uart1_set_input(serial_line_input_byte);
 #endif */
   serial_line_init();
+  sink_log_init();
 
   PRINTF("I am sink!\n");
 }
@@ -174,60 +340,89 @@ tcpip_handler(void)
     return;
   }
 
+  if(uip_datalen() < sizeof(dpkt_t)) {
+    PRINTF("DATA too short [%u]\n", uip_datalen());
+    return;
+  }
+
   pkt = (dpkt_t *)uip_appdata;
-  ds = get_dpkt_stat(&(UIP_IP_BUF->srcipaddr));
+  ds = get_dpkt_stat(&(UIP_IP_BUF->srcipaddr), pkt->flow);
   if(!ds) {
-    if(g_ds_cnt>=MAX_NODES) {
+    ds = add_dpkt_stat(&(UIP_IP_BUF->srcipaddr), pkt->flow);
+    if(!ds) {
       printf("dstats exceeded!\n");
       return;
     }
-
-    ds = &g_dstats[g_ds_cnt++];
-    memset(ds, 0, sizeof(dpkt_stat_t));
-    ds->ip = UIP_IP_BUF->srcipaddr;
   }
+  ds->lastSeen = clock_seconds();
 
-  if (!ds->lastseq){
-    ds->lastseq = pkt->seq;
-    ds->rcvcnt++;
-    ds->leastLatency = ds->maxLatency = curpktlatency = dpkt_latency_time(&(pkt->sendTime));
-    goto SEND_REPLY;
-  }
-
-  if (pkt->seq == ds->lastseq){
-    ds->dupcnt++;
-  }
-  else if(pkt->seq < ds->lastseq) {
-    ds->unordered++;
-    ds->rcvcnt++;
-  }
-  else{
-    ds->lastseq = pkt->seq;
-    ds->rcvcnt++;
-  }
-  
   curpktlatency = dpkt_latency_time(&(pkt->sendTime));
-  if (curpktlatency < ds->leastLatency){
+  if (!ds->rcvcnt || curpktlatency < ds->leastLatency){
     ds->leastLatency = curpktlatency;
   }
   
   if (curpktlatency > ds->maxLatency){
     ds->maxLatency = curpktlatency;
   }
-  
-  SEND_REPLY:
-  PRINTF("DATA Received from [%d] with seq[%d] in duration[%ld mus] min duration[%ld mus] pkt drop[%u]\n",
-         ds->ip.u8[sizeof(ds->ip.u8) - 1], pkt->seq, curpktlatency, ds->leastLatency, (ds->lastseq - ds->rcvcnt));
+
+  if(seq_window_update(&ds->window, pkt->seq, &(pkt->sendTime)) ==
+     SEQ_WINDOW_RESTART) {
+    PRINTF("DATA source [%d/%u] restarted at seq[%d]\n",
+           ds->ip.u8[sizeof(ds->ip.u8) - 1], ds->flow, pkt->seq);
+  }
+  ds->lastseq = ds->window.highest;
+  ds->rcvcnt = ds->window.received;
+  ds->dupcnt = ds->window.duplicates;
+  ds->unordered = ds->window.reordered;
+  ds->dropcnt = ds->window.lost;
+
+  latency_hist_add(&ds->latency, curpktlatency);
+  if(!sink_log_data(&ds->ip, ds->flow, pkt->seq, curpktlatency,
+                    uip_datalen())) {
+    PRINTF("DATA Received from [%d/%u] with seq[%d] in duration[%ld mus] min duration[%ld mus] pkt drop[%u]\n",
+           ds->ip.u8[sizeof(ds->ip.u8) - 1], ds->flow, pkt->seq, curpktlatency, ds->leastLatency, ds->dropcnt);
+  }
 
 #if SERVER_REPLY
   PRINTF("DATA sending reply\n");
   uip_ipaddr_copy(&server_conn->ripaddr, &UIP_IP_BUF->srcipaddr);
+  pkt->upLatency = curpktlatency;
   //uip_udp_packet_send(server_conn, "Reply", sizeof("Reply"));
   uip_udp_packet_send(server_conn, (unsigned char *)pkt, sizeof(dpkt_t));
   uip_create_unspecified(&server_conn->ripaddr);
 #endif
 }
 /*---------------------------------------------------------------------------*/
+/* Upward latency percentiles, of each flow and of all of them */
+static void
+dump_stats(void *ptr)
+{
+  static latency_hist_t all;
+  long pct[LATENCY_PCT_NUM];
+  dpkt_stat_t *ds;
+  uint32_t i;
+
+  memset(&all, 0, sizeof(all));
+  for(i = 0; i < g_ds_size; i++) {
+    if(!g_dstats[i].used) {
+      continue;
+    }
+    ds = &g_dstats[i].stat;
+    latency_hist_merge(&all, &ds->latency);
+    latency_hist_percentiles(&ds->latency, pct);
+    PRINTF("STATS [%d/%u] rcv %u/%u lost %u late %u (not in rcv) dup %u reord %u restarts %u latency p50 %ld p90 %ld p99 %ld p99.9 %ld mus\n",
+           ds->ip.u8[sizeof(ds->ip.u8) - 1], ds->flow, ds->rcvcnt,
+           seq_window_expected(&ds->window), ds->dropcnt, ds->window.late,
+           ds->dupcnt, ds->unordered, ds->window.restarts,
+           pct[0], pct[1], pct[2], pct[3]);
+  }
+
+  latency_hist_percentiles(&all, pct);
+  printf("STATS %u flows, %lu pkts, latency p50 %ld p90 %ld p99 %ld p99.9 %ld mus\n",
+         g_ds_cnt, (unsigned long)all.count, pct[0], pct[1], pct[2], pct[3]);
+  ctimer_reset(&dump_timer);
+}
+/*---------------------------------------------------------------------------*/
 static void
 print_local_addresses(void)
 {
@@ -287,16 +482,29 @@ PROCESS_THREAD(udp_server_process, ev, data)
   uip_ds6_set_addr_iid(&ipaddr, &uip_lladdr);
 #endif
 
-  uip_ds6_addr_add(&ipaddr, 0, ADDR_MANUAL);
-  root_if = uip_ds6_addr_lookup(&ipaddr);
-  if(root_if != NULL) {
-    rpl_dag_t *dag;
-    dag = rpl_set_root(RPL_DEFAULT_INSTANCE,(uip_ip6addr_t *)&ipaddr);
-    uip_ip6addr(&ipaddr, UIP_DS6_DEFAULT_PREFIX, 0, 0, 0, 0, 0, 0, 0);
-    rpl_set_prefix(dag, &ipaddr, 64);
-    PRINTF("created a new RPL dag\n");
-  } else {
-    PRINTF("failed to create a new RPL DAG\n");
+#if RPL_ROOT_SYNC
+  /* BACKUP_ROOT=1 runs this server as the hot standby of the root, which
+     takes over the root address along with the DAG */
+  if(getenv("BACKUP_ROOT") != NULL && atoi(getenv("BACKUP_ROOT"))) {
+    PRINTF("Standing by as backup root\n");
+    rpl_dag_root_init_backup();
+  } else
+#endif /* RPL_ROOT_SYNC */
+  {
+    uip_ds6_addr_add(&ipaddr, 0, ADDR_MANUAL);
+    root_if = uip_ds6_addr_lookup(&ipaddr);
+    if(root_if != NULL) {
+      rpl_dag_t *dag;
+      dag = rpl_set_root(RPL_DEFAULT_INSTANCE,(uip_ip6addr_t *)&ipaddr);
+      uip_ip6addr(&ipaddr, UIP_DS6_DEFAULT_PREFIX, 0, 0, 0, 0, 0, 0, 0);
+      rpl_set_prefix(dag, &ipaddr, 64);
+      PRINTF("created a new RPL dag\n");
+#if RPL_ROOT_SYNC
+      rpl_dag_root_serve_backup();
+#endif /* RPL_ROOT_SYNC */
+    } else {
+      PRINTF("failed to create a new RPL DAG\n");
+    }
   }
 #endif /* UIP_CONF_ROUTER */
 
@@ -312,6 +520,7 @@ if(server_conn == NULL) {
 	    PROCESS_EXIT();
 	  }
   udp_bind(server_conn, UIP_HTONS(UDP_SERVER_PORT));
+  ctimer_set(&dump_timer, STATS_DUMP_INTERVAL, dump_stats, NULL);
 
   PRINTF("Created a server connection with remote address ");
   PRINT6ADDR(&server_conn->ripaddr);
@@ -353,18 +562,27 @@ if(server_conn == NULL) {
 	
 	 PRINTF("Stats Called on BR\n");
 	 dpkt_stat_t *ds;
-	 for(i=0;i<g_ds_cnt;i++) {
-	  ds = &(g_dstats[i]);
+	 memset(&appstat->upwardhist, 0, sizeof(appstat->upwardhist));
+	 memset(&appstat->roundtriphist, 0, sizeof(appstat->roundtriphist));
+	 memset(appstat->roundtrippct, 0, sizeof(appstat->roundtrippct));
+	 for(i=0;i<g_ds_size;i++) {
+	  if (!g_dstats[i].used){
+	    continue;
+	  }
+	  ds = &(g_dstats[i].stat);
 	   if (!ds->rcvcnt){
 	     continue;
 	   }  
 	
-	   s += ds->lastseq;
+	   s += seq_window_expected(&ds->window);
 	   r += ds->rcvcnt;
 	   d += ds->dupcnt;
+	   latency_hist_merge(&appstat->upwardhist, &ds->latency);
 	 }
 	 
 	 appstat->totalpktsent = s;
 	 appstat->totalpktrecvd = r;
 	 appstat->totalduppkt = d;
+	 appstat->flowcnt = 0;
+	 latency_hist_percentiles(&appstat->upwardhist, appstat->upwardpct);
 	}
@@ -0,0 +1,122 @@
+/**
+ * \file
+ *         Binary record log of the sink, see sink-log.h. Records are
+ *         copied into a large stdio buffer that is written out when full
+ *         and flushed every SINK_LOG_FLUSH_INTERVAL, so that the sink
+ *         does no formatting and few system calls per packet.
+ */
+
+#include "contiki.h"
+#include "sys/ctimer.h"
+#include "sink-log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define SINK_LOG_BUFSIZE        65536
+#define SINK_LOG_FLUSH_INTERVAL CLOCK_SECOND
+
+static FILE *log_file;
+static char log_buffer[SINK_LOG_BUFSIZE];
+static struct ctimer flush_timer;
+/*---------------------------------------------------------------------------*/
+static void
+flush(void *ptr)
+{
+  fflush(log_file);
+  ctimer_reset(&flush_timer);
+}
+/*---------------------------------------------------------------------------*/
+static void
+write_record(uint8_t type, const void *body, uint16_t body_len,
+             const void *extra, uint16_t extra_len)
+{
+  struct sink_log_hdr h;
+  struct timeval tv;
+
+  if(extra_len > 0xffff - sizeof(h) - body_len) {
+    extra_len = 0xffff - sizeof(h) - body_len;
+  }
+
+  gettimeofday(&tv, NULL);
+  h.len = sizeof(h) + body_len + extra_len;
+  h.type = type;
+  h.reserved = 0;
+  h.sec = tv.tv_sec;
+  h.usec = tv.tv_usec;
+
+  fwrite(&h, sizeof(h), 1, log_file);
+  fwrite(body, body_len, 1, log_file);
+  if(extra_len > 0) {
+    fwrite(extra, extra_len, 1, log_file);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Opens the log named by SINK_LOG, if any. A pipe blocks until read. */
+void
+sink_log_init(void)
+{
+  struct sink_log_file_hdr fh;
+  const char *path;
+
+  path = getenv("SINK_LOG");
+  if(log_file != NULL || path == NULL || *path == '\0') {
+    return;
+  }
+
+  log_file = fopen(path, "wb");
+  if(log_file == NULL) {
+    printf("sink log: cannot open %s\n", path);
+    return;
+  }
+  setvbuf(log_file, log_buffer, _IOFBF, sizeof(log_buffer));
+
+  fh.magic = SINK_LOG_MAGIC;
+  fh.version = SINK_LOG_VERSION;
+  fh.reserved = 0;
+  fwrite(&fh, sizeof(fh), 1, log_file);
+  ctimer_set(&flush_timer, SINK_LOG_FLUSH_INTERVAL, flush, NULL);
+  printf("sink log: writing to %s\n", path);
+}
+/*---------------------------------------------------------------------------*/
+/* Returns 0 if there is no log, for the caller to print instead */
+int
+sink_log_collect(const rimeaddr_t *originator, uint8_t seqno, uint8_t hops,
+                 const uint8_t *payload, uint16_t payload_len)
+{
+  struct sink_log_collect c;
+
+  if(log_file == NULL) {
+    return 0;
+  }
+
+  c.originator = originator->u8[0] + (originator->u8[1] << 8);
+  c.seqno = seqno;
+  c.hops = hops;
+  write_record(SINK_LOG_COLLECT, &c, sizeof(c), payload, payload_len & ~1);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns 0 if there is no log, for the caller to print instead */
+int
+sink_log_data(const uip_ipaddr_t *src, uint8_t flow, uint32_t seq,
+              long latency, uint16_t len)
+{
+  struct sink_log_data d;
+
+  if(log_file == NULL) {
+    return 0;
+  }
+
+  memcpy(d.src, src, sizeof(d.src));
+  d.seq = seq;
+  d.latency = latency;
+  d.len = len;
+  d.flow = flow;
+  d.reserved = 0;
+  write_record(SINK_LOG_DATA, &d, sizeof(d), NULL, 0);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
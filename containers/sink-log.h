@@ -0,0 +1,63 @@
+#ifndef SINK_LOG_H
+#define SINK_LOG_H
+
+/*
+ * Binary record log of the sink. Started with SINK_LOG=<file or pipe> in
+ * the environment of the server; without it the sink prints as before.
+ * tools/sink-log-csv.py converts a log to CSV.
+ *
+ * The log starts with a struct sink_log_file_hdr, followed by records
+ * made of a struct sink_log_hdr and a body of the record type. All
+ * fields are in host byte order, the magic tells which one.
+ */
+
+#include <stdint.h>
+#include "net/ip/uip.h"
+#include "net/rime/rimeaddr.h"
+
+#define SINK_LOG_MAGIC   0x4c4b4e53 /* "SNKL" */
+#define SINK_LOG_VERSION 1
+
+/* Record types */
+#define SINK_LOG_COLLECT 1 /* struct sink_log_collect + payload */
+#define SINK_LOG_DATA    2 /* struct sink_log_data */
+
+struct sink_log_file_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+};
+
+struct sink_log_hdr {
+  uint16_t len;  /* of the record, this header included */
+  uint8_t type;
+  uint8_t reserved;
+  uint32_t sec;  /* gettimeofday() at reception */
+  uint32_t usec;
+};
+
+/* A collect message, its payload words follow */
+struct sink_log_collect {
+  uint16_t originator;
+  uint8_t seqno;
+  uint8_t hops;
+};
+
+/* A data packet of a UDP client */
+struct sink_log_data {
+  uint8_t src[16];
+  uint32_t seq;
+  int32_t latency;  /* microseconds */
+  uint16_t len;     /* UDP payload */
+  uint8_t flow;     /* of the source, 0 in logs of single flow clients */
+  uint8_t reserved;
+};
+
+void sink_log_init(void);
+int sink_log_collect(const rimeaddr_t *originator, uint8_t seqno,
+                     uint8_t hops, const uint8_t *payload,
+                     uint16_t payload_len);
+int sink_log_data(const uip_ipaddr_t *src, uint8_t flow, uint32_t seq,
+                  long latency, uint16_t len);
+
+#endif /* SINK_LOG_H */
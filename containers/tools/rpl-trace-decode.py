@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# Decodes the RPL trace rings of one or more nodes into a single timeline.
+# The ring format is described in rpl/rpl-trace.h.
+#
+# Usage: rpl-trace-decode.py [--csv] /dev/shm/rpl-trace-* > timeline.txt
+#
+# A ring can be decoded while its node runs; records that the node may
+# have overwritten during the read are left out.
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x52504c54
+VERSION = 1
+
+HEADER = struct.Struct("<IHHIIII8s")
+RECORD = struct.Struct("<IHHII")
+
+INFINITE_RANK = 0xffff
+
+# Event id: name and the labels of its arguments, None for unused ones
+EVENTS = {
+    1: ("dis-in", (None, "from", None)),
+    2: ("dio-in", ("rank", "from", "version-instance")),
+    3: ("dio-out", ("rank", "to", "version-instance")),
+    4: ("dao-in", ("lifetime", "from", "target")),
+    5: ("dao-out", ("lifetime", "parent", "target")),
+    6: ("best-parent", ("rank", "best", "current")),
+    7: ("rank", ("rank", "parent", "base")),
+    8: ("metric-update", ("rank", "parent", "objects")),
+    9: ("parent-switch", ("rank", "parent", "old")),
+    10: ("local-repair", ("rank", None, None)),
+    11: ("global-repair", ("rank", None, "version")),
+}
+
+ADDRESS_ARGS = ("from", "to", "target", "parent", "best", "current", "old")
+
+
+def format_addr(value):
+    if value == 0:
+        return "-"
+    return "%04x:%04x" % (value >> 16, value & 0xffff)
+
+
+def format_arg(label, value):
+    if label in ADDRESS_ARGS:
+        return format_addr(value)
+    if label == "rank" and value == INFINITE_RANK:
+        return "inf"
+    if label == "version-instance":
+        return "%u/%u" % (value >> 8, value & 0xff)
+    return str(value)
+
+
+def read_ring(path):
+    with open(path, "rb") as f:
+        data = f.read()
+        # The head once more, after the records were copied
+        f.seek(0)
+        head_after = HEADER.unpack_from(f.read(HEADER.size))[6]
+
+    if len(data) < HEADER.size:
+        raise ValueError("%s: too short" % path)
+    (magic, version, record_size, num_records, ticks_per_second,
+     start_time, head, lladdr) = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("%s: not an RPL trace ring" % path)
+    if record_size != RECORD.size or \
+       len(data) < HEADER.size + num_records * record_size:
+        raise ValueError("%s: bad record layout" % path)
+
+    node = "%02x%02x" % (lladdr[6], lladdr[7])
+    first = max(head_after - num_records + 1, 0)
+    records = []
+    for i in range(first, head):
+        offset = HEADER.size + (i % num_records) * record_size
+        time, event, a, b, c = RECORD.unpack_from(data, offset)
+        records.append((time, node, i, event, a, b, c))
+    lost = first if head > 0 else 0
+    return records, ticks_per_second, lost
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode RPL trace rings")
+    parser.add_argument("--csv", action="store_true",
+                        help="write CSV instead of a text timeline")
+    parser.add_argument("rings", nargs="+", help="trace ring files")
+    args = parser.parse_args()
+
+    records = []
+    ticks_per_second = None
+    for path in args.rings:
+        try:
+            ring, tps, lost = read_ring(path)
+        except (OSError, ValueError) as e:
+            print("skipping %s" % e, file=sys.stderr)
+            continue
+        if ticks_per_second is not None and tps != ticks_per_second:
+            print("%s: clock rate differs, skipped" % path, file=sys.stderr)
+            continue
+        ticks_per_second = tps
+        if lost:
+            print("%s: %u older records were overwritten" % (path, lost),
+                  file=sys.stderr)
+        records.extend(ring)
+
+    # Node clocks are comparable in a simulation; keep the ring order
+    # for records of the same node and tick.
+    records.sort(key=lambda r: (r[0], r[1], r[2]))
+
+    out = sys.stdout
+    if args.csv:
+        out.write("time,node,event,a,b,c\n")
+    for time, node, _, event, a, b, c in records:
+        seconds = float(time) / ticks_per_second
+        name, labels = EVENTS.get(event, ("event-%u" % event,
+                                          ("a", "b", "c")))
+        if args.csv:
+            out.write("%.3f,%s,%s,%u,%u,%u\n" % (seconds, node, name, a, b, c))
+            continue
+        fields = ["%s=%s" % (label, format_arg(label, value))
+                  for label, value in zip(labels, (a, b, c))
+                  if label is not None]
+        out.write("%12.3f %s %-14s %s\n" % (seconds, node, name,
+                                            " ".join(fields)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+#
+# Converts the binary log of the sink (SINK_LOG=<file> for the server) to
+# CSV. The record format is described in containers/sink-log.h.
+#
+# Usage: sink-log-csv.py [--type data|collect] <log or -> > out.csv
+
+import argparse
+import ipaddress
+import struct
+import sys
+
+MAGIC = 0x4c4b4e53
+VERSION = 1
+
+COLLECT = 1
+DATA = 2
+
+
+def records(f):
+    head = f.read(8)
+    if len(head) < 8:
+        raise ValueError("not a sink log")
+    for order in ("<", ">"):
+        magic, version, _ = struct.unpack(order + "IHH", head)
+        if magic == MAGIC:
+            break
+    else:
+        raise ValueError("not a sink log")
+    if version != VERSION:
+        raise ValueError("unknown sink log version %u" % version)
+
+    hdr = struct.Struct(order + "HBBII")
+    while True:
+        raw = f.read(hdr.size)
+        if len(raw) < hdr.size:
+            return
+        length, rtype, _, sec, usec = hdr.unpack(raw)
+        if length < hdr.size:
+            raise ValueError("corrupt record")
+        body = f.read(length - hdr.size)
+        if len(body) < length - hdr.size:
+            # The sink is still writing it
+            return
+        yield order, rtype, sec + usec / 1e6, body
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a sink log to CSV")
+    parser.add_argument("--type", choices=("data", "collect"), default="data",
+                        help="records to convert (default: data)")
+    parser.add_argument("log", help="sink log file, - for stdin")
+    args = parser.parse_args()
+
+    f = sys.stdin.buffer if args.log == "-" else open(args.log, "rb")
+    out = sys.stdout
+    if args.type == "data":
+        out.write("time,src,flow,seq,latency_us,len\n")
+    else:
+        out.write("time,originator,seqno,hops,data\n")
+
+    try:
+        for order, rtype, time, body in records(f):
+            if args.type == "data" and rtype == DATA:
+                src = ipaddress.IPv6Address(body[:16])
+                seq, latency, length, flow = struct.unpack_from(
+                    order + "IiHB", body, 16)
+                out.write("%.6f,%s,%u,%u,%d,%u\n" % (time, src, flow, seq,
+                                                      latency, length))
+            elif args.type == "collect" and rtype == COLLECT:
+                originator, seqno, hops = struct.unpack_from(order + "HBB",
+                                                             body)
+                words = struct.unpack_from(order + "%uH" % ((len(body) - 4) // 2),
+                                           body, 4)
+                out.write("%.6f,%u,%u,%u,%s\n" % (time, originator, seqno,
+                                                   hops,
+                                                   " ".join(map(str, words))))
+    except ValueError as e:
+        print("%s: %s" % (args.log, e), file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
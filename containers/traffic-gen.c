@@ -0,0 +1,299 @@
+/**
+ * \file
+ *         Traffic flows of a UDP client, see traffic-gen.h. Due times are
+ *         kept in fractional clock ticks, so that rounding to the clock
+ *         does not add up to a rate error.
+ */
+
+#include "traffic-gen.h"
+#include "lib/random.h"
+#include "net/ip/uiplib.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ip/uip-debug.h"
+
+#define TRAFFIC_DEFAULT_LEN 32
+#define TRAFFIC_SPEC_LEN    256
+/*---------------------------------------------------------------------------*/
+/* Uniform in (0, 1] */
+static double
+uniform(void)
+{
+  return (random_rand() + 1.0) / (RANDOM_RAND_MAX + 1.0);
+}
+/*---------------------------------------------------------------------------*/
+static double
+exponential(double mean)
+{
+  return -mean * log(uniform());
+}
+/*---------------------------------------------------------------------------*/
+static int
+load_trace(traffic_flow_t *f, const char *path)
+{
+  FILE *fp;
+  char line[128];
+  uint32_t size;
+  double total;
+  double gap;
+  int len;
+  int n;
+  void *p;
+
+  fp = fopen(path, "r");
+  if(fp == NULL) {
+    printf("traffic: cannot open trace %s\n", path);
+    return 0;
+  }
+
+  size = 0;
+  total = 0;
+  while(fgets(line, sizeof(line), fp) != NULL) {
+    n = sscanf(line, "%lf %d", &gap, &len);
+    if(n < 1 || line[0] == '#' || gap < 0) {
+      continue;
+    }
+    if(f->traceNum == size) {
+      size = size ? size * 2 : 256;
+      p = realloc(f->traceGap, size * sizeof(float));
+      if(p == NULL) {
+        break;
+      }
+      f->traceGap = p;
+      p = realloc(f->traceLen, size * sizeof(uint16_t));
+      if(p == NULL) {
+        break;
+      }
+      f->traceLen = p;
+    }
+    f->traceGap[f->traceNum] = gap;
+    f->traceLen[f->traceNum] = n > 1 && len >= 0 ? len : f->payloadLen;
+    f->traceNum++;
+    total += gap;
+  }
+  fclose(fp);
+
+  if(f->traceNum == 0 || total <= 0) {
+    printf("traffic: no gaps in trace %s\n", path);
+    free(f->traceGap);
+    free(f->traceLen);
+    f->traceGap = NULL;
+    f->traceLen = NULL;
+    return 0;
+  }
+  f->traceRate = f->traceNum / total;
+  /* Replayed at its own rate unless rate= was given */
+  if(f->rate <= 0) {
+    f->rate = f->traceRate;
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Parses "<model>[,<key>=<value>...]", see traffic-gen.h */
+int
+traffic_gen_parse(traffic_flow_t *f, uint8_t id, const char *spec)
+{
+  char buf[TRAFFIC_SPEC_LEN];
+  const char *file;
+  char *tok;
+  char *val;
+
+  memset(f, 0, sizeof(*f));
+  f->id = id;
+  f->payloadLen = TRAFFIC_DEFAULT_LEN;
+  file = NULL;
+
+  strncpy(buf, spec, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+
+  tok = strtok(buf, ",");
+  if(tok == NULL) {
+    return 0;
+  }
+  if(!strcmp(tok, "cbr")) {
+    f->model = TRAFFIC_CBR;
+  } else if(!strcmp(tok, "poisson")) {
+    f->model = TRAFFIC_POISSON;
+  } else if(!strcmp(tok, "onoff")) {
+    f->model = TRAFFIC_ONOFF;
+  } else if(!strcmp(tok, "trace")) {
+    f->model = TRAFFIC_TRACE;
+  } else {
+    printf("traffic: flow %u, unknown model %s\n", id, tok);
+    return 0;
+  }
+
+  while((tok = strtok(NULL, ",")) != NULL) {
+    val = strchr(tok, '=');
+    if(val == NULL) {
+      printf("traffic: flow %u, %s without value\n", id, tok);
+      return 0;
+    }
+    *val++ = '\0';
+    if(!strcmp(tok, "rate")) {
+      f->rate = atof(val);
+    } else if(!strcmp(tok, "len")) {
+      f->payloadLen = atoi(val);
+    } else if(!strcmp(tok, "dst")) {
+      if(!uiplib_ipaddrconv(val, &f->dest)) {
+        printf("traffic: flow %u, bad address %s\n", id, val);
+        return 0;
+      }
+    } else if(!strcmp(tok, "on")) {
+      f->onTime = atof(val);
+    } else if(!strcmp(tok, "off")) {
+      f->offTime = atof(val);
+    } else if(!strcmp(tok, "file")) {
+      /* Loaded last, its lines default to len= */
+      file = val;
+    } else {
+      printf("traffic: flow %u, unknown key %s\n", id, tok);
+      return 0;
+    }
+  }
+
+  if(f->model == TRAFFIC_TRACE) {
+    if(file == NULL) {
+      printf("traffic: flow %u, trace without file=\n", id);
+      return 0;
+    }
+    return load_trace(f, file);
+  }
+  if(f->rate <= 0) {
+    printf("traffic: flow %u, no rate=\n", id);
+    return 0;
+  }
+  if(f->model == TRAFFIC_ONOFF && (f->onTime <= 0 || f->offTime < 0)) {
+    printf("traffic: flow %u, onoff needs on= and off=\n", id);
+    return 0;
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Packets per second, on average */
+double
+traffic_gen_mean_rate(const traffic_flow_t *f)
+{
+  if(f->model == TRAFFIC_ONOFF) {
+    return f->rate * f->onTime / (f->onTime + f->offTime);
+  }
+  return f->rate;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Reads UDP_FLOW0, UDP_FLOW1, ... up to the first one not set, and
+ * scales the flows to UDP_TARGET_RATE if set. Returns the number of
+ * flows; one that does not parse is left out.
+ */
+int
+traffic_gen_init(traffic_flow_t *flows)
+{
+  char name[16];
+  const char *spec;
+  double total;
+  double scale;
+  int num;
+  int i;
+
+  num = 0;
+  for(i = 0; i < TRAFFIC_MAX_FLOWS; i++) {
+    snprintf(name, sizeof(name), "UDP_FLOW%d", i);
+    spec = getenv(name);
+    if(spec == NULL) {
+      break;
+    }
+    if(traffic_gen_parse(&flows[num], num, spec)) {
+      num++;
+    }
+  }
+
+  spec = getenv("UDP_TARGET_RATE");
+  if(spec != NULL && atof(spec) > 0 && num > 0) {
+    total = 0;
+    for(i = 0; i < num; i++) {
+      total += traffic_gen_mean_rate(&flows[i]);
+    }
+    scale = atof(spec) / total;
+    for(i = 0; i < num; i++) {
+      flows[i].rate *= scale;
+    }
+    PRINTF("traffic: %d flows scaled by %f to %s pkts/s\n", num, scale, spec);
+  }
+  return num;
+}
+/*---------------------------------------------------------------------------*/
+static double
+period(const traffic_flow_t *f)
+{
+  return CLOCK_SECOND / f->rate;
+}
+/*---------------------------------------------------------------------------*/
+/* Moves a packet due past the on period on to the next one */
+static void
+onoff_skip(traffic_flow_t *f)
+{
+  double start;
+
+  while(f->next >= f->onEnd) {
+    start = f->onEnd + exponential(f->offTime) * CLOCK_SECOND;
+    f->onEnd = start + exponential(f->onTime) * CLOCK_SECOND;
+    /* A random phase, a burst at its start would send one too many */
+    f->next = start + period(f) * uniform();
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Schedules the first packet of a flow */
+void
+traffic_gen_start(traffic_flow_t *f, clock_time_t now)
+{
+  f->base = now;
+  f->nextLen = f->payloadLen;
+  switch(f->model) {
+  case TRAFFIC_CBR:
+    f->next = f->base + period(f) * (1 + uniform()) / 4;
+    break;
+  case TRAFFIC_POISSON:
+    f->next = now + exponential(period(f));
+    break;
+  case TRAFFIC_ONOFF:
+    f->onEnd = now + exponential(f->onTime) * CLOCK_SECOND;
+    f->next = now + period(f) * uniform();
+    onoff_skip(f);
+    break;
+  case TRAFFIC_TRACE:
+    f->tracePos = 0;
+    f->next = now + f->traceGap[0] * f->traceRate / f->rate * CLOCK_SECOND;
+    f->nextLen = f->traceLen[0];
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Moves on to the packet after the one due at f->next */
+void
+traffic_gen_advance(traffic_flow_t *f)
+{
+  switch(f->model) {
+  case TRAFFIC_CBR:
+    f->base += period(f);
+    f->next = f->base + period(f) * (1 + uniform()) / 4;
+    break;
+  case TRAFFIC_POISSON:
+    f->next += exponential(period(f));
+    break;
+  case TRAFFIC_ONOFF:
+    f->next += period(f);
+    onoff_skip(f);
+    break;
+  case TRAFFIC_TRACE:
+    f->tracePos = (f->tracePos + 1) % f->traceNum;
+    f->next += f->traceGap[f->tracePos] * f->traceRate / f->rate * CLOCK_SECOND;
+    f->nextLen = f->traceLen[f->tracePos];
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
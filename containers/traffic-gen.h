@@ -0,0 +1,80 @@
+#ifndef TRAFFIC_GEN_H
+#define TRAFFIC_GEN_H
+
+/*
+ * Traffic flows of a UDP client. Each flow has its arrival model, payload
+ * length and destination, and is configured in the environment of the
+ * node (nodeExec in wf_plc.cfg) as
+ *
+ *   UDP_FLOW<n>=<model>[,<key>=<value>...]    n = 0 .. TRAFFIC_MAX_FLOWS-1
+ *
+ * with the models
+ *   cbr      one packet per 1/rate, at a random point of the second
+ *            quarter of its period, as the client always did
+ *   poisson  exponential gaps of mean 1/rate
+ *   onoff    rate packets per second during on periods, none during off
+ *            periods; both exponential, of mean on= and off= seconds
+ *   trace    gaps (and lengths) replayed from file=, in a loop; a line is
+ *            "<gap in seconds> [<payload length>]", # starts a comment
+ * and the keys
+ *   rate=    packets per second (cbr, poisson, onoff); for trace, the
+ *            mean rate the gaps are scaled to, default that of the file
+ *   len=     UDP payload length past the packet header, default 32
+ *   dst=     destination address, default the sink
+ *   on=, off=, file=  as above
+ *
+ * UDP_TARGET_RATE=<packets per second> scales the rates of all flows of
+ * the node so that they add up to it, on average.
+ */
+
+#include <stdint.h>
+#include "contiki.h"
+#include "sys/ctimer.h"
+#include "net/ip/uip.h"
+#include "common-hdr.h"
+#include "udp-app.h"
+
+#define TRAFFIC_MAX_FLOWS UDPAPP_MAX_FLOWS
+
+/* Arrival models */
+#define TRAFFIC_CBR     0
+#define TRAFFIC_POISSON 1
+#define TRAFFIC_ONOFF   2
+#define TRAFFIC_TRACE   3
+
+typedef struct _traffic_flow_
+{
+  uint8_t id;
+  uint8_t model;
+  uint16_t payloadLen;
+  uip_ipaddr_t dest;    /* unspecified for the sink */
+  double rate;          /* packets per second, while on for onoff */
+  double onTime;        /* mean on and off periods, seconds */
+  double offTime;
+
+  /* Replayed trace; traceRate is its own mean rate */
+  float *traceGap;
+  uint16_t *traceLen;
+  uint32_t traceNum;
+  uint32_t tracePos;
+  double traceRate;
+
+  /* Schedule, in clock ticks */
+  double base;          /* start of the current cbr period */
+  double next;          /* due time of the next packet */
+  double onEnd;         /* end of the current on period */
+  uint16_t nextLen;     /* payload length of the next packet */
+  struct ctimer timer;
+
+  uint32_t seq;
+  uint32_t sent;
+  dpkt_stat_t stat;     /* of the replies */
+}traffic_flow_t;
+
+int traffic_gen_init(traffic_flow_t *flows);
+int traffic_gen_parse(traffic_flow_t *f, uint8_t id, const char *spec);
+double traffic_gen_mean_rate(const traffic_flow_t *f);
+void traffic_gen_start(traffic_flow_t *f, clock_time_t now);
+void traffic_gen_advance(traffic_flow_t *f);
+
+#endif /* TRAFFIC_GEN_H */
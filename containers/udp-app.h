@@ -1,6 +1,26 @@
 #ifndef __UDP_APP_H__
+#define __UDP_APP_H__
 
 #include "contiki.h"
+#include "latency-hist.h"
+
+#define UDPAPP_MAX_FLOWS 8
+
+/* A traffic flow of a client, see traffic-gen.h */
+typedef struct _udpapp_flow_stat{
+  unsigned int model;
+  unsigned int payloadlen;
+  float rate; /*Packets per second, on average*/
+  unsigned int pktsent;
+  unsigned int pktrecvd; /*Responses*/
+  unsigned int duppkt;
+  unsigned int reorderedpkt;
+  unsigned int lostpkt;
+  long minroundtriptime;
+  long maxroundtriptime;
+  long roundtrippct[LATENCY_PCT_NUM];
+}udpapp_flow_stat_t;
+
 typedef struct _udpapp_stat{
   unsigned int totalpktsent; /*Requests*/
   unsigned int totalpktrecvd; /*Request/response received*/
@@ -9,6 +29,14 @@ typedef struct _udpapp_stat{
   long maxroundtriptime;
   long minupwardtime;
   long maxupwardtime;
+  /* Percentiles, see LATENCY_PCT_PERMILLE, and the histograms to merge
+     them across nodes */
+  long roundtrippct[LATENCY_PCT_NUM];
+  long upwardpct[LATENCY_PCT_NUM];
+  latency_hist_t roundtriphist;
+  latency_hist_t upwardhist;
+  unsigned int flowcnt; /*Zero on the sink*/
+  udpapp_flow_stat_t flow[UDPAPP_MAX_FLOWS];
 }udpapp_stat_t;
 
 void start_udp_process();
@@ -207,6 +207,72 @@
 #define RPL_DIO_REDUNDANCY          10
 #endif
 
+/*
+ * Adaptive Trickle: instead of the DAG's fixed redundancy constant, each
+ * node picks its own k from the number of DIO neighbors it hears and the
+ * share of consistent DIOs. Nodes with at most RPL_TRICKLE_ADAPTIVE_SPARSE
+ * neighbors never suppress; denser nodes use a k inversely proportional
+ * to the neighbor count, between RPL_TRICKLE_ADAPTIVE_K_MIN and
+ * RPL_TRICKLE_ADAPTIVE_K_MAX, doubled while fewer than
+ * RPL_TRICKLE_ADAPTIVE_CONSISTENT percent of the DIOs heard are consistent.
+ */
+#ifdef RPL_CONF_TRICKLE_ADAPTIVE
+#define RPL_TRICKLE_ADAPTIVE RPL_CONF_TRICKLE_ADAPTIVE
+#else
+#define RPL_TRICKLE_ADAPTIVE 0
+#endif
+
+#ifdef RPL_CONF_TRICKLE_ADAPTIVE_SPARSE
+#define RPL_TRICKLE_ADAPTIVE_SPARSE RPL_CONF_TRICKLE_ADAPTIVE_SPARSE
+#else
+#define RPL_TRICKLE_ADAPTIVE_SPARSE 3
+#endif
+
+#ifdef RPL_CONF_TRICKLE_ADAPTIVE_K_MIN
+#define RPL_TRICKLE_ADAPTIVE_K_MIN RPL_CONF_TRICKLE_ADAPTIVE_K_MIN
+#else
+#define RPL_TRICKLE_ADAPTIVE_K_MIN 1
+#endif
+
+#ifdef RPL_CONF_TRICKLE_ADAPTIVE_K_MAX
+#define RPL_TRICKLE_ADAPTIVE_K_MAX RPL_CONF_TRICKLE_ADAPTIVE_K_MAX
+#else
+#define RPL_TRICKLE_ADAPTIVE_K_MAX 6
+#endif
+
+#ifdef RPL_CONF_TRICKLE_ADAPTIVE_CONSISTENT
+#define RPL_TRICKLE_ADAPTIVE_CONSISTENT RPL_CONF_TRICKLE_ADAPTIVE_CONSISTENT
+#else
+#define RPL_TRICKLE_ADAPTIVE_CONSISTENT 75
+#endif
+
+/*
+ * Trickle resets caused by rank and preferred parent changes are filtered
+ * for significance: the rank must move by at least
+ * RPL_TRICKLE_SIGNIFICANT_RANK_DELTA percent of min_hoprankinc, or to or
+ * from infinity. A parent switch alone is enough when
+ * RPL_TRICKLE_RESET_ON_PARENT_SWITCH is set. Such resets are also spaced
+ * by at least RPL_TRICKLE_MIN_RESET_INTERVAL. Joins, version changes and
+ * local repairs always reset.
+ */
+#ifdef RPL_CONF_TRICKLE_SIGNIFICANT_RANK_DELTA
+#define RPL_TRICKLE_SIGNIFICANT_RANK_DELTA RPL_CONF_TRICKLE_SIGNIFICANT_RANK_DELTA
+#else
+#define RPL_TRICKLE_SIGNIFICANT_RANK_DELTA 100
+#endif
+
+#ifdef RPL_CONF_TRICKLE_RESET_ON_PARENT_SWITCH
+#define RPL_TRICKLE_RESET_ON_PARENT_SWITCH RPL_CONF_TRICKLE_RESET_ON_PARENT_SWITCH
+#else
+#define RPL_TRICKLE_RESET_ON_PARENT_SWITCH 0
+#endif
+
+#ifdef RPL_CONF_TRICKLE_MIN_RESET_INTERVAL
+#define RPL_TRICKLE_MIN_RESET_INTERVAL RPL_CONF_TRICKLE_MIN_RESET_INTERVAL
+#else
+#define RPL_TRICKLE_MIN_RESET_INTERVAL (8 * CLOCK_SECOND)
+#endif
+
 
 /*
  * Initial metric attributed to a link when the ETX is unknown
@@ -267,6 +333,149 @@
 #define RPL_REPAIR_ON_DAO_NACK 0
 #endif /* RPL_CONF_RPL_REPAIR_ON_DAO_NACK */
 
+/*
+ * Bounded local repair. When enabled, a node that loses its last parent
+ * does not poison its rank right away. It detaches instead: it keeps
+ * advertising its rank with the detached flag set, so that its children
+ * hold their routes, and looks for another parent among its remaining
+ * candidates and siblings. A new parent may raise the rank by at most
+ * RPL_LOCAL_REPAIR_MAX_RANKINC. Only if none is found within
+ * RPL_LOCAL_REPAIR_HOLD_TIME does the node fall back to a poisoning
+ * local repair.
+ */
+#ifdef RPL_CONF_LOCAL_REPAIR_BOUNDED
+#define RPL_LOCAL_REPAIR_BOUNDED RPL_CONF_LOCAL_REPAIR_BOUNDED
+#else
+#define RPL_LOCAL_REPAIR_BOUNDED 0
+#endif /* RPL_CONF_LOCAL_REPAIR_BOUNDED */
+
+#ifdef RPL_CONF_LOCAL_REPAIR_MAX_RANKINC
+#define RPL_LOCAL_REPAIR_MAX_RANKINC RPL_CONF_LOCAL_REPAIR_MAX_RANKINC
+#else
+#define RPL_LOCAL_REPAIR_MAX_RANKINC (2 * RPL_MIN_HOPRANKINC)
+#endif /* RPL_CONF_LOCAL_REPAIR_MAX_RANKINC */
+
+#ifdef RPL_CONF_LOCAL_REPAIR_HOLD_TIME
+#define RPL_LOCAL_REPAIR_HOLD_TIME RPL_CONF_LOCAL_REPAIR_HOLD_TIME
+#else
+#define RPL_LOCAL_REPAIR_HOLD_TIME (8 * CLOCK_SECOND)
+#endif /* RPL_CONF_LOCAL_REPAIR_HOLD_TIME */
+
+/*
+ * Warm start. When enabled, a router writes its DAG, its parents with
+ * their rank and link metrics, its DTSN and its DAO sequence number to
+ * RPL_SNAPSHOT_FILE every RPL_SNAPSHOT_INTERVAL. On boot it rejoins the
+ * DAG from that file and asks its parent for a DIO; the restored DAG is
+ * dropped unless a DIO confirms it within RPL_SNAPSHOT_VALIDATION_TIME.
+ * Needs a file system, as on the native platform.
+ */
+#ifdef RPL_CONF_SNAPSHOT
+#define RPL_SNAPSHOT RPL_CONF_SNAPSHOT
+#else
+#define RPL_SNAPSHOT 0
+#endif /* RPL_CONF_SNAPSHOT */
+
+/* The file name, formatted with the last two bytes of the link address */
+#ifdef RPL_CONF_SNAPSHOT_FILE
+#define RPL_SNAPSHOT_FILE RPL_CONF_SNAPSHOT_FILE
+#else
+#define RPL_SNAPSHOT_FILE "rpl-%02x%02x.snapshot"
+#endif /* RPL_CONF_SNAPSHOT_FILE */
+
+#ifdef RPL_CONF_SNAPSHOT_INTERVAL
+#define RPL_SNAPSHOT_INTERVAL RPL_CONF_SNAPSHOT_INTERVAL
+#else
+#define RPL_SNAPSHOT_INTERVAL (60 * CLOCK_SECOND)
+#endif /* RPL_CONF_SNAPSHOT_INTERVAL */
+
+#ifdef RPL_CONF_SNAPSHOT_VALIDATION_TIME
+#define RPL_SNAPSHOT_VALIDATION_TIME RPL_CONF_SNAPSHOT_VALIDATION_TIME
+#else
+#define RPL_SNAPSHOT_VALIDATION_TIME (20 * CLOCK_SECOND)
+#endif /* RPL_CONF_SNAPSHOT_VALIDATION_TIME */
+
+/*
+ * Hot-standby root. When enabled, a backup root joined to the DAG asks
+ * the root for its state every RPL_ROOT_SYNC_INTERVAL over UDP port
+ * RPL_ROOT_SYNC_PORT, and mirrors the DAG configuration and up to
+ * RPL_ROOT_SYNC_ROUTES downward routes (storing routes or non-storing
+ * links); it takes twice that in RAM, as a round is staged until it is
+ * complete. Without an answer for RPL_ROOT_TAKEOVER_TIME, the backup
+ * becomes root of the same DODAG ID with a newer version.
+ * See rpl_dag_root_serve_backup() and rpl_dag_root_init_backup().
+ */
+#ifdef RPL_CONF_ROOT_SYNC
+#define RPL_ROOT_SYNC RPL_CONF_ROOT_SYNC
+#else
+#define RPL_ROOT_SYNC 0
+#endif /* RPL_CONF_ROOT_SYNC */
+
+#ifdef RPL_CONF_ROOT_SYNC_PORT
+#define RPL_ROOT_SYNC_PORT RPL_CONF_ROOT_SYNC_PORT
+#else
+#define RPL_ROOT_SYNC_PORT 5690
+#endif /* RPL_CONF_ROOT_SYNC_PORT */
+
+#ifdef RPL_CONF_ROOT_SYNC_INTERVAL
+#define RPL_ROOT_SYNC_INTERVAL RPL_CONF_ROOT_SYNC_INTERVAL
+#else
+#define RPL_ROOT_SYNC_INTERVAL (5 * CLOCK_SECOND)
+#endif /* RPL_CONF_ROOT_SYNC_INTERVAL */
+
+#ifdef RPL_CONF_ROOT_TAKEOVER_TIME
+#define RPL_ROOT_TAKEOVER_TIME RPL_CONF_ROOT_TAKEOVER_TIME
+#else
+#define RPL_ROOT_TAKEOVER_TIME (15 * CLOCK_SECOND)
+#endif /* RPL_CONF_ROOT_TAKEOVER_TIME */
+
+#ifdef RPL_CONF_ROOT_SYNC_ROUTES
+#define RPL_ROOT_SYNC_ROUTES RPL_CONF_ROOT_SYNC_ROUTES
+#else
+#define RPL_ROOT_SYNC_ROUTES 64
+#endif /* RPL_CONF_ROOT_SYNC_ROUTES */
+
+/*
+ * Control plane counters, see rpl-counters.h. They are always kept; when
+ * RPL_COUNTERS_SHM is set they live in a file mapped at
+ * RPL_COUNTERS_SHM_PATH (formatted with the last two bytes of the link
+ * address) that collectors can map read-only while the node runs.
+ */
+#ifdef RPL_CONF_COUNTERS_SHM
+#define RPL_COUNTERS_SHM RPL_CONF_COUNTERS_SHM
+#else
+#define RPL_COUNTERS_SHM 0
+#endif /* RPL_CONF_COUNTERS_SHM */
+
+#ifdef RPL_CONF_COUNTERS_SHM_PATH
+#define RPL_COUNTERS_SHM_PATH RPL_CONF_COUNTERS_SHM_PATH
+#else
+#define RPL_COUNTERS_SHM_PATH "/dev/shm/rpl-counters-%02x%02x"
+#endif /* RPL_CONF_COUNTERS_SHM_PATH */
+
+/*
+ * Tracepoints. When enabled, the hot paths of RPL log compact binary
+ * records to a ring of RPL_TRACE_RECORDS entries (a power of two), mapped
+ * at RPL_TRACE_PATH, instead of printing. See rpl-trace.h for the format
+ * and containers/tools/rpl-trace-decode.py for a decoder.
+ */
+#ifdef RPL_CONF_TRACE
+#define RPL_TRACE RPL_CONF_TRACE
+#else
+#define RPL_TRACE 0
+#endif /* RPL_CONF_TRACE */
+
+#ifdef RPL_CONF_TRACE_RECORDS
+#define RPL_TRACE_RECORDS RPL_CONF_TRACE_RECORDS
+#else
+#define RPL_TRACE_RECORDS 4096
+#endif /* RPL_CONF_TRACE_RECORDS */
+
+#ifdef RPL_CONF_TRACE_PATH
+#define RPL_TRACE_PATH RPL_CONF_TRACE_PATH
+#else
+#define RPL_TRACE_PATH "/dev/shm/rpl-trace-%02x%02x"
+#endif /* RPL_CONF_TRACE_PATH */
+
 /*
  * Setting the DIO_REFRESH_DAO_ROUTES will make the RPL root always
  * increase the DTSN (Destination Advertisement Trigger Sequence Number)
@@ -331,6 +540,26 @@
 #define RPL_PROBING_DELAY_FUNC get_probing_delay
 #endif
 
+/*
+ * Probing budget of the default probing scheduler, in probes per minute
+ * for the whole node. Urgent probes are always sent.
+ */
+#ifdef RPL_CONF_PROBING_BUDGET
+#define RPL_PROBING_BUDGET RPL_CONF_PROBING_BUDGET
+#else
+#define RPL_PROBING_BUDGET 6
+#endif
+
+/*
+ * Number of probing targets the default scheduler picks per scan of the
+ * parent table, best expected benefit first.
+ */
+#ifdef RPL_CONF_PROBING_QUEUE_SIZE
+#define RPL_PROBING_QUEUE_SIZE RPL_CONF_PROBING_QUEUE_SIZE
+#else
+#define RPL_PROBING_QUEUE_SIZE 4
+#endif
+
 /*
  * Interval of DIS transmission
  */
@@ -349,6 +578,63 @@
 #define RPL_DIS_START_DELAY             5
 #endif
 
+/*
+ * Fast join: while the node is in no DAG, multicast DIS go out on an
+ * exponential schedule that starts at RPL_DIS_FAST_JOIN_MIN milliseconds
+ * and doubles up to RPL_DIS_INTERVAL, rather than once per interval after
+ * RPL_DIS_START_DELAY.
+ */
+#ifdef RPL_CONF_DIS_FAST_JOIN
+#define RPL_DIS_FAST_JOIN RPL_CONF_DIS_FAST_JOIN
+#else
+#define RPL_DIS_FAST_JOIN 0
+#endif
+
+#ifdef RPL_CONF_DIS_FAST_JOIN_MIN
+#define RPL_DIS_FAST_JOIN_MIN RPL_CONF_DIS_FAST_JOIN_MIN
+#else
+#define RPL_DIS_FAST_JOIN_MIN 250
+#endif
+
+/*
+ * Delay before rank recalculation runs for parents whose rank or link
+ * metric changed, coalescing the updates of a burst of callbacks.
+ */
+#ifdef RPL_CONF_RANK_RECALC_DELAY
+#define RPL_RANK_RECALC_DELAY RPL_CONF_RANK_RECALC_DELAY
+#else
+#define RPL_RANK_RECALC_DELAY (CLOCK_SECOND / 16)
+#endif
+
+/*
+ * Geometry of the timing wheel on which the lifetimes of DAGs, routes and
+ * NS nodes expire: RPL_LIFETIME_WHEEL_LEVELS levels of
+ * 2^RPL_LIFETIME_WHEEL_SLOT_BITS one-second slots each. The default spans
+ * 2^24 seconds, longer lifetimes are parked in the last slot and placed
+ * again when they get closer.
+ */
+#ifdef RPL_CONF_LIFETIME_WHEEL_SLOT_BITS
+#define RPL_LIFETIME_WHEEL_SLOT_BITS RPL_CONF_LIFETIME_WHEEL_SLOT_BITS
+#else
+#define RPL_LIFETIME_WHEEL_SLOT_BITS 6
+#endif
+
+#ifdef RPL_CONF_LIFETIME_WHEEL_LEVELS
+#define RPL_LIFETIME_WHEEL_LEVELS RPL_CONF_LIFETIME_WHEEL_LEVELS
+#else
+#define RPL_LIFETIME_WHEEL_LEVELS 4
+#endif
+
+/*
+ * Number of hash buckets used to find the lifetime timer of a route or
+ * multicast route. Must be a power of two.
+ */
+#ifdef RPL_CONF_ROUTE_TIMER_HASH_SIZE
+#define RPL_ROUTE_TIMER_HASH_SIZE RPL_CONF_ROUTE_TIMER_HASH_SIZE
+#else
+#define RPL_ROUTE_TIMER_HASH_SIZE 64
+#endif
+
 #ifdef RPL_CONF_WITH_DCO_ACK
 #define RPL_WITH_DCO_ACK   RPL_CONF_WITH_DCO_ACK
 #else
@@ -361,4 +647,100 @@
 #define RPL_WITH_DCO   0
 #endif
 
+/*
+ * Loop repair triggered by the RPL hop-by-hop option is rate limited with
+ * token buckets: per neighbor for the unicast DIOs sent back to the
+ * sender, and per instance for trickle resets. A bucket holds up to BURST
+ * tokens and regains one every INTERVAL.
+ */
+#ifdef RPL_CONF_LOOP_REPAIR_DIO_BURST
+#define RPL_LOOP_REPAIR_DIO_BURST RPL_CONF_LOOP_REPAIR_DIO_BURST
+#else
+#define RPL_LOOP_REPAIR_DIO_BURST 2
+#endif
+
+#ifdef RPL_CONF_LOOP_REPAIR_DIO_INTERVAL
+#define RPL_LOOP_REPAIR_DIO_INTERVAL RPL_CONF_LOOP_REPAIR_DIO_INTERVAL
+#else
+#define RPL_LOOP_REPAIR_DIO_INTERVAL (4 * CLOCK_SECOND)
+#endif
+
+#ifdef RPL_CONF_LOOP_REPAIR_RESET_BURST
+#define RPL_LOOP_REPAIR_RESET_BURST RPL_CONF_LOOP_REPAIR_RESET_BURST
+#else
+#define RPL_LOOP_REPAIR_RESET_BURST 1
+#endif
+
+#ifdef RPL_CONF_LOOP_REPAIR_RESET_INTERVAL
+#define RPL_LOOP_REPAIR_RESET_INTERVAL RPL_CONF_LOOP_REPAIR_RESET_INTERVAL
+#else
+#define RPL_LOOP_REPAIR_RESET_INTERVAL (8 * CLOCK_SECOND)
+#endif
+
+/* Loop repair DIOs requested within this delay are sent together */
+#ifdef RPL_CONF_LOOP_REPAIR_DELAY
+#define RPL_LOOP_REPAIR_DELAY RPL_CONF_LOOP_REPAIR_DELAY
+#else
+#define RPL_LOOP_REPAIR_DELAY (CLOCK_SECOND / 16)
+#endif
+
+/*
+ * Cache the instance, sender parent and route lookups done for the RPL
+ * hop-by-hop option of forwarded packets. Consecutive packets of a flow
+ * then skip the neighbor and route table scans.
+ */
+#ifdef RPL_CONF_WITH_HBH_CACHE
+#define RPL_WITH_HBH_CACHE RPL_CONF_WITH_HBH_CACHE
+#else
+#define RPL_WITH_HBH_CACHE 1
+#endif
+
+/* Number of destinations in the hop-by-hop route lookup cache, in sets
+   of two; must be a power of two, at least 2 */
+#ifdef RPL_CONF_HBH_ROUTE_CACHE_SIZE
+#define RPL_HBH_ROUTE_CACHE_SIZE RPL_CONF_HBH_ROUTE_CACHE_SIZE
+#else
+#define RPL_HBH_ROUTE_CACHE_SIZE 8
+#endif
+
+/*
+ * Interval at which the neighbor policy rebuilds its parent and child
+ * counts from the tables, instead of trusting the incremental updates.
+ */
+#ifdef RPL_CONF_NBR_POLICY_RESYNC_INTERVAL
+#define RPL_NBR_POLICY_RESYNC_INTERVAL RPL_CONF_NBR_POLICY_RESYNC_INTERVAL
+#else
+#define RPL_NBR_POLICY_RESYNC_INTERVAL (60 * CLOCK_SECOND)
+#endif
+
+/*
+ * Eviction score penalties of the neighbor policy, in rank units: for a
+ * parent whose ETX is not fresh, and per minute since it was last used,
+ * counting at most RPL_NBR_POLICY_AGE_MAX minutes.
+ */
+#ifdef RPL_CONF_NBR_POLICY_STALE_PENALTY
+#define RPL_NBR_POLICY_STALE_PENALTY RPL_CONF_NBR_POLICY_STALE_PENALTY
+#else
+#define RPL_NBR_POLICY_STALE_PENALTY 128
+#endif
+
+#ifdef RPL_CONF_NBR_POLICY_AGE_PENALTY
+#define RPL_NBR_POLICY_AGE_PENALTY RPL_CONF_NBR_POLICY_AGE_PENALTY
+#else
+#define RPL_NBR_POLICY_AGE_PENALTY 16
+#endif
+
+#ifdef RPL_CONF_NBR_POLICY_AGE_MAX
+#define RPL_NBR_POLICY_AGE_MAX RPL_CONF_NBR_POLICY_AGE_MAX
+#else
+#define RPL_NBR_POLICY_AGE_MAX 16
+#endif
+
+/* Number of evicted neighbors remembered to count the relearned ones */
+#ifdef RPL_CONF_NBR_POLICY_EVICTED_HISTORY
+#define RPL_NBR_POLICY_EVICTED_HISTORY RPL_CONF_NBR_POLICY_EVICTED_HISTORY
+#else
+#define RPL_NBR_POLICY_EVICTED_HISTORY 8
+#endif
+
 #endif /* RPL_CONF_H */
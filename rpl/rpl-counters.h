@@ -0,0 +1,93 @@
+/**
+ * \file
+ *         Always-on RPL control plane counters. The layout below is what
+ *         a collector finds in the shared memory segment of a node, see
+ *         RPL_COUNTERS_SHM, so this header depends on nothing but stdint.
+ */
+
+#ifndef RPL_COUNTERS_H
+#define RPL_COUNTERS_H
+
+#include <stdint.h>
+
+/* Number of neighbors with counters of their own */
+#ifdef RPL_COUNTERS_CONF_NBR_NUM
+#define RPL_COUNTERS_NBR_NUM RPL_COUNTERS_CONF_NBR_NUM
+#else /* RPL_COUNTERS_CONF_NBR_NUM */
+#define RPL_COUNTERS_NBR_NUM 16
+#endif /* RPL_COUNTERS_CONF_NBR_NUM */
+
+#define RPL_COUNTERS_MAGIC   0x52504c43 /* "RPLC" */
+#define RPL_COUNTERS_VERSION 3
+
+/* Message types, the index is the RPL code of the message */
+#define RPL_COUNTER_DIS     0
+#define RPL_COUNTER_DIO     1
+#define RPL_COUNTER_DAO     2
+#define RPL_COUNTER_DAO_ACK 3
+#define RPL_COUNTER_DCO     4
+#define RPL_COUNTER_DCO_ACK 5
+#define RPL_COUNTER_MSG_NUM 6
+
+/* Repair reasons */
+#define RPL_REPAIR_NO_PARENT     0 /* lost the last parent */
+#define RPL_REPAIR_DAO_TIMEOUT   1 /* no DAO ACK after the retransmissions */
+#define RPL_REPAIR_DAO_NACK      2 /* DAO rejected by the parent */
+#define RPL_REPAIR_DETACH_EXPIRY 3 /* bounded repair found no parent */
+#define RPL_REPAIR_GLOBAL        4 /* followed a new DAG version */
+#define RPL_REPAIR_ROOT          5 /* new DAG version from this root */
+#define RPL_REPAIR_BOUNDED       6 /* bounded repair found a parent */
+#define RPL_REPAIR_REASON_NUM    7
+
+/* Time to join a DAG: below 2^i half-seconds in bucket i, the last bucket
+   takes the rest */
+#define RPL_COUNTER_JOIN_TIME_NUM 8
+
+struct rpl_msg_counters {
+  uint32_t in;
+  uint32_t out;
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+};
+
+/*
+ * Counters of one neighbor. A slot is reused for another neighbor only
+ * between two changes of seq, which is odd while the slot is rewritten:
+ * a reader that sees the same even seq before and after reading a slot
+ * has read one neighbor.
+ */
+struct rpl_nbr_counters {
+  uint32_t seq;
+  uint32_t last_seen; /* clock_seconds() of the last message */
+  uint8_t lladdr[8];
+  struct rpl_msg_counters msg[RPL_COUNTER_MSG_NUM];
+};
+
+/*
+ * The counters of a node. There is a single writer, the node, and each
+ * field is a naturally aligned 32-bit word that is only ever incremented
+ * or stored, so readers need no lock.
+ */
+struct rpl_counters {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t num_nbrs;
+  uint32_t size;
+  uint32_t start_time; /* clock_seconds() when the counters started */
+  struct rpl_msg_counters msg[RPL_COUNTER_MSG_NUM];
+  uint32_t parse_drops;
+  uint32_t parent_switches;
+  uint32_t repairs[RPL_REPAIR_REASON_NUM];
+  uint32_t nbr_evictions; /* neighbor slots taken over */
+  uint32_t joins;
+  uint32_t join_time[RPL_COUNTER_JOIN_TIME_NUM];
+  /* Trickle: ended DIO intervals, those with a DIO sent and with one
+     suppressed, and the DIOs of the DAG heard in all of them */
+  uint32_t dio_intervals;
+  uint32_t dio_intervals_sent;
+  uint32_t dio_intervals_suppressed;
+  uint32_t dio_heard;
+  struct rpl_nbr_counters nbr[RPL_COUNTERS_NBR_NUM];
+};
+
+#endif /* RPL_COUNTERS_H */
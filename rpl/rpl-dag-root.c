@@ -35,6 +35,10 @@
 #include "net/rpl/rpl.h"
 #include "net/rpl/rpl-private.h"
 #include "net/rpl/rpl-dag-root.h"
+#if RPL_ROOT_SYNC
+#include "net/rpl/rpl-ns.h"
+#include "net/ip/simple-udp.h"
+#endif /* RPL_ROOT_SYNC */
 
 #include <string.h>
 
@@ -265,3 +269,417 @@ rpl_dag_root_is_root(void)
   return 0;
 }
 /*---------------------------------------------------------------------------*/
+#if RPL_ROOT_SYNC
+/*
+ * Hot-standby root. The backup asks the root for its state with a
+ * request; the root answers with a configuration message followed by
+ * route messages, one per SYNC_SEND_DELAY. The answers of one round
+ * share a round number and are numbered in it. A configuration message
+ * starts a round, and a route message of fewer than SYNC_ROUTES_PER_MSG
+ * routes (possibly none) ends it. The backup stages a round and mirrors
+ * it only once complete and without gaps, so a root lost halfway leaves
+ * the last complete mirror. Only the root of the DAG is mirrored, and
+ * the root answers one request at a time.
+ */
+#define SYNC_REQUEST 1
+#define SYNC_CONFIG  2
+#define SYNC_ROUTES  3
+
+#define SYNC_ROUTES_PER_MSG 8
+#define SYNC_SEND_DELAY (CLOCK_SECOND / 16)
+
+struct sync_header {
+  uint8_t type;
+  uint8_t round;
+  uint8_t count;
+  uint8_t index;   /* of the message in its round */
+};
+
+struct sync_config {
+  uip_ipaddr_t dag_id;
+  rpl_prefix_t prefix_info;
+  rpl_ocp_t ocp;
+  rpl_rank_t max_rankinc;
+  rpl_rank_t min_hoprankinc;
+  uint16_t lifetime_unit;
+  uint8_t instance_id;
+  uint8_t version;
+  uint8_t mop;
+  uint8_t dtsn_out;
+  uint8_t dio_intdoubl;
+  uint8_t dio_intmin;
+  uint8_t dio_redundancy;
+  uint8_t default_lifetime;
+  uint8_t grounded;
+  uint8_t preference;
+};
+
+/* A storing mode route, or a non-storing mode link from target to via */
+struct sync_route {
+  uip_ipaddr_t target;
+  uip_ipaddr_t via;
+  uint32_t lifetime;
+  uint8_t length;
+};
+
+static struct simple_udp_connection sync_conn;
+static uint8_t sync_registered;
+static struct ctimer sync_timer;
+static uint8_t sync_round;
+static uint8_t sync_index;
+
+/* Root: the backup being answered and the position in the route table */
+static uip_ipaddr_t backup_addr;
+static uint16_t sync_position;
+
+/* Backup: the round being received and the last complete one */
+static struct sync_config stage_config;
+static struct sync_route stage_routes[RPL_ROOT_SYNC_ROUTES];
+static uint16_t num_stage_routes;
+static uint8_t stage_round;
+static uint8_t stage_index;
+static uint8_t staging;
+static struct sync_config mirror_config;
+static struct sync_route mirror_routes[RPL_ROOT_SYNC_ROUTES];
+static uint16_t num_mirror_routes;
+static uint8_t have_mirror;
+static clock_time_t last_sync;
+/*---------------------------------------------------------------------------*/
+static void
+sync_send(uint8_t type, const void *payload, uint8_t count, size_t size)
+{
+  uint8_t buf[sizeof(struct sync_header) +
+              SYNC_ROUTES_PER_MSG * sizeof(struct sync_route)];
+  struct sync_header h;
+
+  h.type = type;
+  h.round = sync_round;
+  h.count = count;
+  h.index = sync_index++;
+  memcpy(buf, &h, sizeof(h));
+  if(size > 0) {
+    memcpy(buf + sizeof(h), payload, size);
+  }
+  simple_udp_sendto(&sync_conn, buf, sizeof(h) + size, &backup_addr);
+}
+/*---------------------------------------------------------------------------*/
+/* Collects the routes from sync_position on, returns how many */
+static uint8_t
+collect_routes(rpl_dag_t *dag, struct sync_route *routes)
+{
+  uint16_t i;
+  uint8_t n;
+
+  n = 0;
+  i = 0;
+  if(RPL_IS_STORING(dag->instance)) {
+#if (UIP_CONF_MAX_ROUTES != 0)
+    uip_ds6_route_t *r;
+
+    for(r = uip_ds6_route_head();
+        r != NULL && n < SYNC_ROUTES_PER_MSG;
+        r = uip_ds6_route_next(r), i++) {
+      if(i >= sync_position && r->state.dag == dag) {
+        memset(&routes[n], 0, sizeof(routes[n]));
+        uip_ipaddr_copy(&routes[n].target, &r->ipaddr);
+        uip_ipaddr_copy(&routes[n].via, uip_ds6_route_nexthop(r));
+        routes[n].lifetime = rpl_lifetime_remaining(r->state.lifetime);
+        routes[n].length = r->length;
+        n++;
+      }
+    }
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+  }
+#if RPL_WITH_NON_STORING
+  if(RPL_IS_NON_STORING(dag->instance)) {
+    rpl_ns_node_t *node;
+    rpl_ns_node_t *parent;
+
+    for(node = rpl_ns_node_head();
+        node != NULL && n < SYNC_ROUTES_PER_MSG;
+        node = rpl_ns_node_next(node), i++) {
+      parent = rpl_ns_node_parent(node);
+      if(i >= sync_position && parent != NULL) {
+        memset(&routes[n], 0, sizeof(routes[n]));
+        rpl_ns_get_node_global_addr(&routes[n].target, node);
+        rpl_ns_get_node_global_addr(&routes[n].via, parent);
+        routes[n].lifetime = rpl_lifetime_remaining(node->lifetime);
+        routes[n].length = 128;
+        n++;
+      }
+    }
+  }
+#endif /* RPL_WITH_NON_STORING */
+  sync_position = i;
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+static void
+sync_next(void *ptr)
+{
+  struct sync_route routes[SYNC_ROUTES_PER_MSG];
+  rpl_dag_t *dag;
+  uint8_t n;
+
+  dag = rpl_get_any_dag();
+  if(dag == NULL || !rpl_dag_root_is_root()) {
+    return;
+  }
+
+  n = collect_routes(dag, routes);
+  /* A short message, possibly empty, ends the round */
+  sync_send(SYNC_ROUTES, routes, n, n * sizeof(struct sync_route));
+  if(n == SYNC_ROUTES_PER_MSG) {
+    ctimer_set(&sync_timer, SYNC_SEND_DELAY, sync_next, NULL);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Root: sends the configuration and schedules the routes */
+static void
+sync_answer(const uip_ipaddr_t *backup)
+{
+  struct sync_config config;
+  rpl_dag_t *dag;
+  rpl_instance_t *instance;
+
+  dag = rpl_get_any_dag();
+  if(dag == NULL || !rpl_dag_root_is_root()) {
+    return;
+  }
+  if(!ctimer_expired(&sync_timer)) {
+    /* A round is on its way, to this backup or another one */
+    return;
+  }
+  instance = dag->instance;
+
+  memset(&config, 0, sizeof(config));
+  uip_ipaddr_copy(&config.dag_id, &dag->dag_id);
+  memcpy(&config.prefix_info, &dag->prefix_info, sizeof(config.prefix_info));
+  config.ocp = instance->of->ocp;
+  config.max_rankinc = instance->max_rankinc;
+  config.min_hoprankinc = instance->min_hoprankinc;
+  config.lifetime_unit = instance->lifetime_unit;
+  config.instance_id = instance->instance_id;
+  config.version = dag->version;
+  config.mop = instance->mop;
+  config.dtsn_out = instance->dtsn_out;
+  config.dio_intdoubl = instance->dio_intdoubl;
+  config.dio_intmin = instance->dio_intmin;
+  config.dio_redundancy = instance->dio_redundancy;
+  config.default_lifetime = instance->default_lifetime;
+  config.grounded = dag->grounded;
+  config.preference = dag->preference;
+
+  uip_ipaddr_copy(&backup_addr, backup);
+  sync_round++;
+  sync_index = 0;
+  sync_position = 0;
+  sync_send(SYNC_CONFIG, &config, 1, sizeof(config));
+  ctimer_set(&sync_timer, SYNC_SEND_DELAY, sync_next, NULL);
+  RPL_STAT(rpl_stats.root_syncs++);
+}
+/*---------------------------------------------------------------------------*/
+/* Backup: records a message of the root */
+static void
+sync_mirror(const struct sync_header *h, const uint8_t *payload, uint16_t len)
+{
+  struct sync_route route;
+  uint8_t i;
+
+  /* Any message tells the root is alive */
+  last_sync = clock_time();
+
+  if(h->type == SYNC_CONFIG && len >= sizeof(stage_config)) {
+    memcpy(&stage_config, payload, sizeof(stage_config));
+    stage_round = h->round;
+    stage_index = h->index;
+    num_stage_routes = 0;
+    staging = 1;
+  } else if(h->type == SYNC_ROUTES && staging && h->round == stage_round) {
+    if(h->index != (uint8_t)(stage_index + 1) ||
+       len < h->count * sizeof(struct sync_route)) {
+      /* A message of the round is missing, wait for the next one */
+      staging = 0;
+      return;
+    }
+    stage_index = h->index;
+    for(i = 0; i < h->count && num_stage_routes < RPL_ROOT_SYNC_ROUTES; i++) {
+      memcpy(&route, payload + i * sizeof(route), sizeof(route));
+      /* Keep the expiry, so that the lifetime left is known on takeover */
+      route.lifetime = rpl_lifetime_to_expiry(route.lifetime);
+      memcpy(&stage_routes[num_stage_routes++], &route, sizeof(route));
+    }
+    if(h->count < SYNC_ROUTES_PER_MSG) {
+      memcpy(&mirror_config, &stage_config, sizeof(mirror_config));
+      memcpy(mirror_routes, stage_routes,
+             num_stage_routes * sizeof(struct sync_route));
+      num_mirror_routes = num_stage_routes;
+      have_mirror = 1;
+      staging = 0;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+sync_callback(struct simple_udp_connection *c,
+              const uip_ipaddr_t *sender_addr, uint16_t sender_port,
+              const uip_ipaddr_t *receiver_addr, uint16_t receiver_port,
+              const uint8_t *data, uint16_t datalen)
+{
+  struct sync_header h;
+  rpl_dag_t *dag;
+
+  if(datalen < sizeof(h)) {
+    return;
+  }
+  memcpy(&h, data, sizeof(h));
+  if(h.type == SYNC_REQUEST) {
+    PRINTF("RPL: State requested by backup root ");
+    PRINT6ADDR(sender_addr);
+    PRINTF("\n");
+    sync_answer(sender_addr);
+  } else if(!rpl_dag_root_is_root()) {
+    /* Only the root of our DAG is mirrored */
+    dag = rpl_get_any_dag();
+    if(dag != NULL && dag->joined && uip_ipaddr_cmp(sender_addr, &dag->dag_id)) {
+      sync_mirror(&h, data + sizeof(h), datalen - sizeof(h));
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+sync_register(void)
+{
+  if(!sync_registered) {
+    simple_udp_register(&sync_conn, RPL_ROOT_SYNC_PORT, NULL,
+                        RPL_ROOT_SYNC_PORT, sync_callback);
+    sync_registered = 1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Backup: becomes root of the mirrored DAG */
+static void
+take_over(void)
+{
+  rpl_dag_t *dag;
+  rpl_instance_t *instance;
+  rpl_of_t *of;
+  uint8_t version;
+  uint32_t lifetime;
+  uint16_t i;
+
+  PRINTF("RPL: No answer from the root, taking over DAG ");
+  PRINT6ADDR(&mirror_config.dag_id);
+  PRINTF("\n");
+
+  /* Traffic for the old root now comes to us */
+  uip_ds6_addr_add(&mirror_config.dag_id, 0, ADDR_MANUAL);
+  dag = rpl_set_root(mirror_config.instance_id, &mirror_config.dag_id);
+  if(dag == NULL) {
+    return;
+  }
+  instance = dag->instance;
+
+  /* A newer version than any seen: the nodes repair towards us */
+  version = mirror_config.version;
+  RPL_LOLLIPOP_INCREMENT(version);
+  if(lollipop_greater_than(version, dag->version)) {
+    dag->version = version;
+  }
+  dag->grounded = mirror_config.grounded;
+  dag->preference = mirror_config.preference;
+  of = rpl_find_of(mirror_config.ocp);
+  if(of != NULL) {
+    instance->of = of;
+  }
+  instance->mop = mirror_config.mop;
+  instance->dio_intdoubl = mirror_config.dio_intdoubl;
+  instance->dio_intmin = mirror_config.dio_intmin;
+  instance->dio_intcurrent = instance->dio_intmin + instance->dio_intdoubl;
+  instance->dio_redundancy = mirror_config.dio_redundancy;
+  instance->max_rankinc = mirror_config.max_rankinc;
+  instance->min_hoprankinc = mirror_config.min_hoprankinc;
+  instance->default_lifetime = mirror_config.default_lifetime;
+  instance->lifetime_unit = mirror_config.lifetime_unit;
+  instance->dtsn_out = mirror_config.dtsn_out;
+  RPL_LOLLIPOP_INCREMENT(instance->dtsn_out);
+  dag->rank = ROOT_RANK(instance);
+  if(mirror_config.prefix_info.length != 0) {
+    rpl_set_prefix(dag, &mirror_config.prefix_info.prefix,
+                   mirror_config.prefix_info.length);
+  }
+
+  for(i = 0; i < num_mirror_routes; i++) {
+    struct sync_route *route = &mirror_routes[i];
+
+    /* Infinite lifetimes go through as they are */
+    lifetime = rpl_lifetime_remaining(route->lifetime);
+    if(lifetime == 0) {
+      continue;
+    }
+    if(RPL_IS_STORING(instance)) {
+      uip_ds6_route_t *rep;
+
+      /* Only routes through our own neighbors are usable from here */
+      if(uip_ds6_nbr_lookup(&route->via) != NULL) {
+        rep = rpl_add_route(dag, &route->target, route->length, &route->via);
+        if(rep != NULL) {
+          rpl_set_route_lifetime(rep, lifetime);
+        }
+      }
+    }
+#if RPL_WITH_NON_STORING
+    if(RPL_IS_NON_STORING(instance)) {
+      rpl_ns_update_node(dag, &route->target, &route->via, lifetime);
+    }
+#endif /* RPL_WITH_NON_STORING */
+  }
+  have_mirror = 0;
+
+  rpl_reset_dio_timer(instance);
+  RPL_STAT(rpl_stats.root_takeovers++);
+  PRINTF("RPL: Took over with version %u, %u routes mirrored\n",
+         dag->version, num_mirror_routes);
+}
+/*---------------------------------------------------------------------------*/
+static void
+backup_periodic(void *ptr)
+{
+  rpl_dag_t *dag;
+  struct sync_header h;
+
+  if(rpl_dag_root_is_root()) {
+    /* Took over; the role ends here */
+    return;
+  }
+
+  if(have_mirror && clock_time() - last_sync >= RPL_ROOT_TAKEOVER_TIME) {
+    take_over();
+    return;
+  }
+
+  dag = rpl_get_any_dag();
+  if(dag != NULL && dag->joined) {
+    memset(&h, 0, sizeof(h));
+    h.type = SYNC_REQUEST;
+    simple_udp_sendto(&sync_conn, &h, sizeof(h), &dag->dag_id);
+  }
+  ctimer_set(&sync_timer, RPL_ROOT_SYNC_INTERVAL, backup_periodic, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_dag_root_serve_backup(void)
+{
+  sync_register();
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_dag_root_init_backup(void)
+{
+  sync_register();
+  have_mirror = 0;
+  staging = 0;
+  ctimer_set(&sync_timer, RPL_ROOT_SYNC_INTERVAL, backup_periodic, NULL);
+}
+#endif /* RPL_ROOT_SYNC */
+/*---------------------------------------------------------------------------*/
@@ -38,4 +38,8 @@ int rpl_dag_root_init_dag_immediately(void);
 
 int rpl_dag_root_is_root(void);
 
+/* Hot-standby root, see RPL_ROOT_SYNC */
+void rpl_dag_root_serve_backup(void);
+void rpl_dag_root_init_backup(void);
+
 #endif /* RPL_DAG_ROOT_H_ */
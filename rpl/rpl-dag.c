@@ -230,6 +230,8 @@ rpl_parent_is_reachable(rpl_parent_t *p) {
 static void
 rpl_set_preferred_parent(rpl_dag_t *dag, rpl_parent_t *p)
 {
+  rpl_parent_t *old;
+
   if(dag != NULL && dag->preferred_parent != p) {
     PRINTF("RPL: rpl_set_preferred_parent ");
     if(p != NULL) {
@@ -253,7 +255,14 @@ rpl_set_preferred_parent(rpl_dag_t *dag, rpl_parent_t *p)
      * neighbor table. */
     nbr_table_unlock(rpl_parents, dag->preferred_parent);
     nbr_table_lock(rpl_parents, p);
+    old = dag->preferred_parent;
     dag->preferred_parent = p;
+    if(old != NULL) {
+      rpl_nbr_policy_parent_updated(old);
+    }
+    if(p != NULL) {
+      rpl_nbr_policy_parent_updated(p);
+    }
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -323,11 +332,33 @@ should_refresh_routes(rpl_instance_t *instance, rpl_dio_t *dio, rpl_parent_t *p)
 static int
 acceptable_rank(rpl_dag_t *dag, rpl_rank_t rank)
 {
+#if RPL_LOCAL_REPAIR_BOUNDED
+  rpl_instance_t *instance = dag->instance;
+
+  /* A bounded local repair may raise the rank we held by so much only */
+  if(instance->detached && dag == instance->current_dag &&
+     DAG_RANK(rank, instance) >
+     DAG_RANK((uint32_t)instance->detached_rank + RPL_LOCAL_REPAIR_MAX_RANKINC, instance)) {
+    return 0;
+  }
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
   return rank != INFINITE_RANK &&
     ((dag->instance->max_rankinc == 0) ||
      DAG_RANK(rank, dag->instance) <= DAG_RANK(dag->min_rank + dag->instance->max_rankinc, dag->instance));
 }
 /*---------------------------------------------------------------------------*/
+/* The rank of a DAG left without a preferred parent */
+static rpl_rank_t
+orphan_rank(rpl_dag_t *dag)
+{
+#if RPL_LOCAL_REPAIR_BOUNDED
+  if(dag->instance->detached && dag == dag->instance->current_dag) {
+    return dag->instance->detached_rank;
+  }
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
+  return INFINITE_RANK;
+}
+/*---------------------------------------------------------------------------*/
 static rpl_dag_t *
 get_dag(uint8_t instance_id, uip_ipaddr_t *dag_id)
 {
@@ -423,12 +454,14 @@ rpl_set_root(uint8_t instance_id, uip_ipaddr_t *dag_id)
     }
 
     instance->current_dag->joined = 0;
+    rpl_schedule_dag_expiry(instance->current_dag);
   }
 
   instance->current_dag = dag;
   instance->dtsn_out = RPL_LOLLIPOP_INIT;
   instance->of->update_metric_container(instance);
   default_instance = instance;
+  rpl_joined_dag(dag);
 
   PRINTF("RPL: Node set to be a DAG root with DAG ID ");
   PRINT6ADDR(&dag->dag_id);
@@ -453,6 +486,7 @@ rpl_repair_root(uint8_t instance_id)
     return 0;
   }
   RPL_STAT(rpl_stats.root_repairs++);
+  RPL_COUNT(repairs[RPL_REPAIR_ROOT]);
 
   RPL_LOLLIPOP_INCREMENT(instance->current_dag->version);
   RPL_LOLLIPOP_INCREMENT(instance->dtsn_out);
@@ -571,6 +605,12 @@ rpl_alloc_instance(uint8_t instance_id)
       instance->instance_id = instance_id;
       instance->def_route = NULL;
       instance->used = 1;
+      instance->repair_tokens = RPL_LOOP_REPAIR_RESET_BURST;
+      instance->repair_time = clock_time();
+      instance->dio_reset_time = clock_time() - RPL_TRICKLE_MIN_RESET_INTERVAL;
+#if RPL_TRICKLE_ADAPTIVE
+      instance->dio_consistency = 100;
+#endif /* RPL_TRICKLE_ADAPTIVE */
 #if RPL_WITH_PROBING
       rpl_schedule_probing(instance);
 #endif /* RPL_WITH_PROBING */
@@ -638,6 +678,7 @@ rpl_free_instance(rpl_instance_t *instance)
   }
 
   rpl_set_default_route(instance, NULL);
+  rpl_icmp6_dco_flush(instance);
 
 #if RPL_WITH_PROBING
   ctimer_stop(&instance->probing_timer);
@@ -645,12 +686,20 @@ rpl_free_instance(rpl_instance_t *instance)
   ctimer_stop(&instance->dio_timer);
   ctimer_stop(&instance->dao_timer);
   ctimer_stop(&instance->dao_lifetime_timer);
+#if RPL_LOCAL_REPAIR_BOUNDED
+  ctimer_stop(&instance->detach_timer);
+  instance->detached = 0;
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
 
   if(default_instance == instance) {
     default_instance = NULL;
   }
 
   instance->used = 0;
+
+  if(rpl_get_any_dag() == NULL) {
+    rpl_lost_dag();
+  }
 }
 /*---------------------------------------------------------------------------*/
 void
@@ -674,6 +723,11 @@ rpl_free_dag(rpl_dag_t *dag)
 
     remove_parents(dag, 0);
   }
+  if(dag == dag->instance->current_dag) {
+    /* Pending DCOs carry the ID of the current DAG */
+    rpl_icmp6_dco_flush(dag->instance);
+  }
+  rpl_cancel_dag_expiry(dag);
   dag->used = 0;
 }
 /*---------------------------------------------------------------------------*/
@@ -698,6 +752,10 @@ rpl_add_parent(rpl_dag_t *dag, rpl_dio_t *dio, uip_ipaddr_t *addr)
       p->dag = dag;
       p->rank = dio->rank;
       p->dtsn = dio->dtsn;
+      p->repair_tokens = RPL_LOOP_REPAIR_DIO_BURST;
+      p->repair_time = clock_time();
+      rpl_ext_header_flush_parent_cache();
+      rpl_nbr_policy_parent_added(p);
 #if RPL_WITH_MC
       memcpy(&p->mc, &dio->mc, sizeof(p->mc));
 #endif /* RPL_WITH_MC */
@@ -801,6 +859,7 @@ rpl_select_dag(rpl_instance_t *instance, rpl_parent_t *p)
 
     best_dag->joined = 1;
     instance->current_dag->joined = 0;
+    rpl_schedule_dag_expiry(instance->current_dag);
     instance->current_dag = best_dag;
   }
 
@@ -816,6 +875,7 @@ rpl_select_dag(rpl_instance_t *instance, rpl_parent_t *p)
   if(!acceptable_rank(best_dag, best_dag->rank)) {
     PRINTF("RPL: New rank unacceptable!\n");
     rpl_set_preferred_parent(instance->current_dag, NULL);
+    best_dag->rank = orphan_rank(best_dag);
     if(RPL_IS_STORING(instance) && last_parent != NULL) {
       /* Send a No-Path DAO to the removed preferred parent. */
       dao_output(last_parent, RPL_ZERO_LIFETIME);
@@ -828,6 +888,10 @@ rpl_select_dag(rpl_instance_t *instance, rpl_parent_t *p)
     PRINTF("RPL: Changed preferred parent, rank changed from %u to %u\n",
   	(unsigned)old_rank, best_dag->rank);
     RPL_STAT(rpl_stats.parent_switch++);
+    RPL_COUNT(parent_switches);
+    RPL_TRACE_EVENT(RPL_TRACE_PARENT_SWITCH, best_dag->rank,
+                    rpl_trace_parent(best_dag->preferred_parent),
+                    rpl_trace_parent(last_parent));
     if(RPL_IS_STORING(instance)) {
 #if !RPL_WITH_DCO	
       if(last_parent != NULL) {
@@ -844,17 +908,38 @@ rpl_select_dag(rpl_instance_t *instance, rpl_parent_t *p)
     }
     /* The DAO parent set changed - schedule a DAO transmission. */
     rpl_schedule_dao(instance);
-    rpl_reset_dio_timer(instance);
+    rpl_reset_dio_timer_on_change(instance, old_rank, best_dag->rank, 1);
 #if DEBUG
     rpl_print_neighbor_list();
 #endif
   } else if(best_dag->rank != old_rank) {
     PRINTF("RPL: Preferred parent update, rank changed from %u to %u\n",
   	(unsigned)old_rank, best_dag->rank);
+    rpl_reset_dio_timer_on_change(instance, old_rank, best_dag->rank, 0);
   }
   return best_dag;
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * A detached neighbor has no way upwards, so it is kept only if it already
+ * is our preferred parent. While we are detached ourselves, descendants
+ * (of a greater DAG rank than the one we hold) are no candidates either.
+ */
+static int
+candidate_parent(rpl_dag_t *dag, rpl_parent_t *p)
+{
+  if((p->flags & RPL_PARENT_FLAG_DETACHED) && p != dag->preferred_parent) {
+    return 0;
+  }
+#if RPL_LOCAL_REPAIR_BOUNDED
+  if(dag->instance->detached && dag == dag->instance->current_dag &&
+     DAG_RANK(p->rank, dag->instance) > DAG_RANK(dag->instance->detached_rank, dag->instance)) {
+    return 0;
+  }
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
 static rpl_parent_t *
 best_parent(rpl_dag_t *dag, int fresh_only)
 {
@@ -883,6 +968,10 @@ best_parent(rpl_dag_t *dag, int fresh_only)
       continue;
     }
 
+    if(!candidate_parent(dag, p)) {
+      continue;
+    }
+
 #if UIP_ND6_SEND_NS
     {
     uip_ds6_nbr_t *nbr = rpl_get_nbr(p);
@@ -897,6 +986,10 @@ best_parent(rpl_dag_t *dag, int fresh_only)
     best = of->best_parent(best, p);
   }
 
+  RPL_TRACE_EVENT(RPL_TRACE_BEST_PARENT,
+                  best != NULL ? best->rank : INFINITE_RANK,
+                  rpl_trace_parent(best),
+                  rpl_trace_parent(dag->preferred_parent));
   return best;
 }
 /*---------------------------------------------------------------------------*/
@@ -932,7 +1025,11 @@ rpl_select_parent(rpl_dag_t *dag)
     rpl_set_preferred_parent(dag, NULL);
   }
 
-  dag->rank = rpl_rank_via_parent(dag->preferred_parent);
+  if(dag->preferred_parent != NULL) {
+    dag->rank = rpl_rank_via_parent(dag->preferred_parent);
+  } else {
+    dag->rank = orphan_rank(dag);
+  }
   return dag->preferred_parent;
 }
 /*---------------------------------------------------------------------------*/
@@ -945,7 +1042,11 @@ rpl_remove_parent(rpl_parent_t *parent)
 
   rpl_nullify_parent(parent);
 
+  rpl_nbr_policy_parent_removed(parent);
+  /* Entries still in the rank recalculation queue are skipped */
+  parent->flags &= ~RPL_PARENT_FLAG_UPDATED;
   nbr_table_remove(rpl_parents, parent);
+  rpl_ext_header_flush_parent_cache();
 }
 /*---------------------------------------------------------------------------*/
 void
@@ -955,7 +1056,7 @@ rpl_nullify_parent(rpl_parent_t *parent)
   /* This function can be called when the preferred parent is NULL, so we
      need to handle this condition in order to trigger uip_ds6_defrt_rm. */
   if(parent == dag->preferred_parent || dag->preferred_parent == NULL) {
-    dag->rank = INFINITE_RANK;
+    dag->rank = orphan_rank(dag);
     if(dag->joined) {
       if(dag->instance->def_route != NULL) {
         PRINTF("RPL: Removing default route ");
@@ -1005,6 +1106,7 @@ rpl_move_parent(rpl_dag_t *dag_src, rpl_dag_t *dag_dst, rpl_parent_t *parent)
   PRINTF("\n");
 
   parent->dag = dag_dst;
+  rpl_nbr_policy_parent_updated(parent);
 }
 /*---------------------------------------------------------------------------*/
 int
@@ -1174,6 +1276,7 @@ rpl_join_instance(uip_ipaddr_t *from, rpl_dio_t *dio)
   PRINTF("\n");
 
   ANNOTATE("#A join=%u\n", dag->dag_id.u8[sizeof(dag->dag_id) - 1]);
+  rpl_joined_dag(dag);
 
   rpl_reset_dio_timer(instance);
   rpl_set_default_route(instance, from);
@@ -1307,18 +1410,16 @@ global_repair(uip_ipaddr_t *from, rpl_dag_t *dag, rpl_dio_t *dio)
          dag->version, dag->rank);
 
   RPL_STAT(rpl_stats.global_repairs++);
+  RPL_COUNT(repairs[RPL_REPAIR_GLOBAL]);
+  RPL_TRACE_EVENT(RPL_TRACE_GLOBAL_REPAIR, dag->rank, 0, dag->version);
 }
 
 /*---------------------------------------------------------------------------*/
-void
-rpl_local_repair(rpl_instance_t *instance)
+static void
+poison_instance(rpl_instance_t *instance)
 {
   int i;
 
-  if(instance == NULL) {
-    PRINTF("RPL: local repair requested for instance NULL\n");
-    return;
-  }
   PRINTF("RPL: Starting a local instance repair\n");
   for(i = 0; i < RPL_MAX_DAG_PER_INSTANCE; i++) {
     if(instance->dag_table[i].used) {
@@ -1339,28 +1440,166 @@ rpl_local_repair(rpl_instance_t *instance)
   }
 
   RPL_STAT(rpl_stats.local_repairs++);
+
+  if(instance == default_instance) {
+    /* No rank until a parent shows up, look for one */
+    rpl_lost_dag();
+  }
+}
+#if RPL_LOCAL_REPAIR_BOUNDED
+/*---------------------------------------------------------------------------*/
+static void
+detach_expired(void *ptr)
+{
+  rpl_instance_t *instance = ptr;
+
+  PRINTF("RPL: No parent found while detached\n");
+  instance->detached = 0;
+  RPL_COUNT(repairs[RPL_REPAIR_DETACH_EXPIRY]);
+  poison_instance(instance);
+}
+/*---------------------------------------------------------------------------*/
+static void
+reattach(rpl_instance_t *instance)
+{
+  PRINTF("RPL: Reattached with rank %u, held %u\n",
+         instance->current_dag->rank, instance->detached_rank);
+  instance->detached = 0;
+  ctimer_stop(&instance->detach_timer);
+  RPL_STAT(rpl_stats.bounded_repairs++);
+  RPL_COUNT(repairs[RPL_REPAIR_BOUNDED]);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Starts a bounded local repair: the current rank is held, so that the
+ * subtree below us keeps its routes, while we look for another parent.
+ * Returns 0 if there is no rank to hold.
+ */
+static int
+detach(rpl_instance_t *instance)
+{
+  rpl_dag_t *dag;
+  rpl_parent_t *p;
+
+  dag = instance->current_dag;
+  if(dag == NULL || !dag->joined || dag->rank == INFINITE_RANK ||
+     dag->rank == ROOT_RANK(instance)) {
+    return 0;
+  }
+
+  PRINTF("RPL: Detaching, holding rank %u\n", dag->rank);
+  instance->detached = 1;
+  instance->detached_rank = dag->rank;
+  ctimer_set(&instance->detach_timer, RPL_LOCAL_REPAIR_HOLD_TIME,
+             detach_expired, instance);
+  RPL_STAT(rpl_stats.detaches++);
+
+  p = dag->preferred_parent;
+  if(p != NULL) {
+    /* The parent failed us; it is no candidate until it advertises again */
+    rpl_nullify_parent(p);
+    p->rank = INFINITE_RANK;
+    rpl_nbr_policy_parent_updated(p);
+  }
+
+  /* Try the next-best parents and the siblings first */
+  p = best_parent(dag, 0);
+  if(p != NULL) {
+    rpl_process_parent_event(instance, p);
+  }
+
+  if(instance->detached) {
+    /* Tell the neighborhood we are detached and ask it for fresh DIOs */
+    rpl_reset_dio_timer(instance);
+    dis_output(NULL);
+  }
+  return 1;
+}
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
+/*---------------------------------------------------------------------------*/
+void
+rpl_local_repair(rpl_instance_t *instance)
+{
+  if(instance == NULL) {
+    PRINTF("RPL: local repair requested for instance NULL\n");
+    return;
+  }
+  RPL_TRACE_EVENT(RPL_TRACE_LOCAL_REPAIR,
+                  instance->current_dag != NULL ?
+                  instance->current_dag->rank : INFINITE_RANK, 0, 0);
+#if RPL_LOCAL_REPAIR_BOUNDED
+  if(instance->detached) {
+    /* Already repairing; the hold timer decides when to poison */
+    return;
+  }
+  if(detach(instance)) {
+    return;
+  }
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
+  poison_instance(instance);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Parents with RPL_PARENT_FLAG_UPDATED set, in the order they were
+ * updated. A parent is queued at most once while the flag is set; if the
+ * queue still overflows, the next recalculation walks the parent table.
+ */
+static rpl_parent_t *updated_parents[NBR_TABLE_MAX_NEIGHBORS];
+static uint16_t num_updated_parents;
+static uint8_t updated_parents_overflow;
+/*---------------------------------------------------------------------------*/
+void
+rpl_queue_parent_update(rpl_parent_t *p)
+{
+  if(!(p->flags & RPL_PARENT_FLAG_UPDATED)) {
+    p->flags |= RPL_PARENT_FLAG_UPDATED;
+    if(num_updated_parents < NBR_TABLE_MAX_NEIGHBORS) {
+      updated_parents[num_updated_parents++] = p;
+    } else {
+      updated_parents_overflow = 1;
+    }
+  }
+  rpl_schedule_rank_recalculation();
+}
+/*---------------------------------------------------------------------------*/
+static void
+recalculate_rank(rpl_parent_t *p)
+{
+  if(p->dag != NULL && p->dag->instance && (p->flags & RPL_PARENT_FLAG_UPDATED)) {
+    p->flags &= ~RPL_PARENT_FLAG_UPDATED;
+    PRINTF("RPL: rpl_process_parent_event recalculate_ranks\n");
+    if(!rpl_process_parent_event(p->dag->instance, p)) {
+      PRINTF("RPL: A parent was dropped\n");
+    }
+    /* The link metric may have changed the rank via this parent */
+    rpl_nbr_policy_parent_updated(p);
+  }
 }
 /*---------------------------------------------------------------------------*/
 void
 rpl_recalculate_ranks(void)
 {
   rpl_parent_t *p;
+  uint16_t i;
 
   /*
    * We recalculate ranks when we receive feedback from the system rather
-   * than RPL protocol messages. This periodical recalculation is called
-   * from a timer in order to keep the stack depth reasonably low.
+   * than RPL protocol messages. This recalculation is called from a timer
+   * in order to keep the stack depth reasonably low, and only visits the
+   * parents that were queued as updated.
    */
-  p = nbr_table_head(rpl_parents);
-  while(p != NULL) {
-    if(p->dag != NULL && p->dag->instance && (p->flags & RPL_PARENT_FLAG_UPDATED)) {
-      p->flags &= ~RPL_PARENT_FLAG_UPDATED;
-      PRINTF("RPL: rpl_process_parent_event recalculate_ranks\n");
-      if(!rpl_process_parent_event(p->dag->instance, p)) {
-        PRINTF("RPL: A parent was dropped\n");
-      }
+  for(i = 0; i < num_updated_parents; i++) {
+    recalculate_rank(updated_parents[i]);
+  }
+  num_updated_parents = 0;
+
+  if(updated_parents_overflow) {
+    updated_parents_overflow = 0;
+    p = nbr_table_head(rpl_parents);
+    while(p != NULL) {
+      recalculate_rank(p);
+      p = nbr_table_next(rpl_parents, p);
     }
-    p = nbr_table_next(rpl_parents, p);
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -1368,12 +1607,11 @@ int
 rpl_process_parent_event(rpl_instance_t *instance, rpl_parent_t *p)
 {
   int return_value;
-  rpl_parent_t *last_parent = instance->current_dag->preferred_parent;
-
-#if DEBUG
+  rpl_dag_t *last_dag = instance->current_dag;
+  rpl_parent_t *last_parent = last_dag->preferred_parent;
   rpl_rank_t old_rank;
-  old_rank = instance->current_dag->rank;
-#endif /* DEBUG */
+
+  old_rank = last_dag->rank;
 
   return_value = 1;
 
@@ -1403,11 +1641,30 @@ rpl_process_parent_event(rpl_instance_t *instance, rpl_parent_t *p)
     if(last_parent != NULL) {
       /* No suitable parent anymore; trigger a local repair. */
       PRINTF("RPL: No parents found in any DAG\n");
+#if RPL_LOCAL_REPAIR_BOUNDED
+      if(instance->current_dag == last_dag) {
+        /* Hold on to the rank we had with the lost parent */
+        last_dag->rank = old_rank;
+      }
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
+      RPL_COUNT(repairs[RPL_REPAIR_NO_PARENT]);
       rpl_local_repair(instance);
       return 0;
     }
   }
 
+  if(instance->current_dag->preferred_parent != NULL) {
+    /* Ends the search if the node had lost its rank */
+    rpl_joined_dag(instance->current_dag);
+  }
+
+#if RPL_LOCAL_REPAIR_BOUNDED
+  if(instance->detached && instance->current_dag->preferred_parent != NULL) {
+    /* Found a parent within the bound: the subtree never noticed */
+    reattach(instance);
+  }
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
+
 #if DEBUG
   if(DAG_RANK(old_rank, instance) != DAG_RANK(instance->current_dag->rank, instance)) {
     PRINTF("RPL: Moving in the instance from rank %hu to %hu\n",
@@ -1461,6 +1718,10 @@ rpl_process_dio(uip_ipaddr_t *from, rpl_dio_t *dio)
   instance = rpl_get_instance(dio->instance_id);
 
   if(dag != NULL && instance != NULL) {
+#if RPL_SNAPSHOT
+    /* The DAG is still there, whatever its version */
+    rpl_snapshot_confirm(dag);
+#endif /* RPL_SNAPSHOT */
     if(lollipop_greater_than(dio->version, dag->version)) {
       if(dag->rank == ROOT_RANK(instance)) {
         PRINTF("RPL: Root received inconsistent DIO version number (current: %u, received: %u)\n", dag->version, dio->version);
@@ -1543,6 +1804,12 @@ rpl_process_dio(uip_ipaddr_t *from, rpl_dio_t *dio)
     return;
   }
 
+  /* The total does not saturate as the count of the interval does */
+  RPL_COUNT(dio_heard);
+  if(instance->dio_heard < 0xff) {
+    instance->dio_heard++;
+  }
+
   if(dag->rank == ROOT_RANK(instance)) {
     if(dio->rank != INFINITE_RANK) {
       instance->dio_counter++;
@@ -1551,10 +1818,11 @@ rpl_process_dio(uip_ipaddr_t *from, rpl_dio_t *dio)
   }
 
   /* The DIO comes from a valid DAG, we can refresh its lifetime */
-  dag->lifetime = (1UL << (instance->dio_intmin + instance->dio_intdoubl)) * RPL_DAG_LIFETIME / 1000;
+  dag->lifetime = rpl_lifetime_to_expiry((1UL << (instance->dio_intmin + instance->dio_intdoubl)) * RPL_DAG_LIFETIME / 1000);
+  rpl_schedule_dag_expiry(dag);
   PRINTF("RPL: Set dag ");
   PRINT6ADDR(&dag->dag_id);
-  PRINTF(" lifetime to %ld\n", dag->lifetime);
+  PRINTF(" lifetime to %ld\n", (long)rpl_lifetime_remaining(dag->lifetime));
 
   /*
    * At this point, we know that this DIO pertains to a DAG that
@@ -1593,6 +1861,12 @@ rpl_process_dio(uip_ipaddr_t *from, rpl_dio_t *dio)
     }
   }
   p->rank = dio->rank;
+  if(dio->detached) {
+    p->flags |= RPL_PARENT_FLAG_DETACHED;
+  } else {
+    p->flags &= ~RPL_PARENT_FLAG_DETACHED;
+  }
+  rpl_nbr_policy_parent_updated(p);
 
   if(dio->rank == INFINITE_RANK && p == dag->preferred_parent) {
     /* Our preferred parent advertised an infinite rank, reset DIO timer */
@@ -1600,7 +1874,7 @@ rpl_process_dio(uip_ipaddr_t *from, rpl_dio_t *dio)
   }
 
   /* Parent info has been updated, trigger rank recalculation */
-  p->flags |= RPL_PARENT_FLAG_UPDATED;
+  rpl_queue_parent_update(p);
 
   PRINTF("RPL: preferred DAG ");
   PRINT6ADDR(&instance->current_dag->dag_id);
@@ -68,6 +68,128 @@
 #define UIP_EXT_HDR_OPT_PADN_BUF  ((struct uip_ext_hdr_opt_padn *)&uip_buf[uip_l2_l3_hdr_len + uip_ext_opt_offset])
 #define UIP_EXT_HDR_OPT_RPL_BUF   ((struct uip_ext_hdr_opt_rpl *)&uip_buf[uip_l2_l3_hdr_len + uip_ext_opt_offset])
 /*---------------------------------------------------------------------------*/
+#if RPL_WITH_HBH_CACHE
+/* Last instance seen in a hop-by-hop option */
+static rpl_instance_t *cached_instance;
+
+/* Last link-layer sender and its parent entry, NULL if not a parent */
+static linkaddr_t cached_sender_addr;
+static rpl_parent_t *cached_sender;
+static uint8_t cached_sender_valid;
+
+#if (UIP_CONF_MAX_ROUTES != 0)
+/* Route lookup results, two-way set associative, flushed whenever a
+   route is added or removed */
+struct route_cache_entry {
+  uip_ipaddr_t dest;
+  uip_ds6_route_t *route;
+  uint8_t valid;
+};
+static struct route_cache_entry route_cache[RPL_HBH_ROUTE_CACHE_SIZE];
+static struct uip_ds6_notification route_notification;
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+#endif /* RPL_WITH_HBH_CACHE */
+/*---------------------------------------------------------------------------*/
+#if RPL_WITH_HBH_CACHE && (UIP_CONF_MAX_ROUTES != 0)
+static void
+route_callback(int event, uip_ipaddr_t *route, uip_ipaddr_t *nexthop, int num_routes)
+{
+  if(event == UIP_DS6_NOTIFICATION_ROUTE_ADD ||
+     event == UIP_DS6_NOTIFICATION_ROUTE_RM) {
+    memset(route_cache, 0, sizeof(route_cache));
+  }
+}
+#endif /* RPL_WITH_HBH_CACHE && (UIP_CONF_MAX_ROUTES != 0) */
+/*---------------------------------------------------------------------------*/
+void
+rpl_ext_header_init(void)
+{
+#if RPL_WITH_HBH_CACHE
+  cached_instance = NULL;
+  cached_sender_valid = 0;
+#if (UIP_CONF_MAX_ROUTES != 0)
+  memset(route_cache, 0, sizeof(route_cache));
+  uip_ds6_notification_add(&route_notification, route_callback);
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+#endif /* RPL_WITH_HBH_CACHE */
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_ext_header_flush_parent_cache(void)
+{
+#if RPL_WITH_HBH_CACHE
+  cached_sender_valid = 0;
+#endif /* RPL_WITH_HBH_CACHE */
+}
+/*---------------------------------------------------------------------------*/
+static rpl_instance_t *
+hbh_get_instance(uint8_t instance_id)
+{
+#if RPL_WITH_HBH_CACHE
+  if(cached_instance != NULL && cached_instance->used &&
+     cached_instance->instance_id == instance_id) {
+    return cached_instance;
+  }
+  cached_instance = rpl_get_instance(instance_id);
+  return cached_instance;
+#else /* RPL_WITH_HBH_CACHE */
+  return rpl_get_instance(instance_id);
+#endif /* RPL_WITH_HBH_CACHE */
+}
+/*---------------------------------------------------------------------------*/
+static rpl_parent_t *
+hbh_get_sender(void)
+{
+  const linkaddr_t *sender_addr;
+
+  sender_addr = packetbuf_addr(PACKETBUF_ADDR_SENDER);
+#if RPL_WITH_HBH_CACHE
+  if(cached_sender_valid && linkaddr_cmp(&cached_sender_addr, sender_addr)) {
+    RPL_STAT(rpl_stats.hbh_cache_hits++);
+    return cached_sender;
+  }
+  RPL_STAT(rpl_stats.hbh_cache_misses++);
+  linkaddr_copy(&cached_sender_addr, sender_addr);
+  cached_sender = nbr_table_get_from_lladdr(rpl_parents, sender_addr);
+  cached_sender_valid = 1;
+  return cached_sender;
+#else /* RPL_WITH_HBH_CACHE */
+  return nbr_table_get_from_lladdr(rpl_parents, sender_addr);
+#endif /* RPL_WITH_HBH_CACHE */
+}
+/*---------------------------------------------------------------------------*/
+static uip_ds6_route_t *
+hbh_route_lookup(uip_ipaddr_t *dest)
+{
+#if RPL_WITH_HBH_CACHE && (UIP_CONF_MAX_ROUTES != 0)
+  struct route_cache_entry *set;
+  struct route_cache_entry e;
+
+  /* Two ways per set, the most recently used first */
+  set = &route_cache[((dest->u8[14] * 31 + dest->u8[15]) &
+                      (RPL_HBH_ROUTE_CACHE_SIZE / 2 - 1)) * 2];
+  if(set[0].valid && uip_ipaddr_cmp(&set[0].dest, dest)) {
+    RPL_STAT(rpl_stats.hbh_cache_hits++);
+    return set[0].route;
+  }
+  if(set[1].valid && uip_ipaddr_cmp(&set[1].dest, dest)) {
+    RPL_STAT(rpl_stats.hbh_cache_hits++);
+    e = set[1];
+    set[1] = set[0];
+    set[0] = e;
+    return e.route;
+  }
+  RPL_STAT(rpl_stats.hbh_cache_misses++);
+  set[1] = set[0];
+  uip_ipaddr_copy(&set[0].dest, dest);
+  set[0].route = uip_ds6_route_lookup(dest);
+  set[0].valid = 1;
+  return set[0].route;
+#else /* RPL_WITH_HBH_CACHE && (UIP_CONF_MAX_ROUTES != 0) */
+  return uip_ds6_route_lookup(dest);
+#endif /* RPL_WITH_HBH_CACHE && (UIP_CONF_MAX_ROUTES != 0) */
+}
+/*---------------------------------------------------------------------------*/
 int
 rpl_verify_hbh_header(int uip_ext_opt_offset)
 {
@@ -89,7 +211,7 @@ rpl_verify_hbh_header(int uip_ext_opt_offset)
     return 0; /* Drop */
   }
 
-  instance = rpl_get_instance(UIP_EXT_HDR_OPT_RPL_BUF->instance);
+  instance = hbh_get_instance(UIP_EXT_HDR_OPT_RPL_BUF->instance);
   if(instance == NULL) {
     PRINTF("RPL: Unknown instance: %u\n",
            UIP_EXT_HDR_OPT_RPL_BUF->instance);
@@ -103,14 +225,14 @@ rpl_verify_hbh_header(int uip_ext_opt_offset)
          routes that go through the neighbor that sent the packet to
          us. */
     if(RPL_IS_STORING(instance)) {
-      route = uip_ds6_route_lookup(&UIP_IP_BUF->destipaddr);
+      route = hbh_route_lookup(&UIP_IP_BUF->destipaddr);
       if(route != NULL) {
         uip_ds6_route_rm(route);
       }
     }
     RPL_STAT(rpl_stats.forward_errors++);
     /* Trigger DAO retransmission */
-    rpl_reset_dio_timer(instance);
+    rpl_request_loop_repair_reset(instance);
     /* drop the packet as it is not routable */
     return 0;
   }
@@ -125,7 +247,7 @@ rpl_verify_hbh_header(int uip_ext_opt_offset)
   }
 
   sender_rank = UIP_HTONS(UIP_EXT_HDR_OPT_RPL_BUF->senderrank);
-  sender = nbr_table_get_from_lladdr(rpl_parents, packetbuf_addr(PACKETBUF_ADDR_SENDER));
+  sender = hbh_get_sender();
 
   if(sender != NULL && (UIP_EXT_HDR_OPT_RPL_BUF->flags & RPL_HDR_OPT_RANK_ERR)) {
     /* A rank error was signalled, attempt to repair it by updating
@@ -154,14 +276,13 @@ rpl_verify_hbh_header(int uip_ext_opt_offset)
     /* Attempt to repair the loop by sending a unicast DIO back to the sender
      * so that it gets a fresh update of our rank. */
     if(sender != NULL) {
-      instance->unicast_dio_target = sender;
-      rpl_schedule_unicast_dio_immediately(instance);
+      rpl_schedule_loop_repair(instance, sender);
     }
     if(UIP_EXT_HDR_OPT_RPL_BUF->flags & RPL_HDR_OPT_RANK_ERR) {
       RPL_STAT(rpl_stats.loop_errors++);
       PRINTF("RPL: Rank error signalled in RPL option!\n");
       /* Packet must be dropped and dio trickle timer reset, see RFC6550 - 11.2.2.2 */
-      rpl_reset_dio_timer(instance);
+      rpl_request_loop_repair_reset(instance);
       return 0;
     }
     PRINTF("RPL: Single error tolerated\n");
@@ -214,7 +335,7 @@ rpl_srh_get_next_hop(uip_ipaddr_t *ipaddr)
   if((uip_next_hdr != NULL && *uip_next_hdr == UIP_PROTO_ROUTING
       && UIP_RH_BUF->routing_type == RPL_RH_TYPE_SRH) ||
      (dest_node != NULL && root_node != NULL &&
-      dest_node->parent == root_node)) {
+      rpl_ns_node_parent(dest_node) == root_node)) {
     /* Routing header found or the packet destined for a direct child of the root.
      * The next hop should be already copied as the IPv6 destination
      * address, via rpl_process_srh_header. We turn this address into a link-local to enable
@@ -322,11 +443,48 @@ count_matching_bytes(const void *p1, const void *p2, size_t n)
   return n;
 }
 /*---------------------------------------------------------------------------*/
+#if RPL_NS_SRH_CACHE_SIZE
+/* Encoded source routing headers, direct-mapped on the destination. An
+   entry is valid as long as the topology generation it was built in. */
+struct srh_cache_entry {
+  uip_ipaddr_t dest;
+  uip_ipaddr_t first_hop;
+  uint32_t generation;
+  uint8_t valid;
+  uint8_t ext_len; /* 0 when the destination is a child of the root */
+  uint8_t hdr[RPL_NS_SRH_CACHE_MAX_LEN];
+};
+
+static struct srh_cache_entry srh_cache[RPL_NS_SRH_CACHE_SIZE];
+
+static struct srh_cache_entry *
+srh_cache_slot(const uip_ipaddr_t *dest)
+{
+  return &srh_cache[(dest->u8[13] * 961 + dest->u8[14] * 31 + dest->u8[15])
+                    & (RPL_NS_SRH_CACHE_SIZE - 1)];
+}
+#endif /* RPL_NS_SRH_CACHE_SIZE */
+/*---------------------------------------------------------------------------*/
+static void
+srh_update_lengths(uint8_t ext_len)
+{
+  uint8_t temp_len;
+
+  /* In-place update of IPv6 length field */
+  temp_len = UIP_IP_BUF->len[1];
+  UIP_IP_BUF->len[1] += ext_len;
+  if(UIP_IP_BUF->len[1] < temp_len) {
+    UIP_IP_BUF->len[0]++;
+  }
+
+  uip_ext_len += ext_len;
+  uip_len += ext_len;
+}
+/*---------------------------------------------------------------------------*/
 static int
 insert_srh_header(void)
 {
   /* Implementation of RFC6554 */
-  uint8_t temp_len;
   uint8_t path_len;
   uint8_t ext_len;
   uint8_t cmpri, cmpre; /* ComprI and ComprE fields of the RPL Source Routing Header */
@@ -337,6 +495,9 @@ insert_srh_header(void)
   rpl_ns_node_t *node;
   rpl_dag_t *dag;
   uip_ipaddr_t node_addr;
+#if RPL_NS_SRH_CACHE_SIZE
+  struct srh_cache_entry *entry;
+#endif /* RPL_NS_SRH_CACHE_SIZE */
 
   PRINTF("RPL: SRH creating source routing header with destination ");
   PRINT6ADDR(&UIP_IP_BUF->destipaddr);
@@ -352,6 +513,29 @@ insert_srh_header(void)
     return 0;
   }
 
+#if RPL_NS_SRH_CACHE_SIZE
+  entry = srh_cache_slot(&UIP_IP_BUF->destipaddr);
+  if(entry->valid && entry->generation == rpl_ns_generation()
+     && uip_ipaddr_cmp(&entry->dest, &UIP_IP_BUF->destipaddr)) {
+    if(entry->ext_len == 0) {
+      return 1;
+    }
+    if(uip_len + entry->ext_len > UIP_BUFSIZE) {
+      PRINTF("RPL: Packet too long: impossible to add source routing header (%u bytes)\n", entry->ext_len);
+      return 1;
+    }
+    memmove(uip_buf + uip_l2_l3_hdr_len + entry->ext_len,
+        uip_buf + uip_l2_l3_hdr_len, uip_len - UIP_IPH_LEN);
+    memcpy(uip_buf + uip_l2_l3_hdr_len, entry->hdr, entry->ext_len);
+    UIP_RH_BUF->next = UIP_IP_BUF->proto;
+    UIP_IP_BUF->proto = UIP_PROTO_ROUTING;
+    uip_ipaddr_copy(&UIP_IP_BUF->destipaddr, &entry->first_hop);
+    srh_update_lengths(entry->ext_len);
+    return 1;
+  }
+  entry->valid = 0;
+#endif /* RPL_NS_SRH_CACHE_SIZE */
+
   dest_node = rpl_ns_get_node(dag, &UIP_IP_BUF->destipaddr);
   if(dest_node == NULL) {
     /* The destination is not found, skip SRH insertion */
@@ -371,13 +555,19 @@ insert_srh_header(void)
 
   /* Compute path length and compression factors (we use cmpri == cmpre) */
   path_len = 0;
-  node = dest_node->parent;
+  node = rpl_ns_node_parent(dest_node);
   /* For simplicity, we use cmpri = cmpre */
   cmpri = 15;
   cmpre = 15;
 
   if(node == root_node) {
     PRINTF("RPL: SRH no need to insert SRH\n");
+#if RPL_NS_SRH_CACHE_SIZE
+    uip_ipaddr_copy(&entry->dest, &UIP_IP_BUF->destipaddr);
+    entry->generation = rpl_ns_generation();
+    entry->ext_len = 0;
+    entry->valid = 1;
+#endif /* RPL_NS_SRH_CACHE_SIZE */
     return 1;
   }
 
@@ -392,7 +582,7 @@ insert_srh_header(void)
     PRINTF("RPL: SRH Hop ");
     PRINT6ADDR(&node_addr);
     PRINTF("\n");
-    node = node->parent;
+    node = rpl_ns_node_parent(node);
     path_len++;
   }
 
@@ -436,28 +626,31 @@ insert_srh_header(void)
   node = dest_node;
   hop_ptr = ((uint8_t *)UIP_RH_BUF) + ext_len - padding; /* Pointer where to write the next hop compressed address */
 
-  while(node != NULL && node->parent != root_node) {
+  while(node != NULL && rpl_ns_node_parent(node) != root_node) {
     rpl_ns_get_node_global_addr(&node_addr, node);
 
     hop_ptr -= (16 - cmpri);
     memcpy(hop_ptr, ((uint8_t*)&node_addr) + cmpri, 16 - cmpri);
 
-    node = node->parent;
+    node = rpl_ns_node_parent(node);
   }
 
   /* The next hop (i.e. node whose parent is the root) is placed as the current IPv6 destination */
   rpl_ns_get_node_global_addr(&node_addr, node);
-  uip_ipaddr_copy(&UIP_IP_BUF->destipaddr, &node_addr);
 
-  /* In-place update of IPv6 length field */
-  temp_len = UIP_IP_BUF->len[1];
-  UIP_IP_BUF->len[1] += ext_len;
-  if(UIP_IP_BUF->len[1] < temp_len) {
-    UIP_IP_BUF->len[0]++;
+#if RPL_NS_SRH_CACHE_SIZE
+  if(ext_len <= RPL_NS_SRH_CACHE_MAX_LEN) {
+    uip_ipaddr_copy(&entry->dest, &UIP_IP_BUF->destipaddr);
+    uip_ipaddr_copy(&entry->first_hop, &node_addr);
+    memcpy(entry->hdr, UIP_RH_BUF, ext_len);
+    entry->generation = rpl_ns_generation();
+    entry->ext_len = ext_len;
+    entry->valid = 1;
   }
+#endif /* RPL_NS_SRH_CACHE_SIZE */
 
-  uip_ext_len += ext_len;
-  uip_len += ext_len;
+  uip_ipaddr_copy(&UIP_IP_BUF->destipaddr, &node_addr);
+  srh_update_lengths(ext_len);
 
   return 1;
 }
@@ -487,7 +680,7 @@ update_hbh_header(void)
       return 0; /* Drop */
     }
 
-    instance = rpl_get_instance(UIP_EXT_HDR_OPT_RPL_BUF->instance);
+    instance = hbh_get_instance(UIP_EXT_HDR_OPT_RPL_BUF->instance);
     if(instance == NULL || !instance->used || !instance->current_dag->joined) {
       PRINTF("RPL: Unable to add/update hop-by-hop extension header: incorrect instance\n");
       uip_ext_len = last_uip_ext_len;
@@ -505,13 +698,13 @@ update_hbh_header(void)
             general not go back up again. If this happens, a
             RPL_HDR_OPT_FWD_ERR should be flagged. */
       if((UIP_EXT_HDR_OPT_RPL_BUF->flags & RPL_HDR_OPT_DOWN)) {
-        if(uip_ds6_route_lookup(&UIP_IP_BUF->destipaddr) == NULL) {
+        if(hbh_route_lookup(&UIP_IP_BUF->destipaddr) == NULL) {
           UIP_EXT_HDR_OPT_RPL_BUF->flags |= RPL_HDR_OPT_FWD_ERR;
           PRINTF("RPL: Forwarding error\n");
           /* We should send back the packet to the originating parent,
                 but it is not feasible yet, so we send a No-Path DAO instead */
           PRINTF("RPL: Generate No-Path DAO\n");
-          parent = rpl_get_parent((uip_lladdr_t *)packetbuf_addr(PACKETBUF_ADDR_SENDER));
+          parent = hbh_get_sender();
           if(parent != NULL) {
             dao_output_target(parent, &UIP_IP_BUF->destipaddr, RPL_ZERO_LIFETIME);
           }
@@ -522,7 +715,7 @@ update_hbh_header(void)
         /* Set the down extension flag correctly as described in Section
               11.2 of RFC6550. If the packet progresses along a DAO route,
               the down flag should be set. */
-        if(uip_ds6_route_lookup(&UIP_IP_BUF->destipaddr) == NULL) {
+        if(hbh_route_lookup(&UIP_IP_BUF->destipaddr) == NULL) {
           /* No route was found, so this packet will go towards the RPL
                 root. If so, we should not set the down flag. */
           UIP_EXT_HDR_OPT_RPL_BUF->flags &= ~RPL_HDR_OPT_DOWN;
@@ -55,6 +55,8 @@
 #include "net/packetbuf.h"
 #include "net/ipv6/multicast/uip-mcast6.h"
 #include "random.h"
+#include "lib/list.h"
+#include "lib/memb.h"
 
 #include <limits.h>
 #include <string.h>
@@ -108,6 +110,7 @@
 #define RPL_DIO_MOP_SHIFT                3
 #define RPL_DIO_MOP_MASK                 0x38
 #define RPL_DIO_PREFERENCE_MASK          0x07
+#define RPL_DIO_FLAG_DETACHED            0x80 /* in the DIO flags field */
 
 #define UIP_IP_BUF       ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
 #define UIP_ICMP_BUF     ((struct uip_icmp_hdr *)&uip_buf[uip_l2_l3_hdr_len])
@@ -306,20 +309,6 @@ update_metric_container(rpl_instance_t *instance)
 				
 static void dao_output_target_seq(rpl_parent_t *parent, uip_ipaddr_t *prefix,
                                   uint8_t lifetime, uint8_t seq_no);
-void dco_output
-(
-    rpl_instance_t *instance,
-	uip_ipaddr_t *pstTargetIP,
-	uip_ipaddr_t *pstDcoTarget,
-	uint8_t pathSequence
-);
-void dco_ack_output
-(
-	rpl_instance_t *instance, 
-	uip_ipaddr_t *dest, 
-	uint8_t sequence,
-	uint8_t status
-);
 
 /* some debug callbacks useful when debugging RPL networks */
 #ifdef RPL_DEBUG_DIO_INPUT
@@ -347,6 +336,10 @@ static uint8_t dco_sequence = RPL_LOLLIPOP_INIT;
 #if RPL_WITH_MULTICAST
 static uip_mcast6_route_t *mcast_group;
 #endif
+
+/* Last time a DAG configuration was solicited from a DIO sender */
+static clock_time_t conf_solicited_time;
+static uint8_t conf_solicited;
 /*---------------------------------------------------------------------------*/
 /* Initialise RPL ICMPv6 message handlers */
 UIP_ICMP6_HANDLER(dis_handler, ICMP6_RPL, RPL_CODE_DIS, dis_input);
@@ -440,6 +433,13 @@ set16(uint8_t *buffer, int pos, uint16_t value)
   buffer[pos++] = value & 0xff;
 }
 /*---------------------------------------------------------------------------*/
+static void
+rpl_icmp6_send(uip_ipaddr_t *dest, int code, int len)
+{
+  rpl_counters_output(code, dest, len);
+  uip_icmp6_send(dest, ICMP6_RPL, code, len);
+}
+/*---------------------------------------------------------------------------*/
 uip_ds6_nbr_t *
 rpl_icmp6_update_nbr_table(uip_ipaddr_t *from, nbr_table_reason_t reason, void *data)
 {
@@ -460,20 +460,99 @@ rpl_icmp6_update_nbr_table(uip_ipaddr_t *from, nbr_table_reason_t reason, void *
   return nbr;
 }
 /*---------------------------------------------------------------------------*/
+uint8_t
+rpl_icmp6_dao_sequence(void)
+{
+  return dao_sequence;
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_icmp6_set_dao_sequence(uint8_t sequence)
+{
+  dao_sequence = sequence;
+}
+/*---------------------------------------------------------------------------*/
+/* Does the instance match the predicates of a Solicited Information option? */
+static int
+solicited_info_matches(rpl_instance_t *instance, const unsigned char *option)
+{
+  rpl_dag_t *dag = instance->current_dag;
+
+  if((option[3] & RPL_DIS_SOLICITED_I_FLAG) &&
+     instance->instance_id != option[2]) {
+    return 0;
+  }
+  if((option[3] & RPL_DIS_SOLICITED_D_FLAG) &&
+     (dag == NULL || memcmp(&dag->dag_id, &option[4], sizeof(dag->dag_id)))) {
+    return 0;
+  }
+  if((option[3] & RPL_DIS_SOLICITED_V_FLAG) &&
+     (dag == NULL || dag->version != option[20])) {
+    return 0;
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
 static void
 dis_input(void)
 {
   rpl_instance_t *instance;
   rpl_instance_t *end;
+  unsigned char *buffer;
+  unsigned char *solicited;
+  uint8_t buffer_length;
+  uint8_t subopt_type;
+  int i;
+  int len;
+
+  rpl_counters_input(RPL_CODE_DIS);
 
   /* DAG Information Solicitation */
+  RPL_TRACE_EVENT(RPL_TRACE_DIS_INPUT, 0,
+                  RPL_TRACE_ADDR(&UIP_IP_BUF->srcipaddr), 0);
   PRINTF("RPL: Received a DIS from ");
   PRINT6ADDR(&UIP_IP_BUF->srcipaddr);
   PRINTF("\n");
 
+  buffer_length = uip_len - uip_l3_icmp_hdr_len;
+  buffer = UIP_ICMP_PAYLOAD;
+  solicited = NULL;
+
+  /* Options follow the flags and reserved bytes */
+  for(i = 2; i < buffer_length; i += len) {
+    subopt_type = buffer[i];
+    if(subopt_type == RPL_OPTION_PAD1) {
+      len = 1;
+    } else {
+      len = 2 + buffer[i + 1];
+    }
+
+    if(len + i > buffer_length) {
+      PRINTF("RPL: Invalid DIS packet\n");
+      RPL_STAT(rpl_stats.malformed_msgs++);
+      RPL_COUNT(parse_drops);
+      goto discard;
+    }
+
+    if(subopt_type == RPL_OPTION_SOLICITED_INFO) {
+      if(len != 21) {
+        PRINTF("RPL: Invalid solicited information option, len = %d\n", len);
+        RPL_STAT(rpl_stats.malformed_msgs++);
+        RPL_COUNT(parse_drops);
+        goto discard;
+      }
+      solicited = &buffer[i];
+    }
+  }
+
   for(instance = &instance_table[0], end = instance + RPL_MAX_INSTANCES;
       instance < end; ++instance) {
     if(instance->used == 1) {
+      if(solicited != NULL && !solicited_info_matches(instance, solicited)) {
+        PRINTF("RPL: DIS does not solicit instance %u\n", instance->instance_id);
+        RPL_STAT(rpl_stats.dis_filtered++);
+        continue;
+      }
       if(uip_is_addr_mcast(&UIP_IP_BUF->destipaddr)) {
 #if RPL_LEAF_ONLY
         PRINTF("RPL: LEAF ONLY Multicast DIS will NOT reset DIO timer\n");
@@ -498,14 +577,17 @@ dis_input(void)
       }
     }
   }
+
+discard:
   uip_clear_buf();
 }
 /*---------------------------------------------------------------------------*/
-void
-dis_output(uip_ipaddr_t *addr)
+static void
+send_dis(uip_ipaddr_t *addr, uint8_t instance_id, const uip_ipaddr_t *dag_id)
 {
   unsigned char *buffer;
   uip_ipaddr_t tmpaddr;
+  int pos;
 
   /*
    * DAG Information Solicitation  - 2 bytes reserved
@@ -518,6 +600,18 @@ dis_output(uip_ipaddr_t *addr)
 
   buffer = UIP_ICMP_PAYLOAD;
   buffer[0] = buffer[1] = 0;
+  pos = 2;
+
+  if(dag_id != NULL) {
+    /* Solicit the given DAG only */
+    buffer[pos++] = RPL_OPTION_SOLICITED_INFO;
+    buffer[pos++] = 19;
+    buffer[pos++] = instance_id;
+    buffer[pos++] = RPL_DIS_SOLICITED_I_FLAG | RPL_DIS_SOLICITED_D_FLAG;
+    memcpy(&buffer[pos], dag_id, sizeof(*dag_id));
+    pos += sizeof(*dag_id);
+    buffer[pos++] = 0; /* version, not solicited */
+  }
 
   if(addr == NULL) {
     uip_create_linklocal_rplnodes_mcast(&tmpaddr);
@@ -528,7 +622,21 @@ dis_output(uip_ipaddr_t *addr)
   PRINT6ADDR(addr);
   PRINTF("\n");
 
-  uip_icmp6_send(addr, ICMP6_RPL, RPL_CODE_DIS, 2);
+  rpl_icmp6_send(addr, RPL_CODE_DIS, pos);
+}
+/*---------------------------------------------------------------------------*/
+void
+dis_output(uip_ipaddr_t *addr)
+{
+  send_dis(addr, 0, NULL);
+}
+/*---------------------------------------------------------------------------*/
+/* Sends a DIS that only the given instance and DAG answer */
+void
+dis_output_solicited(uip_ipaddr_t *addr, uint8_t instance_id,
+                     const uip_ipaddr_t *dag_id)
+{
+  send_dis(addr, instance_id, dag_id);
 }
 /*---------------------------------------------------------------------------*/
 static void
@@ -541,6 +649,9 @@ dio_input(void)
   int i;
   int len;
   uip_ipaddr_t from;
+  uint8_t has_conf = 0;
+
+  rpl_counters_input(RPL_CODE_DIO);
 
   memset(&dio, 0, sizeof(dio));
 
@@ -583,7 +694,8 @@ dio_input(void)
   dio.preference = buffer[i++] & RPL_DIO_PREFERENCE_MASK;
 
   dio.dtsn = buffer[i++];
-  /* two reserved bytes */
+  dio.detached = (buffer[i] & RPL_DIO_FLAG_DETACHED) != 0;
+  /* flags and reserved bytes */
   i += 2;
 
   memcpy(&dio.dag_id, buffer + i, sizeof(dio.dag_id));
@@ -606,6 +718,7 @@ dio_input(void)
     if(len + i > buffer_length) {
       PRINTF("RPL: Invalid DIO packet\n");
       RPL_STAT(rpl_stats.malformed_msgs++);
+      RPL_COUNT(parse_drops);
       goto discard;
     }
 
@@ -616,6 +729,7 @@ dio_input(void)
         if(len < 6) {
           PRINTF("RPL: Invalid DAG MC, len = %d\n", len);
           RPL_STAT(rpl_stats.malformed_msgs++);
+          RPL_COUNT(parse_drops);
           goto discard;
         }
         dio.mc.type = buffer[i + 2];
@@ -642,6 +756,7 @@ dio_input(void)
           dio.mc.obj.energy.energy_est = buffer[i + 7];
         } else {
           PRINTF("RPL: Unhandled DAG MC type: %u\n", (unsigned)dio.mc.type);
+          RPL_COUNT(parse_drops);
           goto discard;
         }
         break;
@@ -649,6 +764,7 @@ dio_input(void)
         if(len < 9) {
           PRINTF("RPL: Invalid destination prefix option, len = %d\n", len);
           RPL_STAT(rpl_stats.malformed_msgs++);
+          RPL_COUNT(parse_drops);
           goto discard;
         }
 
@@ -665,14 +781,17 @@ dio_input(void)
         } else {
           PRINTF("RPL: Invalid route info option, len = %d\n", len);
           RPL_STAT(rpl_stats.malformed_msgs++);
+          RPL_COUNT(parse_drops);
           goto discard;
         }
 
         break;
       case RPL_OPTION_DAG_CONF:
+        has_conf = 1;
         if(len != 16) {
           PRINTF("RPL: Invalid DAG configuration option, len = %d\n", len);
           RPL_STAT(rpl_stats.malformed_msgs++);
+          RPL_COUNT(parse_drops);
           goto discard;
         }
 
@@ -695,6 +814,7 @@ dio_input(void)
         if(len != 32) {
           PRINTF("RPL: Invalid DAG prefix info, len != 32\n");
           RPL_STAT(rpl_stats.malformed_msgs++);
+          RPL_COUNT(parse_drops);
           goto discard;
         }
         dio.prefix_info.length = buffer[i + 2];
@@ -712,10 +832,26 @@ dio_input(void)
     }
   }
 
+  /* Rather than joining a new instance with the default configuration,
+     ask the first sender of a DIO without one for a unicast DIO, which
+     always carries it. A sender that still leaves it out is taken with
+     the defaults. */
+  if(!has_conf && rpl_get_instance(dio.instance_id) == NULL &&
+     (!conf_solicited ||
+      clock_time() - conf_solicited_time > RPL_DIS_INTERVAL * CLOCK_SECOND)) {
+    PRINTF("RPL: DIO without DAG configuration, soliciting one\n");
+    conf_solicited = 1;
+    conf_solicited_time = clock_time();
+    dis_output_solicited(&from, dio.instance_id, &dio.dag_id);
+    goto discard;
+  }
+
 #ifdef RPL_DEBUG_DIO_INPUT
   RPL_DEBUG_DIO_INPUT(&from, &dio);
 #endif
 
+  RPL_TRACE_EVENT(RPL_TRACE_DIO_INPUT, dio.rank, RPL_TRACE_ADDR(&from),
+                  dio.version << 8 | dio.instance_id);
   rpl_process_dio(&from, &dio);
 
 discard:
@@ -777,7 +913,13 @@ dio_output(rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
   }
 
   /* reserved 2 bytes */
-  buffer[pos++] = 0; /* flags */
+  buffer[pos] = 0; /* flags */
+#if RPL_LOCAL_REPAIR_BOUNDED
+  if(instance->detached && dag == instance->current_dag) {
+    buffer[pos] |= RPL_DIO_FLAG_DETACHED;
+  }
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
+  pos++;
   buffer[pos++] = 0; /* reserved */
 
   memcpy(buffer + pos, &dag->dag_id, sizeof(dag->dag_id));
@@ -850,6 +992,9 @@ dio_output(rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
            dag->prefix_info.length);
   }
 
+  RPL_TRACE_EVENT(RPL_TRACE_DIO_OUTPUT, dag->rank, RPL_TRACE_ADDR(uc_addr),
+                  dag->version << 8 | instance->instance_id);
+
 #if RPL_LEAF_ONLY
 #if (DEBUG) & DEBUG_PRINT
   if(uc_addr == NULL) {
@@ -860,21 +1005,21 @@ dio_output(rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
          (unsigned)dag->rank);
   PRINT6ADDR(uc_addr);
   PRINTF("\n");
-  uip_icmp6_send(uc_addr, ICMP6_RPL, RPL_CODE_DIO, pos);
+  rpl_icmp6_send(uc_addr, RPL_CODE_DIO, pos);
 #else /* RPL_LEAF_ONLY */
   /* Unicast requests get unicast replies! */
   if(uc_addr == NULL) {
     PRINTF("RPL: Sending a multicast-DIO with rank %u\n",
            (unsigned)instance->current_dag->rank);
     uip_create_linklocal_rplnodes_mcast(&addr);
-    uip_icmp6_send(&addr, ICMP6_RPL, RPL_CODE_DIO, pos);
+    rpl_icmp6_send(&addr, RPL_CODE_DIO, pos);
     RPL_STAT(rpl_stats.dio_sent_m++);
   } else {
     PRINTF("RPL: Sending unicast-DIO with rank %u to ",
            (unsigned)instance->current_dag->rank);
     PRINT6ADDR(uc_addr);
     PRINTF("\n");
-    uip_icmp6_send(uc_addr, ICMP6_RPL, RPL_CODE_DIO, pos);
+    rpl_icmp6_send(uc_addr, RPL_CODE_DIO, pos);
 	RPL_STAT(rpl_stats.dio_sent_u++);
   }
 #endif /* RPL_LEAF_ONLY */
@@ -968,7 +1113,7 @@ dao_input_storing(void)
       PRINTF("RPL: Loop detected when receiving a unicast DAO from a node with a lower rank! (%u < %u)\n",
              DAG_RANK(parent->rank, instance), DAG_RANK(dag->rank, instance));
       parent->rank = INFINITE_RANK;
-      parent->flags |= RPL_PARENT_FLAG_UPDATED;
+      rpl_queue_parent_update(parent);
       return;
     }
 
@@ -976,7 +1121,7 @@ dao_input_storing(void)
     if(parent != NULL && parent == dag->preferred_parent) {
       PRINTF("RPL: Loop detected when receiving a unicast DAO from our parent\n");
       parent->rank = INFINITE_RANK;
-      parent->flags |= RPL_PARENT_FLAG_UPDATED;
+      rpl_queue_parent_update(parent);
       return;
     }
   }
@@ -1014,6 +1159,8 @@ dao_input_storing(void)
          (unsigned)lifetime, (unsigned)prefixlen);
   PRINT6ADDR(&prefix);
   PRINTF("\n");
+  RPL_TRACE_EVENT(RPL_TRACE_DAO_INPUT, lifetime,
+                  RPL_TRACE_ADDR(&dao_sender_addr), RPL_TRACE_ADDR(&prefix));
 
 #if RPL_WITH_MULTICAST
   if(uip_is_addr_mcast_global(&prefix)) {
@@ -1025,7 +1172,7 @@ dao_input_storing(void)
     mcast_group = uip_mcast6_route_add(&prefix);
     if(mcast_group) {
       mcast_group->dag = dag;
-      mcast_group->lifetime = RPL_LIFETIME(instance, lifetime);
+      rpl_set_mcast_route_lifetime(mcast_group, RPL_LIFETIME(instance, lifetime));
     }
     goto fwd_dao;
   }
@@ -1047,7 +1194,7 @@ dao_input_storing(void)
       PRINT6ADDR(&prefix);
       PRINTF("\n");
       RPL_ROUTE_SET_NOPATH_RECEIVED(rep);
-      rep->state.lifetime = RPL_NOPATH_REMOVAL_DELAY;
+      rpl_set_route_lifetime(rep, RPL_NOPATH_REMOVAL_DELAY);
 
       /* We forward the incoming No-Path DAO to our parent, if we have
          one. */
@@ -1063,8 +1210,8 @@ dao_input_storing(void)
 
         buffer = UIP_ICMP_PAYLOAD;
         buffer[3] = out_seq; /* add an outgoing seq no before fwd */
-        uip_icmp6_send(rpl_get_parent_ipaddr(dag->preferred_parent),
-                       ICMP6_RPL, RPL_CODE_DAO, buffer_length);
+        rpl_icmp6_send(rpl_get_parent_ipaddr(dag->preferred_parent),
+                       RPL_CODE_DAO, buffer_length);
 		RPL_STAT(rpl_stats.npdao_forwarded++);
       }
     }
@@ -1121,13 +1268,14 @@ dao_input_storing(void)
 
 	
   /* set lifetime and clear NOPATH bit */
-  rep->state.lifetime = RPL_LIFETIME(instance, lifetime);
+  rpl_set_route_lifetime(rep, RPL_LIFETIME(instance, lifetime));
 #if RPL_WITH_DCO	
         PRINTF("Updating Path Sequence -%u\n",pathSequence);
 	rep->state.dao_path_sequence = pathSequence;
 #endif
   RPL_ROUTE_CLEAR_NOPATH_RECEIVED(rep);
-  PRINTF("Route Life Time in Seconds-%u\n",rep->state.lifetime);
+  PRINTF("Route Life Time in Seconds-%u\n",
+         (unsigned)rpl_lifetime_remaining(rep->state.lifetime));
 
 #if RPL_WITH_MULTICAST
 fwd_dao:
@@ -1172,8 +1320,8 @@ fwd_dao:
 
       buffer = UIP_ICMP_PAYLOAD;
       buffer[3] = out_seq; /* add an outgoing seq no before fwd */
-      uip_icmp6_send(rpl_get_parent_ipaddr(dag->preferred_parent),
-                     ICMP6_RPL, RPL_CODE_DAO, buffer_length);
+      rpl_icmp6_send(rpl_get_parent_ipaddr(dag->preferred_parent),
+                     RPL_CODE_DAO, buffer_length);
 	  RPL_STAT(rpl_stats.dao_forwarded++);
     }
     if(should_ack) {
@@ -1279,6 +1427,8 @@ dao_input_nonstoring(void)
   PRINTF(", parent: ");
   PRINT6ADDR(&dao_parent_addr);
   PRINTF(" \n");
+  RPL_TRACE_EVENT(RPL_TRACE_DAO_INPUT, lifetime,
+                  RPL_TRACE_ADDR(&dao_sender_addr), RPL_TRACE_ADDR(&prefix));
 
   if(lifetime == RPL_ZERO_LIFETIME) {
     PRINTF("RPL: No-Path DAO received\n");
@@ -1305,6 +1455,8 @@ dao_input(void)
   rpl_instance_t *instance;
   uint8_t instance_id;
 
+  rpl_counters_input(RPL_CODE_DAO);
+
   /* Destination Advertisement Object */
   PRINTF("RPL: Received a DAO from ");
   PRINT6ADDR(&UIP_IP_BUF->srcipaddr);
@@ -1361,6 +1513,7 @@ handle_dao_retransmission(void *ptr)
     }
 
     /* Perform local repair and hope to find another parent. */
+    RPL_COUNT(repairs[RPL_REPAIR_DAO_TIMEOUT]);
     rpl_local_repair(instance);
     return;
   }
@@ -1547,7 +1700,9 @@ dao_output_target_seq(rpl_parent_t *parent, uip_ipaddr_t *prefix,
   PRINTF("\n");
 
   if(dest_ipaddr != NULL) {
-    uip_icmp6_send(dest_ipaddr, ICMP6_RPL, RPL_CODE_DAO, pos);
+    RPL_TRACE_EVENT(RPL_TRACE_DAO_OUTPUT, lifetime,
+                    RPL_TRACE_ADDR(parent_ipaddr), RPL_TRACE_ADDR(prefix));
+    rpl_icmp6_send(dest_ipaddr, RPL_CODE_DAO, pos);
 	if (lifetime == 0){
 		RPL_STAT(rpl_stats.npdao_sent++);
 	}
@@ -1570,6 +1725,8 @@ dao_ack_input(void)
   rpl_instance_t *instance;
   rpl_parent_t *parent;
 
+  rpl_counters_input(RPL_CODE_DAO_ACK);
+
   buffer = UIP_ICMP_PAYLOAD;
 
   instance_id = buffer[0];
@@ -1616,6 +1773,7 @@ dao_ack_input(void)
        * Failed the DAO transmission - need to remove the default route.
        * Trigger a local repair since we can not get our DAO in.
        */
+      RPL_COUNT(repairs[RPL_REPAIR_DAO_NACK]);
       rpl_local_repair(instance);
     }
 #endif
@@ -1637,7 +1795,7 @@ dao_ack_input(void)
         PRINT6ADDR(nexthop);
         PRINTF("\n");
         buffer[2] = re->state.dao_seqno_in;
-        uip_icmp6_send(nexthop, ICMP6_RPL, RPL_CODE_DAO_ACK, 4);
+        rpl_icmp6_send(nexthop, RPL_CODE_DAO_ACK, 4);
       }
 
       if(status >= RPL_DAO_ACK_UNABLE_TO_ACCEPT) {
@@ -1670,70 +1828,283 @@ dao_ack_output(rpl_instance_t *instance, uip_ipaddr_t *dest, uint8_t sequence,
   buffer[2] = sequence;
   buffer[3] = status;
 
-  uip_icmp6_send(dest, ICMP6_RPL, RPL_CODE_DAO_ACK, 4);
+  rpl_icmp6_send(dest, RPL_CODE_DAO_ACK, 4);
 #endif /* RPL_WITH_DAO_ACK */
 }
 
-static void dco_input(void)
+#if RPL_WITH_DCO && RPL_WITH_STORING
+/*
+ * Outgoing DCOs. Targets towards the same next hop are first collected for
+ * RPL_DCO_BATCH_DELAY so that a subtree move produces one multi-target DCO
+ * instead of one DCO per moved node. Once sent, the entry stays in the
+ * list until the DCO-ACK arrives or the retransmissions are exhausted.
+ */
+struct dco_target {
+  uip_ipaddr_t addr;
+  uint8_t path_sequence;
+};
+
+struct dco_pending {
+  struct dco_pending *next;
+  rpl_instance_t *instance;
+  uip_ipaddr_t dest;
+  struct ctimer timer;
+  clock_time_t sent_time;
+  clock_time_t timeout;
+  uint8_t sequence;
+  uint8_t transmissions;
+  uint8_t num_targets;
+  struct dco_target targets[RPL_DCO_MAX_TARGETS];
+};
+
+MEMB(dco_memb, struct dco_pending, RPL_DCO_MAX_PENDING);
+LIST(dco_list);
+
+#if RPL_WITH_DCO_ACK
+/* Smoothed DCO-ACK round trip time (scaled by 8) and its mean deviation
+   (scaled by 4), both in clock ticks. Zero until the first sample. */
+static long dco_srtt;
+static long dco_rttvar;
+#endif /* RPL_WITH_DCO_ACK */
+/*---------------------------------------------------------------------------*/
+#if RPL_WITH_DCO_ACK
+static clock_time_t
+dco_initial_timeout(void)
+{
+  long rto;
+
+  if(dco_srtt == 0) {
+    return RPL_DCO_RETRANSMISSION_TIMEOUT;
+  }
+  rto = (dco_srtt >> 3) + dco_rttvar;
+  if(rto < RPL_DCO_MIN_RETRANSMISSION_TIMEOUT) {
+    rto = RPL_DCO_MIN_RETRANSMISSION_TIMEOUT;
+  } else if(rto > RPL_DCO_MAX_RETRANSMISSION_TIMEOUT) {
+    rto = RPL_DCO_MAX_RETRANSMISSION_TIMEOUT;
+  }
+  return (clock_time_t)rto;
+}
+/*---------------------------------------------------------------------------*/
+static void
+dco_rtt_sample(clock_time_t rtt)
+{
+  long delta;
+
+  if(dco_srtt == 0) {
+    dco_srtt = (long)rtt << 3;
+    dco_rttvar = (long)rtt << 1;
+    return;
+  }
+  delta = (long)rtt - (dco_srtt >> 3);
+  dco_srtt += delta;
+  if(delta < 0) {
+    delta = -delta;
+  }
+  dco_rttvar += delta - (dco_rttvar >> 2);
+}
+#endif /* RPL_WITH_DCO_ACK */
+/*---------------------------------------------------------------------------*/
+/* Returns 0 if the instance has no DAG to send the DCO in any more */
+static int
+dco_send(struct dco_pending *p)
+{
+  rpl_instance_t *instance;
+  uint8_t *buffer;
+  uint8_t prefixlen;
+  int pos;
+  int i;
+
+  instance = p->instance;
+  if(instance->current_dag == NULL) {
+    PRINTF("RPL: Dropping DCO with sequence number %u, no DAG\n",
+           p->sequence);
+    return 0;
+  }
+  buffer = UIP_ICMP_PAYLOAD;
+  pos = 0;
+
+  buffer[pos++] = instance->instance_id;
+  buffer[pos] = 0;
+#if RPL_DAO_SPECIFY_DAG
+  buffer[pos] |= RPL_DAO_D_FLAG;
+#endif /* RPL_DAO_SPECIFY_DAG */
+#if RPL_WITH_DCO_ACK
+  buffer[pos] |= RPL_DAO_K_FLAG;
+#endif /* RPL_WITH_DCO_ACK */
+  ++pos;
+  buffer[pos++] = 0; /* reserved */
+  buffer[pos++] = p->sequence;
+#if RPL_DAO_SPECIFY_DAG
+  memcpy(buffer + pos, &instance->current_dag->dag_id,
+         sizeof(instance->current_dag->dag_id));
+  pos += sizeof(instance->current_dag->dag_id);
+#endif /* RPL_DAO_SPECIFY_DAG */
+
+  /* One target option per target, each followed by its own transit
+     information option carrying the target's path sequence. */
+  prefixlen = sizeof(uip_ipaddr_t) * CHAR_BIT;
+  for(i = 0; i < p->num_targets; i++) {
+    buffer[pos++] = RPL_OPTION_TARGET;
+    buffer[pos++] = 2 + ((prefixlen + 7) / CHAR_BIT);
+    buffer[pos++] = 0; /* reserved */
+    buffer[pos++] = prefixlen;
+    memcpy(buffer + pos, &p->targets[i].addr, (prefixlen + 7) / CHAR_BIT);
+    pos += ((prefixlen + 7) / CHAR_BIT);
+
+    buffer[pos++] = RPL_OPTION_TRANSIT;
+    buffer[pos++] = 4;
+    buffer[pos++] = 0; /* flags - ignored */
+    buffer[pos++] = 0; /* path control - ignored */
+    buffer[pos++] = p->targets[i].path_sequence;
+    buffer[pos++] = RPL_ZERO_LIFETIME;
+  }
+
+  PRINTF("RPL: Sending a DCO with sequence number %u, %u target(s), transmission %u to ",
+         p->sequence, p->num_targets, p->transmissions);
+  PRINT6ADDR(&p->dest);
+  PRINTF("\n");
+
+  rpl_icmp6_send(&p->dest, RPL_CODE_DCO, pos);
+  p->sent_time = clock_time();
+  RPL_STAT(rpl_stats.dco_sent++);
+  RPL_STAT(rpl_stats.dco_targets_sent += p->num_targets);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+dco_free(struct dco_pending *p)
+{
+  ctimer_stop(&p->timer);
+  list_remove(dco_list, p);
+  memb_free(&dco_memb, p);
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_dco_timer(void *ptr)
+{
+  struct dco_pending *p;
+
+  p = ptr;
+
+  if(p->transmissions == 0) {
+    /* The batching delay expired: assign a sequence number and send. */
+    p->sequence = dco_sequence;
+    RPL_LOLLIPOP_INCREMENT(dco_sequence);
+    p->transmissions = 1;
+    if(!dco_send(p)) {
+      dco_free(p);
+      return;
+    }
+#if RPL_WITH_DCO_ACK
+    p->timeout = dco_initial_timeout();
+    ctimer_set(&p->timer, p->timeout, handle_dco_timer, p);
+#else
+    dco_free(p);
+#endif /* RPL_WITH_DCO_ACK */
+    return;
+  }
+
+#if RPL_WITH_DCO_ACK
+  if(p->transmissions > RPL_DCO_MAX_RETRANSMISSIONS) {
+    PRINTF("RPL: Giving up on DCO with sequence number %u to ", p->sequence);
+    PRINT6ADDR(&p->dest);
+    PRINTF("\n");
+    RPL_STAT(rpl_stats.dco_failures++);
+    dco_free(p);
+    return;
+  }
+
+  /* Exponential backoff on top of the adaptive initial timeout. */
+  p->timeout <<= 1;
+  if(p->timeout > RPL_DCO_MAX_RETRANSMISSION_TIMEOUT) {
+    p->timeout = RPL_DCO_MAX_RETRANSMISSION_TIMEOUT;
+  }
+  p->transmissions++;
+  RPL_STAT(rpl_stats.dco_retransmits++);
+  if(!dco_send(p)) {
+    dco_free(p);
+    return;
+  }
+  ctimer_set(&p->timer, p->timeout, handle_dco_timer, p);
+#endif /* RPL_WITH_DCO_ACK */
+}
+#endif /* RPL_WITH_DCO && RPL_WITH_STORING */
+/*---------------------------------------------------------------------------*/
+static void
+dco_input(void)
 {
 #if RPL_WITH_DCO && RPL_WITH_STORING
-  uip_ipaddr_t dao_sender;
-  uip_ipaddr_t prefix;
-  uip_ipaddr_t *pstNextHop;
+  uip_ipaddr_t dco_sender;
+  uip_ipaddr_t my_addr;
+  uip_ipaddr_t *nexthop;
   rpl_instance_t *instance;
-  uip_ds6_route_t *pstRoute;
-  rpl_dag_t *curdag;
-  uint8_t instance_id;
+  uip_ds6_route_t *rep;
+  rpl_dag_t *dag;
+  struct dco_target targets[RPL_DCO_MAX_TARGETS];
+  uint8_t target_lifetime[RPL_DCO_MAX_TARGETS];
   unsigned char *buffer;
-  uint16_t dco_sequence;
+  uint8_t instance_id;
+  uint8_t sequence;
   uint8_t prefixlen;
   uint8_t flags;
   uint8_t subopt_type;
+  uint8_t num_targets;
+  uint8_t first_pending;
+  uint8_t handled;
   uint16_t buffer_length;
   uint16_t pos;
   uint16_t i;
   uint16_t len;
-  uint8_t pathLifetime;
-  uint8_t pathSequence;
+  int have_addr;
+
+  rpl_counters_input(RPL_CODE_DCO);
 
   buffer = UIP_ICMP_PAYLOAD;
   buffer_length = uip_len - uip_l3_icmp_hdr_len;
 
-  uip_ipaddr_copy(&dao_sender, &UIP_IP_BUF->srcipaddr);
-	
-	/* Destination Advertisement Object */
+  uip_ipaddr_copy(&dco_sender, &UIP_IP_BUF->srcipaddr);
+
   PRINTF("RPL: Received a DCO from ");
-  PRINT6ADDR(&dao_sender);
+  PRINT6ADDR(&dco_sender);
   PRINTF("\n");
   RPL_STAT(rpl_stats.dco_recvd++);
 
-	pos = 0;
-	instance_id = buffer[pos++];
-  
+  pos = 0;
+  instance_id = buffer[pos++];
+
   instance = rpl_get_instance(instance_id);
   if(instance == NULL) {
     PRINTF("RPL: Ignoring a DCO for an unknown RPL instance(%u)\n",
            instance_id);
     goto discard;
   }
-	
-	flags = buffer[pos++];
-	/* reserved */
-	pos++;
-	dco_sequence = buffer[pos++];
-	
-	curdag = instance->current_dag;		
-	
-	/* Is the DAG ID present? */
-	if(flags & RPL_DAO_D_FLAG) {
-		if(memcmp(&curdag->dag_id, &buffer[pos], sizeof(curdag->dag_id))) {
-			PRINTF("RPL: Ignoring a DAO for a DAG different from ours\n");
-			return;
-		}
-		pos += 16;
-	}
 
- /* Check if there are any RPL options present. */
+  flags = buffer[pos++];
+  /* reserved */
+  pos++;
+  sequence = buffer[pos++];
+
+  dag = instance->current_dag;
+  if(dag == NULL) {
+    PRINTF("RPL: Ignoring a DCO without a DAG\n");
+    goto discard;
+  }
+
+  /* Is the DAG ID present? */
+  if(flags & RPL_DAO_D_FLAG) {
+    if(memcmp(&dag->dag_id, &buffer[pos], sizeof(dag->dag_id))) {
+      PRINTF("RPL: Ignoring a DCO for a DAG different from ours\n");
+      goto discard;
+    }
+    pos += 16;
+  }
+
+  /*
+   * Collect the targets. A transit information option applies to all
+   * target options preceding it that have not been assigned one yet.
+   */
+  num_targets = 0;
+  first_pending = 0;
   for(i = pos; i < buffer_length; i += len) {
     subopt_type = buffer[i];
     if(subopt_type == RPL_OPTION_PAD1) {
@@ -1743,167 +2114,239 @@ static void dco_input(void)
       len = 2 + buffer[i + 1];
     }
 
+    if(len + i > buffer_length) {
+      PRINTF("RPL: Invalid DCO packet\n");
+      RPL_STAT(rpl_stats.malformed_msgs++);
+      RPL_COUNT(parse_drops);
+      goto discard;
+    }
+
     switch(subopt_type) {
     case RPL_OPTION_TARGET:
-      /* Handle the target option. */
-      prefixlen = buffer[i + 3];
-      memset(&prefix, 0, sizeof(prefix));
-      memcpy(&prefix, buffer + i + 4, (prefixlen + 7) / CHAR_BIT);
+      prefixlen = len >= 4 ? buffer[i + 3] : 0;
+      if(len < 4 || prefixlen > sizeof(uip_ipaddr_t) * CHAR_BIT ||
+         4 + (prefixlen + 7) / CHAR_BIT > len) {
+        PRINTF("RPL: Invalid DCO target option, len = %u, prefix %u\n",
+               len, prefixlen);
+        RPL_STAT(rpl_stats.malformed_msgs++);
+        RPL_COUNT(parse_drops);
+        goto discard;
+      }
+      if(num_targets == RPL_DCO_MAX_TARGETS) {
+        PRINTF("RPL: Too many targets in DCO, ignoring the rest\n");
+        break;
+      }
+      memset(&targets[num_targets].addr, 0, sizeof(uip_ipaddr_t));
+      memcpy(&targets[num_targets].addr, buffer + i + 4, (prefixlen + 7) / CHAR_BIT);
+      targets[num_targets].path_sequence = 0;
+      target_lifetime[num_targets] = RPL_ZERO_LIFETIME;
+      num_targets++;
       break;
     case RPL_OPTION_TRANSIT:
-      /* The path control is ignored. */
-      /*      pathcontrol = buffer[i + 3];*/
-      pathSequence = buffer[i + 4];
-      pathLifetime = buffer[i + 5];
-      /* The parent address is also ignored. */
+      if(len < 6) {
+        PRINTF("RPL: Invalid DCO transit option, len = %u\n", len);
+        RPL_STAT(rpl_stats.malformed_msgs++);
+        RPL_COUNT(parse_drops);
+        goto discard;
+      }
+      /* The path control and the parent address are ignored. */
+      for(; first_pending < num_targets; first_pending++) {
+        targets[first_pending].path_sequence = buffer[i + 4];
+        target_lifetime[first_pending] = buffer[i + 5];
+      }
       break;
     }
   }
 
-	pstRoute = uip_ds6_route_lookup(&prefix);
-	if (pstRoute && !pathLifetime){
-		pstNextHop = uip_ds6_route_nexthop(pstRoute);
-
-		/* If We have the latest path sequence then no need to forward the DCO */
-                PRINTF("Handling DCO Received path seq-%u stored %u\n",
-                      pathSequence, pstRoute->state.dao_path_sequence);
-		if (pstNextHop && lollipop_greater_than(pathSequence , pstRoute->state.dao_path_sequence)){
-                     PRINTF("Forwarding the DCO to");
-                     PRINT6ADDR(pstNextHop);
-                     PRINTF("\n");
-		     uip_icmp6_send(pstNextHop,
-                     ICMP6_RPL, RPL_CODE_DCO, buffer_length);
-                     /* Remove the rute entry*/
-			 RPL_STAT(rpl_stats.dco_forwarded++);
-		     uip_ds6_route_rm(pstRoute);
-		}
-		else{
-			RPL_STAT(rpl_stats.dco_ignored++);
-		}
+  have_addr = get_global_addr(&my_addr);
+  handled = 0;
 
-		/* If DCO-ACK is requested then send the ACK */
-                if(flags & RPL_DAO_K_FLAG) {
-                  uip_clear_buf();
-		  dco_ack_output(instance,&dao_sender,dco_sequence, 0);
-                }
-		
-	}
-	else
-	{
-           uip_ipaddr_t stMyAddress;
-           /* If its My address no need to send the -ve ACK */
-           if (get_global_addr(&stMyAddress) && 
-                uip_ipaddr_cmp(&stMyAddress, &prefix)){
-              PRINTF("Received DCO of my OWN address\n");
-			  RPL_STAT(rpl_stats.dco_ignored++);
-              goto discard;
-           }
-           PRINTF("No Route entry found for the DCO target\n");
-		/* If DCO-ACK is requested then send -ve ACK  this si required to stop DCO retransmission*/
-                if(flags & RPL_DAO_K_FLAG) {
-                  uip_clear_buf();
-		  dco_ack_output(instance,&dao_sender,dco_sequence, 234);
-                }
-	}
+  for(i = 0; i < num_targets; i++) {
+    if(have_addr && uip_ipaddr_cmp(&my_addr, &targets[i].addr)) {
+      PRINTF("RPL: Received DCO for my own address\n");
+      RPL_STAT(rpl_stats.dco_ignored++);
+      handled++;
+      continue;
+    }
 
-#endif
+    rep = uip_ds6_route_lookup(&targets[i].addr);
+    if(rep == NULL) {
+      PRINTF("RPL: No route entry found for DCO target ");
+      PRINT6ADDR(&targets[i].addr);
+      PRINTF("\n");
+      continue;
+    }
+    handled++;
+
+    if(target_lifetime[i] != RPL_ZERO_LIFETIME) {
+      continue;
+    }
+
+    nexthop = uip_ds6_route_nexthop(rep);
+    PRINTF("RPL: Handling DCO target, received path seq %u stored %u\n",
+           targets[i].path_sequence, rep->state.dao_path_sequence);
+
+    /* If we have a newer path sequence than the DCO, our route is the
+       current one and the DCO must not go further. */
+    if(nexthop != NULL &&
+       lollipop_greater_than(targets[i].path_sequence,
+                             rep->state.dao_path_sequence)) {
+      PRINTF("RPL: Forwarding DCO target to ");
+      PRINT6ADDR(nexthop);
+      PRINTF("\n");
+      dco_output(instance, &targets[i].addr, nexthop, targets[i].path_sequence);
+      RPL_STAT(rpl_stats.dco_forwarded++);
+      uip_ds6_route_rm(rep);
+    } else {
+      RPL_STAT(rpl_stats.dco_ignored++);
+    }
+  }
 
+  /* A negative ACK also stops the retransmissions at the sender. */
+  if(flags & RPL_DAO_K_FLAG) {
+    uip_clear_buf();
+    dco_ack_output(instance, &dco_sender, sequence,
+                   handled ? RPL_DCO_ACK_UNCONDITIONAL_ACCEPT :
+                   RPL_DCO_ACK_NO_ROUTE);
+  }
+#endif /* RPL_WITH_DCO && RPL_WITH_STORING */
+
+#if RPL_WITH_DCO && RPL_WITH_STORING
  discard:
-  uip_clear_buf();	
+#endif
+  uip_clear_buf();
 }
-
-void dco_output
-(
-    rpl_instance_t *instance,
-	uip_ipaddr_t *pstTargetIP,
-	uip_ipaddr_t *pstDcoTarget,
-	uint8_t pathSequence
-)
+/*---------------------------------------------------------------------------*/
+void
+dco_output(rpl_instance_t *instance, uip_ipaddr_t *target, uip_ipaddr_t *dest,
+           uint8_t path_sequence)
 {
-
 #if RPL_WITH_DCO && RPL_WITH_STORING
-	uint8_t *buffer;
-	int pos;
-	uint8_t prefixlen;
-	
-	buffer = UIP_ICMP_PAYLOAD;
-	pos = 0;
-	
-	buffer[pos++] = instance->instance_id;
-	buffer[pos] = 0;
-#if RPL_DAO_SPECIFY_DAG
-	buffer[pos] |= RPL_DAO_D_FLAG;
-#endif /* RPL_DAO_SPECIFY_DAG */
+  struct dco_pending *p;
+  int i;
 
-#if RPL_WITH_DCO_ACK
-	buffer[pos] |= RPL_DAO_K_FLAG;
-#endif /* RPL_WITH_DAO_ACK */
+  /* Add the target to a DCO that is still collecting targets for dest. */
+  for(p = list_head(dco_list); p != NULL; p = list_item_next(p)) {
+    if(p->transmissions == 0 && p->instance == instance &&
+       uip_ipaddr_cmp(&p->dest, dest)) {
+      for(i = 0; i < p->num_targets; i++) {
+        if(uip_ipaddr_cmp(&p->targets[i].addr, target)) {
+          p->targets[i].path_sequence = path_sequence;
+          return;
+        }
+      }
+      if(p->num_targets < RPL_DCO_MAX_TARGETS) {
+        uip_ipaddr_copy(&p->targets[p->num_targets].addr, target);
+        p->targets[p->num_targets].path_sequence = path_sequence;
+        p->num_targets++;
+        return;
+      }
+    }
+  }
 
-		++pos;
-		buffer[pos++] = 0; /* reserved */
-		buffer[pos++] = dco_sequence;
-		RPL_LOLLIPOP_INCREMENT(dco_sequence);
-		
-#if RPL_DAO_SPECIFY_DAG
-		memcpy(buffer + pos, &instance->current_dag->dag_id, sizeof(instance->current_dag->dag_id));
-		pos+=sizeof(instance->current_dag->dag_id);
-#endif /* RPL_DAO_SPECIFY_DAG */
-	
-		/* create target subopt */
-		prefixlen = sizeof(*pstTargetIP) * CHAR_BIT;
-		buffer[pos++] = RPL_OPTION_TARGET;
-		buffer[pos++] = 2 + ((prefixlen + 7) / CHAR_BIT);
-		buffer[pos++] = 0; /* reserved */
-		buffer[pos++] = prefixlen;
-		memcpy(buffer + pos, pstTargetIP, (prefixlen + 7) / CHAR_BIT);
-		pos += ((prefixlen + 7) / CHAR_BIT);
-	
-		/* Create a transit information sub-option. */
-		buffer[pos++] = RPL_OPTION_TRANSIT;
-		buffer[pos++] = 4;
-		buffer[pos++] = 0; /* flags - ignored */
-		buffer[pos++] = 0; /* path control - ignored */		
-		buffer[pos++] = pathSequence; /* path seq - ignored */
-		buffer[pos++] = 0;
-
-		uip_icmp6_send(pstDcoTarget, ICMP6_RPL, RPL_CODE_DCO, pos);
-		RPL_STAT(rpl_stats.dco_sent++);
-#endif
-}
+  p = memb_alloc(&dco_memb);
+  if(p == NULL) {
+    PRINTF("RPL: No room for a DCO to ");
+    PRINT6ADDR(dest);
+    PRINTF("\n");
+    RPL_STAT(rpl_stats.mem_overflows++);
+    return;
+  }
+
+  p->instance = instance;
+  uip_ipaddr_copy(&p->dest, dest);
+  p->transmissions = 0;
+  p->num_targets = 1;
+  uip_ipaddr_copy(&p->targets[0].addr, target);
+  p->targets[0].path_sequence = path_sequence;
+  list_add(dco_list, p);
 
-static void dco_ack_input(void)
+  ctimer_set(&p->timer, RPL_DCO_BATCH_DELAY, handle_dco_timer, p);
+#endif /* RPL_WITH_DCO && RPL_WITH_STORING */
+}
+/*---------------------------------------------------------------------------*/
+/* Drops the pending DCOs of an instance that leaves its DAG */
+void
+rpl_icmp6_dco_flush(rpl_instance_t *instance)
 {
 #if RPL_WITH_DCO && RPL_WITH_STORING
-#endif
+  struct dco_pending *p;
+  struct dco_pending *next;
+
+  for(p = list_head(dco_list); p != NULL; p = next) {
+    next = list_item_next(p);
+    if(p->instance == instance) {
+      dco_free(p);
+    }
+  }
+#endif /* RPL_WITH_DCO && RPL_WITH_STORING */
 }
+/*---------------------------------------------------------------------------*/
+static void
+dco_ack_input(void)
+{
+#if RPL_WITH_DCO && RPL_WITH_STORING && RPL_WITH_DCO_ACK
+  struct dco_pending *p;
+  uint8_t *buffer;
+  uint8_t instance_id;
+  uint8_t sequence;
+  uint8_t status;
 
-/* We can Modify dao_ack_output with message type if we don't want a separate function */
-void dco_ack_output
-(
-	rpl_instance_t *instance, 
-	uip_ipaddr_t *dest, 
-	uint8_t sequence,
-	uint8_t status
-)
+  rpl_counters_input(RPL_CODE_DCO_ACK);
+
+  buffer = UIP_ICMP_PAYLOAD;
+
+  instance_id = buffer[0];
+  sequence = buffer[2];
+  status = buffer[3];
+
+  PRINTF("RPL: Received a DCO %s with sequence number %u and status %u from ",
+         status < 128 ? "ACK" : "NACK", sequence, status);
+  PRINT6ADDR(&UIP_IP_BUF->srcipaddr);
+  PRINTF("\n");
+
+  for(p = list_head(dco_list); p != NULL; p = list_item_next(p)) {
+    if(p->transmissions > 0 && p->sequence == sequence &&
+       p->instance->instance_id == instance_id &&
+       uip_ipaddr_cmp(&p->dest, &UIP_IP_BUF->srcipaddr)) {
+      /* Only unambiguous samples feed the timeout estimate. */
+      if(p->transmissions == 1) {
+        dco_rtt_sample(clock_time() - p->sent_time);
+      }
+      if(status < 128) {
+        RPL_STAT(rpl_stats.dco_acked++);
+      } else {
+        RPL_STAT(rpl_stats.dco_nacked++);
+      }
+      dco_free(p);
+      break;
+    }
+  }
+#endif /* RPL_WITH_DCO && RPL_WITH_STORING && RPL_WITH_DCO_ACK */
+  uip_clear_buf();
+}
+/*---------------------------------------------------------------------------*/
+void
+dco_ack_output(rpl_instance_t *instance, uip_ipaddr_t *dest, uint8_t sequence,
+               uint8_t status)
 {
 #if RPL_WITH_DCO && RPL_WITH_STORING
-	unsigned char *buffer;
-	
-	PRINTF("RPL: Sending a DCO %s with sequence number %d to ", status < 128 ? "ACK" : "NACK", sequence);
-	PRINT6ADDR(dest);
-	PRINTF(" with status %d\n", status);
-	
-	buffer = UIP_ICMP_PAYLOAD;
-	
-	buffer[0] = instance->instance_id;
-	buffer[1] = 0;
-	buffer[2] = sequence;
-	buffer[3] = status;
-	
-	uip_icmp6_send(dest, ICMP6_RPL, RPL_CODE_DCO_ACK, 4);
-#endif	
-}
+  unsigned char *buffer;
 
+  PRINTF("RPL: Sending a DCO %s with sequence number %d to ", status < 128 ? "ACK" : "NACK", sequence);
+  PRINT6ADDR(dest);
+  PRINTF(" with status %d\n", status);
+
+  buffer = UIP_ICMP_PAYLOAD;
+
+  buffer[0] = instance->instance_id;
+  buffer[1] = 0;
+  buffer[2] = sequence;
+  buffer[3] = status;
+
+  rpl_icmp6_send(dest, RPL_CODE_DCO_ACK, 4);
+#endif /* RPL_WITH_DCO && RPL_WITH_STORING */
+}
 /*---------------------------------------------------------------------------*/
 void
 rpl_icmp6_register_handlers()
@@ -48,6 +48,7 @@
 #include "net/nbr-table.h"
 #include "net/ipv6/uip-ds6-nbr.h"
 #include "net/ipv6/uip-ds6-route.h"
+#include "net/link-stats.h"
 
 #define DEBUG DEBUG_NONE
 #include "net/ip/uip-debug.h"
@@ -65,108 +66,455 @@
 #define MAX_CHILDREN (NBR_TABLE_MAX_NEIGHBORS - 2)
 #define UIP_IP_BUF       ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
 
+/*
+ * The counters and the removal candidate below are kept up to date from
+ * the parent, route and neighbor table events instead of being recomputed
+ * by a scan of the neighbor and route tables for every DIO, DAO and DIS.
+ * A periodic resync rebuilds them from scratch, which also picks up
+ * neighbors added by ND that RPL never hears about.
+ */
 static int num_parents; /* any node that are possible parents */
 static int num_children;  /* all children that we have as nexthop */
 static int num_free;
 static linkaddr_t *worst_rank_nbr; /* the parent that has the worst rank */
 static rpl_rank_t worst_rank;
+
+/* Worst-scored parent that is neither preferred parent nor child */
+static rpl_parent_t *worst_parent;
+static uint32_t worst_parent_score;
+static uint8_t worst_parent_dirty;
+
+/* A neighbor that is neither parent nor child */
+static linkaddr_t unused_nbr;
+static uint8_t unused_nbr_valid;
+static uint8_t unused_scan_needed;
+
+static struct ctimer resync_timer;
+
+#if RPL_CONF_STATS
+/* Recently evicted neighbors, to count the ones that come back */
+static linkaddr_t evicted[RPL_NBR_POLICY_EVICTED_HISTORY];
+static uint8_t evicted_next;
+#endif /* RPL_CONF_STATS */
+
+#if (UIP_CONF_MAX_ROUTES != 0)
+/* Number of routes using each neighbor as nexthop */
+struct nbr_policy_child {
+  uip_ipaddr_t nexthop;
+  uint16_t num_routes;
+};
+NBR_TABLE(struct nbr_policy_child, nbr_children);
+
+static struct uip_ds6_notification route_notification;
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+/*---------------------------------------------------------------------------*/
+static int
+is_child(const linkaddr_t *lladdr)
+{
+#if (UIP_CONF_MAX_ROUTES != 0)
+  return nbr_table_get_from_lladdr(nbr_children, lladdr) != NULL;
+#else /* (UIP_CONF_MAX_ROUTES != 0) */
+  return 0;
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+}
+/*---------------------------------------------------------------------------*/
+static int
+is_removable_parent(rpl_parent_t *parent)
+{
+  return parent->rank > 0 &&
+    parent->dag != NULL &&
+    parent->dag->instance != NULL &&
+    /*
+     * The preferred parent for the DAG must not be removed
+     * Note: this assumes that only RPL adds default routes.
+     */
+    parent->dag->preferred_parent != parent &&
+    !is_child(nbr_table_get_lladdr(rpl_parents, parent));
+}
+/*---------------------------------------------------------------------------*/
+static void
+check_relearned(const linkaddr_t *lladdr)
+{
+#if RPL_CONF_STATS
+  int i;
+
+  for(i = 0; lladdr != NULL && i < RPL_NBR_POLICY_EVICTED_HISTORY; i++) {
+    if(linkaddr_cmp(&evicted[i], lladdr)) {
+      /* Evicted not long ago and learned again */
+      RPL_STAT(rpl_stats.nbr_relearned++);
+      linkaddr_copy(&evicted[i], &linkaddr_null);
+      return;
+    }
+  }
+#endif /* RPL_CONF_STATS */
+}
+/*---------------------------------------------------------------------------*/
+/* Time since we last transmitted to this neighbor, in minutes */
+static clock_time_t
+nbr_age(const struct link_stats *stats)
+{
+  clock_time_t age;
+
+  if(stats == NULL) {
+    return RPL_NBR_POLICY_AGE_MAX;
+  }
+  age = (clock_time() - stats->last_tx_time) / (60 * CLOCK_SECOND);
+  return age < RPL_NBR_POLICY_AGE_MAX ? age : RPL_NBR_POLICY_AGE_MAX;
+}
 /*---------------------------------------------------------------------------*/
-#if DEBUG == DEBUG_FULL
 /*
- * This create a periodic call of the update_nbr function that will print
- * useful debugging information when in DEBUG_FULL mode
+ * Eviction score of a parent, in rank units: the rank via the parent,
+ * plus a penalty when its ETX is not fresh and a penalty growing with
+ * the time since it was last used. Parents that are children or the
+ * preferred parent are never scored. Higher is a better candidate.
  */
-static void update_nbr(void);
-static struct ctimer periodic_timer;
-static int timer_init = 0;
+static uint32_t
+parent_score(rpl_parent_t *parent)
+{
+  const struct link_stats *stats;
+  uint32_t score;
+
+  if(parent->dag == NULL || parent->dag->instance == NULL) {
+    return 0;
+  }
+  score = parent->dag->instance->of->rank_via_parent(parent);
+
+  stats = rpl_get_parent_link_stats(parent);
+  if(!link_stats_is_fresh(stats)) {
+    score += RPL_NBR_POLICY_STALE_PENALTY;
+  }
+  score += (uint32_t)nbr_age(stats) * RPL_NBR_POLICY_AGE_PENALTY;
+  return score;
+}
+/*---------------------------------------------------------------------------*/
 static void
-handle_periodic_timer(void *ptr)
+offer_parent(rpl_parent_t *parent)
 {
-  update_nbr();
-  ctimer_restart(&periodic_timer);
+  uint32_t score;
+
+  if(worst_parent_dirty) {
+    /* A full recomputation is already pending */
+    return;
+  }
+
+  score = parent_score(parent);
+
+  if(parent == worst_parent) {
+    if(score < worst_parent_score || !is_removable_parent(parent)) {
+      /* Some other parent may be worse now */
+      worst_parent_dirty = 1;
+    } else {
+      worst_parent_score = score;
+    }
+  } else if(score > worst_parent_score && is_removable_parent(parent)) {
+    worst_parent = parent;
+    worst_parent_score = score;
+  }
 }
-#endif /* DEBUG == DEBUG_FULL */
 /*---------------------------------------------------------------------------*/
 static void
-update_nbr(void)
+recompute_worst_parent(void)
 {
-  uip_ds6_nbr_t *nbr;
   rpl_parent_t *parent;
-  int num_used;
-  int is_used;
-  rpl_rank_t rank;
 
-#if DEBUG == DEBUG_FULL
-  if(!timer_init) {
-    timer_init = 1;
-    ctimer_set(&periodic_timer, 60 * CLOCK_SECOND,
-               &handle_periodic_timer, NULL);
+  worst_parent = NULL;
+  worst_parent_score = 0;
+  worst_parent_dirty = 0;
+  for(parent = nbr_table_head(rpl_parents);
+      parent != NULL;
+      parent = nbr_table_next(rpl_parents, parent)) {
+    offer_parent(parent);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+is_unused(const linkaddr_t *lladdr)
+{
+  return !is_child(lladdr) &&
+    rpl_get_parent((uip_lladdr_t *)lladdr) == NULL;
+}
+/*---------------------------------------------------------------------------*/
+static int
+unused_nbr_check(void)
+{
+  if(unused_nbr_valid &&
+     (uip_ds6_nbr_ll_lookup((uip_lladdr_t *)&unused_nbr) == NULL ||
+      !is_unused(&unused_nbr))) {
+    unused_nbr_valid = 0;
+  }
+  return unused_nbr_valid;
+}
+/*---------------------------------------------------------------------------*/
+/* Keep the least recently used of the unused neighbors */
+static void
+remember_unused(const linkaddr_t *lladdr)
+{
+  if(unused_nbr_check() &&
+     nbr_age(link_stats_from_lladdr(lladdr)) <=
+     nbr_age(link_stats_from_lladdr(&unused_nbr))) {
+    return;
   }
-#endif /* DEBUG == DEBUG_FULL */
+  linkaddr_copy(&unused_nbr, lladdr);
+  unused_nbr_valid = 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+scan_unused(void)
+{
+  uip_ds6_nbr_t *nbr;
+  int num_used;
 
-  worst_rank = 0;
-  worst_rank_nbr = NULL;
+  /*
+   * Only runs after the last known unused neighbor was handed out for
+   * removal, or on resync. Parent and child state are plain lookups here,
+   * no route table scan is needed.
+   */
+  unused_scan_needed = 0;
   num_used = 0;
-  num_parents = 0;
-  num_children = 0;
-
-  nbr = nbr_table_head(ds6_neighbors);
-  while(nbr != NULL) {
+  for(nbr = nbr_table_head(ds6_neighbors);
+      nbr != NULL;
+      nbr = nbr_table_next(ds6_neighbors, nbr)) {
     linkaddr_t *lladdr = nbr_table_get_lladdr(ds6_neighbors, nbr);
-    is_used = 0;
+    if(is_unused(lladdr)) {
+      /* This neighbor is neither parent or child and can be safely removed */
+      remember_unused(lladdr);
+    }
+    num_used++;
+  }
+  /* how many more IP neighbors can be have? */
+  num_free = NBR_TABLE_MAX_NEIGHBORS - num_used;
+}
+/*---------------------------------------------------------------------------*/
+static void
+update_nbr(void)
+{
+  if(!unused_nbr_check() && unused_scan_needed) {
+    scan_unused();
+  }
 
-    /*
-     * Check if this neighbor is used as nexthop and therefor being a
-     * RPL child.
-    */
+  if(unused_nbr_valid) {
+    worst_rank_nbr = &unused_nbr;
+    worst_rank = INFINITE_RANK;
+    return;
+  }
 
-    if(uip_ds6_route_is_nexthop(&nbr->ipaddr) != 0) {
-      is_used++;
-      num_children++;
+  if(worst_parent_dirty) {
+    recompute_worst_parent();
+  }
+  if(worst_parent != NULL) {
+    /* Stale and idle parents look worse than their rank alone */
+    worst_rank_nbr = nbr_table_get_lladdr(rpl_parents, worst_parent);
+    worst_rank = worst_parent_score < INFINITE_RANK ?
+      worst_parent_score : INFINITE_RANK - 1;
+  } else {
+    worst_rank_nbr = NULL;
+    worst_rank = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+#if (UIP_CONF_MAX_ROUTES != 0)
+static struct nbr_policy_child *
+child_lookup(const uip_ipaddr_t *nexthop)
+{
+  struct nbr_policy_child *child;
+
+  for(child = nbr_table_head(nbr_children);
+      child != NULL;
+      child = nbr_table_next(nbr_children, child)) {
+    if(uip_ipaddr_cmp(&child->nexthop, nexthop)) {
+      return child;
     }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static struct nbr_policy_child *
+child_add(const uip_ipaddr_t *nexthop)
+{
+  const uip_lladdr_t *lladdr;
+  struct nbr_policy_child *child;
+  rpl_parent_t *parent;
 
-    parent = rpl_get_parent((uip_lladdr_t *)lladdr);
-    if(parent != NULL) {
-      num_parents++;
-
-      if(parent->dag != NULL && parent->dag->preferred_parent == parent) {
-        /*
-         * This is the preferred parent for the DAG and must not be removed
-         * Note: this assumes that only RPL adds default routes.
-         */
-      } else if(is_used == 0 && worst_rank < INFINITE_RANK &&
-                parent->rank > 0 &&
-                parent->dag != NULL &&
-                parent->dag->instance != NULL &&
-                (rank = parent->dag->instance->of->rank_via_parent(parent)) > worst_rank) {
-        /* This is the worst-rank neighbor - this is a good candidate for removal */
-        worst_rank = rank;
-        worst_rank_nbr = lladdr;
-      }
-      /* add to is_used after evaluation of is_used above */
-      is_used++;
+  lladdr = uip_ds6_nbr_lladdr_from_ipaddr((uip_ipaddr_t *)nexthop);
+  if(lladdr == NULL) {
+    return NULL;
+  }
+  /* The nexthop is a ds6 neighbor, so this never evicts anything */
+  child = nbr_table_add_lladdr(nbr_children, (linkaddr_t *)lladdr,
+                               NBR_TABLE_REASON_ROUTE, NULL);
+  if(child == NULL) {
+    return NULL;
+  }
+  uip_ipaddr_copy(&child->nexthop, nexthop);
+  child->num_routes = 0;
+  num_children++;
+  check_relearned((linkaddr_t *)lladdr);
+
+  parent = rpl_get_parent((uip_lladdr_t *)lladdr);
+  if(parent != NULL && parent == worst_parent) {
+    worst_parent_dirty = 1;
+  }
+  return child;
+}
+/*---------------------------------------------------------------------------*/
+static void
+child_remove(struct nbr_policy_child *child)
+{
+  linkaddr_t lladdr;
+  rpl_parent_t *parent;
+
+  linkaddr_copy(&lladdr, nbr_table_get_lladdr(nbr_children, child));
+  nbr_table_remove(nbr_children, child);
+  num_children--;
+
+  parent = rpl_get_parent((uip_lladdr_t *)&lladdr);
+  if(parent != NULL) {
+    offer_parent(parent);
+  } else if(uip_ds6_nbr_ll_lookup((uip_lladdr_t *)&lladdr) != NULL) {
+    remember_unused(&lladdr);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+child_evicted(void *ptr)
+{
+  /* The neighbor is leaving all tables, its routes go with it */
+  num_children--;
+}
+/*---------------------------------------------------------------------------*/
+static void
+route_callback(int event, uip_ipaddr_t *route, uip_ipaddr_t *nexthop,
+               int num_routes)
+{
+  struct nbr_policy_child *child;
+
+  if(nexthop == NULL) {
+    return;
+  }
+
+  if(event == UIP_DS6_NOTIFICATION_ROUTE_ADD) {
+    child = child_lookup(nexthop);
+    if(child == NULL) {
+      child = child_add(nexthop);
+    }
+    if(child != NULL) {
+      child->num_routes++;
     }
+  } else if(event == UIP_DS6_NOTIFICATION_ROUTE_RM) {
+    child = child_lookup(nexthop);
+    if(child != NULL && --child->num_routes == 0) {
+      child_remove(child);
+    }
+  }
+}
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+/*---------------------------------------------------------------------------*/
+static void
+resync(void)
+{
+  rpl_parent_t *parent;
+#if (UIP_CONF_MAX_ROUTES != 0)
+  struct nbr_policy_child *child;
+  struct nbr_policy_child *next;
+  uip_ds6_route_t *r;
+  uip_ipaddr_t *nexthop;
 
-    if(is_used == 0) {
-      /* This neighbor is neither parent or child and can be safely removed */
-      worst_rank_nbr = lladdr;
-      worst_rank = INFINITE_RANK;
-    } else if(is_used > 1) {
-      PRINTF("NBR-POLICY: *** Neighbor is both child and candidate parent: ");
-      PRINTLLADDR((uip_lladdr_t *)lladdr);
-      PRINTF("\n");
+  /* Rebuild the route counts in case a notification was missed */
+  for(child = nbr_table_head(nbr_children);
+      child != NULL;
+      child = nbr_table_next(nbr_children, child)) {
+    child->num_routes = 0;
+  }
+  for(r = uip_ds6_route_head(); r != NULL; r = uip_ds6_route_next(r)) {
+    nexthop = uip_ds6_route_nexthop(r);
+    if(nexthop != NULL) {
+      child = child_lookup(nexthop);
+      if(child == NULL) {
+        child = child_add(nexthop);
+      }
+      if(child != NULL) {
+        child->num_routes++;
+      }
+    }
+  }
+  num_children = 0;
+  child = nbr_table_head(nbr_children);
+  while(child != NULL) {
+    next = nbr_table_next(nbr_children, child);
+    if(child->num_routes == 0) {
+      nbr_table_remove(nbr_children, child);
+    } else {
+      num_children++;
     }
+    child = next;
+  }
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
 
-    nbr = nbr_table_next(ds6_neighbors, nbr);
-    num_used++;
+  num_parents = 0;
+  for(parent = nbr_table_head(rpl_parents);
+      parent != NULL;
+      parent = nbr_table_next(rpl_parents, parent)) {
+    num_parents++;
   }
-  /* how many more IP neighbors can be have? */
-  num_free = NBR_TABLE_MAX_NEIGHBORS - num_used;
+
+  worst_parent_dirty = 1;
+  unused_nbr_valid = 0;
+  scan_unused();
 
   PRINTF("NBR-POLICY: Free: %d, Children: %d, Parents: %d Routes: %d\n",
 	 num_free, num_children, num_parents, uip_ds6_route_num_routes());
 }
 /*---------------------------------------------------------------------------*/
+static void
+handle_resync_timer(void *ptr)
+{
+  resync();
+  ctimer_restart(&resync_timer);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_nbr_policy_init(void)
+{
+#if (UIP_CONF_MAX_ROUTES != 0)
+  nbr_table_register(nbr_children, (nbr_table_callback *)child_evicted);
+  uip_ds6_notification_add(&route_notification, route_callback);
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+  resync();
+  ctimer_set(&resync_timer, RPL_NBR_POLICY_RESYNC_INTERVAL,
+             handle_resync_timer, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_nbr_policy_parent_added(rpl_parent_t *parent)
+{
+  check_relearned(nbr_table_get_lladdr(rpl_parents, parent));
+  num_parents++;
+  offer_parent(parent);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_nbr_policy_parent_removed(rpl_parent_t *parent)
+{
+  linkaddr_t *lladdr;
+
+  num_parents--;
+  if(parent == worst_parent) {
+    worst_parent = NULL;
+    worst_parent_dirty = 1;
+  }
+  lladdr = nbr_table_get_lladdr(rpl_parents, parent);
+  if(lladdr != NULL && !is_child(lladdr) &&
+     uip_ds6_nbr_ll_lookup((uip_lladdr_t *)lladdr) != NULL) {
+    remember_unused(lladdr);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_nbr_policy_parent_updated(rpl_parent_t *parent)
+{
+  offer_parent(parent);
+}
+/*---------------------------------------------------------------------------*/
 /* Called whenever we get a unicast DIS - e.g. someone that already
    have this node in its table - since it is a unicast */
 const linkaddr_t *
@@ -239,18 +587,54 @@ find_removable_dao(uip_ipaddr_t *from, rpl_instance_t *instance)
 const linkaddr_t *
 rpl_nbr_policy_find_removable(nbr_table_reason_t reason,void * data)
 {
+  const linkaddr_t *removable;
+
   /* When we get the DIO/DAO/DIS we know that UIP contains the
      incoming packet */
   switch(reason) {
   case NBR_TABLE_REASON_RPL_DIO:
-    return find_removable_dio(&UIP_IP_BUF->srcipaddr, data);
+    removable = find_removable_dio(&UIP_IP_BUF->srcipaddr, data);
+    break;
   case NBR_TABLE_REASON_RPL_DAO:
-    return find_removable_dao(&UIP_IP_BUF->srcipaddr, data);
+    removable = find_removable_dao(&UIP_IP_BUF->srcipaddr, data);
+    break;
   case NBR_TABLE_REASON_RPL_DIS:
-    return find_removable_dis(&UIP_IP_BUF->srcipaddr);
+    removable = find_removable_dis(&UIP_IP_BUF->srcipaddr);
+    break;
   default:
     return NULL;
   }
+
+  if(removable == NULL) {
+    RPL_STAT(rpl_stats.nbr_admit_refused++);
+    return NULL;
+  }
+
+  switch(reason) {
+  case NBR_TABLE_REASON_RPL_DIO:
+    RPL_STAT(rpl_stats.nbr_evict_dio++);
+    break;
+  case NBR_TABLE_REASON_RPL_DAO:
+    RPL_STAT(rpl_stats.nbr_evict_dao++);
+    break;
+  default:
+    RPL_STAT(rpl_stats.nbr_evict_dis++);
+    break;
+  }
+#if RPL_CONF_STATS
+  linkaddr_copy(&evicted[evicted_next], removable);
+  evicted_next = (evicted_next + 1) % RPL_NBR_POLICY_EVICTED_HISTORY;
+#endif /* RPL_CONF_STATS */
+
+  if(removable == &unused_nbr) {
+    RPL_STAT(rpl_stats.nbr_evict_unused++);
+    /* It is about to be removed, look for another one next time */
+    unused_nbr_valid = 0;
+    unused_scan_needed = 1;
+  } else {
+    RPL_STAT(rpl_stats.nbr_evict_parent++);
+  }
+  return removable;
 }
 /*---------------------------------------------------------------------------*/
 /** @}*/
@@ -45,8 +45,6 @@
 #include "net/ipv6/uip-icmp6.h"
 #include "net/rpl/rpl-private.h"
 #include "net/rpl/rpl-ns.h"
-#include "lib/list.h"
-#include "lib/memb.h"
 
 #if RPL_WITH_NON_STORING
 
@@ -55,13 +53,42 @@
 
 #include <limits.h>
 #include <string.h>
+#if RPL_NS_DYNAMIC_STORAGE
+#include <stdlib.h>
+#endif /* RPL_NS_DYNAMIC_STORAGE */
+
+#if RPL_NS_DYNAMIC_STORAGE && RPL_NS_MAX_NODES > RPL_LIFETIME_MAX_INDEX
+#error "RPL_NS_MAX_NODES is above the number of timers the lifetime wheel can index"
+#endif
 
 /* Total number of nodes */
 static int num_nodes;
 
-/* Every known node in the network */
-LIST(nodelist);
-MEMB(nodememb, rpl_ns_node_t, RPL_NS_LINK_NUM);
+/* Incremented whenever a path to a node may have changed */
+static uint32_t generation;
+
+/* Every known node in the network, chained through next and prev, and the
+   unused records, chained through next. */
+static rpl_ns_index_t nodelist = RPL_NS_NODE_NONE;
+static rpl_ns_index_t freelist;
+
+#if RPL_NS_DYNAMIC_STORAGE
+/* Node records are allocated in chunks of RPL_NS_CHUNK_SIZE that are never
+   moved, so node pointers handed out stay valid while the storage grows. */
+static rpl_ns_node_t **chunks;
+static uint32_t num_chunks;
+static uint32_t max_chunks;
+
+/* Nodes hashed on their link identifier, chained through hash_next. The
+   table is doubled when the average chain length exceeds two. */
+static rpl_ns_index_t *nodehash;
+static uint32_t hash_size;
+#else /* RPL_NS_DYNAMIC_STORAGE */
+static rpl_ns_node_t nodestore[RPL_NS_LINK_NUM];
+
+static rpl_ns_index_t nodehash[RPL_NS_HASH_SIZE];
+#define hash_size RPL_NS_HASH_SIZE
+#endif /* RPL_NS_DYNAMIC_STORAGE */
 
 /*---------------------------------------------------------------------------*/
 int
@@ -70,101 +97,465 @@ rpl_ns_num_nodes(void)
   return num_nodes;
 }
 /*---------------------------------------------------------------------------*/
+static rpl_ns_node_t *
+node_at(rpl_ns_index_t index)
+{
+  if(index == RPL_NS_NODE_NONE) {
+    return NULL;
+  }
+#if RPL_NS_DYNAMIC_STORAGE
+  return &chunks[index / RPL_NS_CHUNK_SIZE][index % RPL_NS_CHUNK_SIZE];
+#else /* RPL_NS_DYNAMIC_STORAGE */
+  return &nodestore[index];
+#endif /* RPL_NS_DYNAMIC_STORAGE */
+}
+/*---------------------------------------------------------------------------*/
+/* Nodes refer to their DAG by its position in the RPL instance table
+   rather than by pointer. */
+static uint8_t
+dag_to_index(const rpl_dag_t *dag)
+{
+  return (dag->instance - instance_table) * RPL_MAX_DAG_PER_INSTANCE +
+    (dag - dag->instance->dag_table);
+}
+/*---------------------------------------------------------------------------*/
+static rpl_dag_t *
+index_to_dag(uint8_t index)
+{
+  return &instance_table[index / RPL_MAX_DAG_PER_INSTANCE].dag_table[index % RPL_MAX_DAG_PER_INSTANCE];
+}
+/*---------------------------------------------------------------------------*/
+static unsigned
+hash_link_identifier(const unsigned char *iid)
+{
+  /* FNV-1a over the 8-byte interface identifier */
+  uint32_t h = 2166136261UL;
+  int i;
+
+  for(i = 0; i < 8; i++) {
+    h = (h ^ iid[i]) * 16777619UL;
+  }
+  return h & (hash_size - 1);
+}
+/*---------------------------------------------------------------------------*/
 static int
 node_matches_address(const rpl_dag_t *dag, const rpl_ns_node_t *node, const uip_ipaddr_t *addr)
 {
   return addr != NULL
       && node != NULL
       && dag != NULL
-      && dag == node->dag
-      && !memcmp(addr, &node->dag->dag_id, 8)
+      && dag_to_index(dag) == node->dag
+      && !memcmp(addr, &dag->dag_id, 8)
       && !memcmp(((const unsigned char *)addr) + 8, node->link_identifier, 8);
 }
 /*---------------------------------------------------------------------------*/
-rpl_ns_node_t *
-rpl_ns_get_node(const rpl_dag_t *dag, const uip_ipaddr_t *addr)
+#if RPL_NS_DYNAMIC_STORAGE
+static int
+grow_storage(void)
+{
+  rpl_ns_node_t **new_chunks;
+  rpl_ns_node_t *chunk;
+  uint32_t base;
+  uint32_t i;
+
+  if((num_chunks + 1) * (unsigned long)RPL_NS_CHUNK_SIZE > RPL_NS_MAX_NODES) {
+    return 0;
+  }
+
+  if(num_chunks == max_chunks) {
+    max_chunks = max_chunks > 0 ? max_chunks * 2 : 8;
+    new_chunks = realloc(chunks, max_chunks * sizeof(*chunks));
+    if(new_chunks == NULL) {
+      max_chunks = num_chunks;
+      return 0;
+    }
+    chunks = new_chunks;
+  }
+
+  chunk = malloc(RPL_NS_CHUNK_SIZE * sizeof(rpl_ns_node_t));
+  if(chunk == NULL) {
+    return 0;
+  }
+  base = num_chunks * RPL_NS_CHUNK_SIZE;
+  chunks[num_chunks++] = chunk;
+
+  for(i = RPL_NS_CHUNK_SIZE; i > 0; i--) {
+    chunk[i - 1].next = freelist;
+    freelist = base + i - 1;
+  }
+
+#if DEBUG
+  {
+    rpl_ns_memory_t usage;
+    rpl_ns_memory_usage(&usage);
+    PRINTF("RPL: NS node storage grown to %lu nodes, %lu bytes, %u bytes per node record\n",
+           (unsigned long)usage.capacity, (unsigned long)usage.bytes,
+           usage.node_size);
+  }
+#endif /* DEBUG */
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+grow_hash(void)
+{
+  rpl_ns_index_t *new_hash;
+  rpl_ns_index_t index;
+  rpl_ns_node_t *node;
+  uint32_t i;
+  unsigned h;
+
+  new_hash = malloc(2 * hash_size * sizeof(rpl_ns_index_t));
+  if(new_hash == NULL) {
+    /* Keep the current table, only the chains get longer */
+    return;
+  }
+  free(nodehash);
+  nodehash = new_hash;
+  hash_size *= 2;
+  for(i = 0; i < hash_size; i++) {
+    nodehash[i] = RPL_NS_NODE_NONE;
+  }
+  for(index = nodelist; index != RPL_NS_NODE_NONE; index = node->next) {
+    node = node_at(index);
+    h = hash_link_identifier(node->link_identifier);
+    node->hash_next = nodehash[h];
+    nodehash[h] = index;
+  }
+}
+#endif /* RPL_NS_DYNAMIC_STORAGE */
+/*---------------------------------------------------------------------------*/
+static rpl_ns_index_t
+alloc_node(void)
+{
+  rpl_ns_index_t index;
+
+#if RPL_NS_DYNAMIC_STORAGE
+  if(freelist == RPL_NS_NODE_NONE && !grow_storage()) {
+    return RPL_NS_NODE_NONE;
+  }
+  if((uint32_t)num_nodes >= 2 * hash_size) {
+    grow_hash();
+  }
+#endif /* RPL_NS_DYNAMIC_STORAGE */
+
+  index = freelist;
+  if(index != RPL_NS_NODE_NONE) {
+    freelist = node_at(index)->next;
+  }
+  return index;
+}
+/*---------------------------------------------------------------------------*/
+static void
+refresh_from_parent(rpl_ns_node_t *node)
+{
+  rpl_ns_node_t *parent;
+
+  if(node->flags & RPL_NS_NODE_ROOT) {
+    node->flags |= RPL_NS_NODE_REACHABLE;
+    node->depth = 0;
+    return;
+  }
+  parent = node_at(node->parent);
+  if(parent != NULL && (parent->flags & RPL_NS_NODE_REACHABLE)) {
+    node->flags |= RPL_NS_NODE_REACHABLE;
+    node->depth = parent->depth + 1;
+  } else {
+    node->flags &= ~RPL_NS_NODE_REACHABLE;
+    node->depth = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Recompute reachability and depth of a node and of its whole subtree,
+   in pre-order and without recursion to keep the stack usage constant. */
+static void
+update_subtree(rpl_ns_index_t index)
+{
+  rpl_ns_index_t i;
+  rpl_ns_node_t *node;
+
+  i = index;
+  for(;;) {
+    node = node_at(i);
+    refresh_from_parent(node);
+    if(node->first_child != RPL_NS_NODE_NONE) {
+      i = node->first_child;
+      continue;
+    }
+    while(i != index && node_at(i)->next_sibling == RPL_NS_NODE_NONE) {
+      i = node_at(i)->parent;
+    }
+    if(i == index) {
+      return;
+    }
+    i = node_at(i)->next_sibling;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void node_expired(uint32_t index);
+
+static void
+unlink_from_parent(rpl_ns_node_t *node)
+{
+  rpl_ns_node_t *parent;
+
+  parent = node_at(node->parent);
+  if(parent == NULL) {
+    return;
+  }
+  if(node->prev_sibling != RPL_NS_NODE_NONE) {
+    node_at(node->prev_sibling)->next_sibling = node->next_sibling;
+  } else {
+    parent->first_child = node->next_sibling;
+  }
+  if(node->next_sibling != RPL_NS_NODE_NONE) {
+    node_at(node->next_sibling)->prev_sibling = node->prev_sibling;
+  }
+  if(--parent->num_children == 0 &&
+     rpl_lifetime_remaining(parent->lifetime) == 0) {
+    /* The parent only stayed for its children */
+    rpl_lifetime_timer_set(RPL_LIFETIME_NS, node->parent, parent->lifetime);
+  }
+  node->parent = RPL_NS_NODE_NONE;
+  node->next_sibling = RPL_NS_NODE_NONE;
+  node->prev_sibling = RPL_NS_NODE_NONE;
+}
+/*---------------------------------------------------------------------------*/
+static void
+set_parent(rpl_ns_index_t index, rpl_ns_index_t parent_index)
 {
+  rpl_ns_node_t *node;
+  rpl_ns_node_t *parent;
+
+  node = node_at(index);
+  unlink_from_parent(node);
+  generation++;
+  parent = node_at(parent_index);
+  if(parent != NULL) {
+    node->parent = parent_index;
+    node->next_sibling = parent->first_child;
+    if(parent->first_child != RPL_NS_NODE_NONE) {
+      node_at(parent->first_child)->prev_sibling = index;
+    }
+    parent->first_child = index;
+    parent->num_children++;
+  }
+  update_subtree(index);
+}
+/*---------------------------------------------------------------------------*/
+/* Is the node at index in the subtree rooted at ancestor? */
+static int
+is_in_subtree(rpl_ns_index_t index, rpl_ns_index_t ancestor)
+{
+  rpl_ns_node_t *node;
+  rpl_ns_node_t *top;
+  uint8_t reachable;
+
+  node = node_at(index);
+  top = node_at(ancestor);
+  reachable = top->flags & RPL_NS_NODE_REACHABLE;
+  /* A subtree is either entirely reachable or entirely unreachable */
+  if((node->flags & RPL_NS_NODE_REACHABLE) != reachable) {
+    return 0;
+  }
+  while(index != RPL_NS_NODE_NONE) {
+    if(index == ancestor) {
+      return 1;
+    }
+    node = node_at(index);
+    /* Nodes of a reachable subtree are deeper than its top */
+    if(reachable && node->depth <= top->depth) {
+      return 0;
+    }
+    index = node->parent;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+hash_remove(rpl_ns_index_t index)
+{
+  rpl_ns_index_t *pp;
+  rpl_ns_node_t *node;
+
+  node = node_at(index);
+  pp = &nodehash[hash_link_identifier(node->link_identifier)];
+  while(*pp != RPL_NS_NODE_NONE) {
+    if(*pp == index) {
+      *pp = node->hash_next;
+      return;
+    }
+    pp = &node_at(*pp)->hash_next;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static rpl_ns_index_t
+lookup(const rpl_dag_t *dag, const uip_ipaddr_t *addr)
+{
+  rpl_ns_index_t index;
   rpl_ns_node_t *l;
-  for(l = list_head(nodelist); l != NULL; l = list_item_next(l)) {
+
+  if(addr == NULL || num_nodes == 0) {
+    return RPL_NS_NODE_NONE;
+  }
+  index = nodehash[hash_link_identifier(((const unsigned char *)addr) + 8)];
+  for(; index != RPL_NS_NODE_NONE; index = l->hash_next) {
+    l = node_at(index);
     /* Compare prefix and node identifier */
     if(node_matches_address(dag, l, addr)) {
-      return l;
+      return index;
     }
   }
-  return NULL;
+  return RPL_NS_NODE_NONE;
+}
+/*---------------------------------------------------------------------------*/
+/* Deallocates a node at the end of its lifetime. A node that children
+   still point to goes when its last child does. */
+static void
+node_expired(uint32_t index)
+{
+  rpl_ns_node_t *l = node_at(index);
+
+  if(l->num_children > 0) {
+    return;
+  }
+
+  if(l->prev != RPL_NS_NODE_NONE) {
+    node_at(l->prev)->next = l->next;
+  } else {
+    nodelist = l->next;
+  }
+  if(l->next != RPL_NS_NODE_NONE) {
+    node_at(l->next)->prev = l->prev;
+  }
+  hash_remove(index);
+  unlink_from_parent(l);
+  generation++;
+  l->next = freelist;
+  freelist = index;
+  num_nodes--;
+}
+/*---------------------------------------------------------------------------*/
+static struct rpl_lifetime_timer *
+node_timer_at(uint32_t index)
+{
+  return &node_at(index)->timer;
+}
+
+static const rpl_lifetime_user_t node_lifetime_user = {
+  node_timer_at, node_expired
+};
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_get_node(const rpl_dag_t *dag, const uip_ipaddr_t *addr)
+{
+  return node_at(lookup(dag, addr));
+}
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_node_parent(const rpl_ns_node_t *node)
+{
+  return node != NULL ? node_at(node->parent) : NULL;
 }
 /*---------------------------------------------------------------------------*/
 int
 rpl_ns_is_node_reachable(const rpl_dag_t *dag, const uip_ipaddr_t *addr)
 {
-  int max_depth = RPL_NS_LINK_NUM;
   rpl_ns_node_t *node = rpl_ns_get_node(dag, addr);
-  rpl_ns_node_t *root_node = rpl_ns_get_node(dag, dag != NULL ? &dag->dag_id : NULL);
-  while(node != NULL && node != root_node && max_depth > 0) {
-    node = node->parent;
-    max_depth--;
-  }
-  return node != NULL && node == root_node;
+  return node != NULL && (node->flags & RPL_NS_NODE_REACHABLE);
 }
 /*---------------------------------------------------------------------------*/
 void
 rpl_ns_expire_parent(rpl_dag_t *dag, const uip_ipaddr_t *child, const uip_ipaddr_t *parent)
 {
-  rpl_ns_node_t *l = rpl_ns_get_node(dag, child);
+  rpl_ns_index_t index = lookup(dag, child);
+  rpl_ns_node_t *l = node_at(index);
   /* Check if parent matches */
-  if(l != NULL && node_matches_address(dag, l->parent, parent)) {
-    l->lifetime = RPL_NOPATH_REMOVAL_DELAY;
+  if(l != NULL && node_matches_address(dag, node_at(l->parent), parent)) {
+    l->lifetime = rpl_lifetime_to_expiry(RPL_NOPATH_REMOVAL_DELAY);
+    rpl_lifetime_timer_set(RPL_LIFETIME_NS, index, l->lifetime);
   }
 }
 /*---------------------------------------------------------------------------*/
 rpl_ns_node_t *
 rpl_ns_update_node(rpl_dag_t *dag, const uip_ipaddr_t *child, const uip_ipaddr_t *parent, uint32_t lifetime)
 {
-  rpl_ns_node_t *child_node = rpl_ns_get_node(dag, child);
-  rpl_ns_node_t *parent_node = rpl_ns_get_node(dag, parent);
-  rpl_ns_node_t *old_parent_node;
+  rpl_ns_index_t child_index = lookup(dag, child);
+  rpl_ns_index_t parent_index = lookup(dag, parent);
+  rpl_ns_node_t *child_node;
+  unsigned h;
+
+  if(dag == NULL || child == NULL) {
+    return NULL;
+  }
 
   if(parent != NULL) {
     /* No node for the parent, add one with infinite lifetime */
-    if(parent_node == NULL) {
-      parent_node = rpl_ns_update_node(dag, parent, NULL, 0xffffffff);
-      if(parent_node == NULL) {
+    if(parent_index == RPL_NS_NODE_NONE) {
+      if(rpl_ns_update_node(dag, parent, NULL, 0xffffffff) == NULL) {
         return NULL;
       }
+      parent_index = lookup(dag, parent);
     }
   }
 
   /* No node for this child, add one */
-  if(child_node == NULL) {
-    child_node = memb_alloc(&nodememb);
+  if(child_index == RPL_NS_NODE_NONE) {
+    child_index = alloc_node();
     /* No space left, abort */
-    if(child_node == NULL) {
+    if(child_index == RPL_NS_NODE_NONE) {
       return NULL;
     }
-    child_node->parent = NULL;
-    list_add(nodelist, child_node);
+    child_node = node_at(child_index);
+    child_node->parent = RPL_NS_NODE_NONE;
+    child_node->first_child = RPL_NS_NODE_NONE;
+    child_node->next_sibling = RPL_NS_NODE_NONE;
+    child_node->prev_sibling = RPL_NS_NODE_NONE;
+    child_node->num_children = 0;
+    child_node->dag = dag_to_index(dag);
+    memcpy(child_node->link_identifier, ((const unsigned char *)child) + 8, 8);
+    child_node->flags = 0;
+    if(!memcmp(child_node->link_identifier, ((const unsigned char *)&dag->dag_id) + 8, 8)) {
+      child_node->flags = RPL_NS_NODE_ROOT;
+    }
+    refresh_from_parent(child_node);
+
+    child_node->timer.slot = 0;
+    child_node->next = nodelist;
+    child_node->prev = RPL_NS_NODE_NONE;
+    if(nodelist != RPL_NS_NODE_NONE) {
+      node_at(nodelist)->prev = child_index;
+    }
+    nodelist = child_index;
+    h = hash_link_identifier(child_node->link_identifier);
+    child_node->hash_next = nodehash[h];
+    nodehash[h] = child_index;
     num_nodes++;
+  } else {
+    child_node = node_at(child_index);
   }
 
   /* Initialize node */
-  child_node->dag = dag;
-  child_node->lifetime = lifetime;
-  memcpy(child_node->link_identifier, ((const unsigned char *)child) + 8, 8);
-
-  /* Is the node reachable before the update? */
-  if(rpl_ns_is_node_reachable(dag, child)) {
-    old_parent_node = child_node->parent;
-    /* Update node */
-    child_node->parent = parent_node;
-    /* Has the node become unreachable? May happen if we create a loop. */
-    if(!rpl_ns_is_node_reachable(dag, child)) {
-      /* The new parent makes the node unreachable, restore old parent.
-       * We will take the update next time, with chances we know more of
-       * the topology and the loop is gone. */
-      child_node->parent = old_parent_node;
-    }
+  child_node->lifetime = rpl_lifetime_to_expiry(lifetime);
+  rpl_lifetime_timer_set(RPL_LIFETIME_NS, child_index, child_node->lifetime);
+
+  /* The root is reachable by definition and has no parent */
+  if((child_node->flags & RPL_NS_NODE_ROOT) || parent_index == child_node->parent) {
+    return child_node;
+  }
+
+  if(parent_index != RPL_NS_NODE_NONE && is_in_subtree(parent_index, child_index)) {
+    /* The new parent is in the node's own subtree: taking it would create
+     * a loop. Keep the old parent, we will take the update next time, with
+     * chances we know more of the topology and the loop is gone. */
+    PRINTF("RPL: NS loop detected, keeping the old parent\n");
+  } else if((child_node->flags & RPL_NS_NODE_REACHABLE) &&
+            (parent_index == RPL_NS_NODE_NONE ||
+             !(node_at(parent_index)->flags & RPL_NS_NODE_REACHABLE))) {
+    /* The new parent would make a reachable node unreachable, keep the
+     * old one until the new parent gets a path to the root. */
   } else {
-    child_node->parent = parent_node;
+    set_parent(child_index, parent_index);
   }
 
   return child_node;
@@ -173,58 +564,89 @@ rpl_ns_update_node(rpl_dag_t *dag, const uip_ipaddr_t *child, const uip_ipaddr_t
 void
 rpl_ns_init(void)
 {
+  uint32_t i;
+
+  /* Nodes still in use leave the lifetime wheel */
+  rpl_lifetime_register(RPL_LIFETIME_NS, &node_lifetime_user);
+  for(i = nodelist; i != RPL_NS_NODE_NONE; i = node_at(i)->next) {
+    rpl_lifetime_timer_stop(RPL_LIFETIME_NS, i);
+  }
+
   num_nodes = 0;
-  memb_init(&nodememb);
-  list_init(nodelist);
+  generation++;
+  nodelist = RPL_NS_NODE_NONE;
+  freelist = RPL_NS_NODE_NONE;
+
+#if RPL_NS_DYNAMIC_STORAGE
+  for(i = 0; i < num_chunks; i++) {
+    free(chunks[i]);
+  }
+  free(chunks);
+  chunks = NULL;
+  num_chunks = max_chunks = 0;
+
+  free(nodehash);
+  hash_size = RPL_NS_HASH_SIZE;
+  nodehash = malloc(hash_size * sizeof(rpl_ns_index_t));
+  if(nodehash == NULL) {
+    /* Fall back to a single chain rather than failing */
+    hash_size = 1;
+    nodehash = malloc(sizeof(rpl_ns_index_t));
+  }
+#else /* RPL_NS_DYNAMIC_STORAGE */
+  for(i = RPL_NS_LINK_NUM; i > 0; i--) {
+    nodestore[i - 1].next = freelist;
+    freelist = i - 1;
+  }
+#endif /* RPL_NS_DYNAMIC_STORAGE */
+
+  for(i = 0; i < hash_size; i++) {
+    nodehash[i] = RPL_NS_NODE_NONE;
+  }
 }
 /*---------------------------------------------------------------------------*/
 rpl_ns_node_t *
 rpl_ns_node_head(void)
 {
-  return list_head(nodelist);
+  return node_at(nodelist);
 }
 /*---------------------------------------------------------------------------*/
 rpl_ns_node_t *
 rpl_ns_node_next(rpl_ns_node_t *item)
 {
-  return list_item_next(item);
+  return item != NULL ? node_at(item->next) : NULL;
 }
 /*---------------------------------------------------------------------------*/
 void
 rpl_ns_get_node_global_addr(uip_ipaddr_t *addr, rpl_ns_node_t *node)
 {
-  if(addr != NULL && node != NULL && node->dag != NULL) {
-    memcpy(addr, &node->dag->dag_id, 8);
+  if(addr != NULL && node != NULL) {
+    memcpy(addr, &index_to_dag(node->dag)->dag_id, 8);
     memcpy(((unsigned char *)addr) + 8, &node->link_identifier, 8);
   }
 }
 /*---------------------------------------------------------------------------*/
+uint32_t
+rpl_ns_generation(void)
+{
+  return generation;
+}
+/*---------------------------------------------------------------------------*/
 void
-rpl_ns_periodic(void)
+rpl_ns_memory_usage(rpl_ns_memory_t *usage)
 {
-  rpl_ns_node_t *l;
-  /* First pass, decrement lifetime for all nodes with non-infinite lifetime */
-  for(l = list_head(nodelist); l != NULL; l = list_item_next(l)) {
-    /* Don't touch infinite lifetime nodes */
-    if(l->lifetime != 0xffffffff && l->lifetime > 0) {
-      l->lifetime--;
-    }
-  }
-  /* Second pass, for all expire nodes, deallocate them iff no child points to them */
-  for(l = list_head(nodelist); l != NULL; l = list_item_next(l)) {
-    if(l->lifetime == 0) {
-      rpl_ns_node_t *l2;
-      for(l2 = list_head(nodelist); l2 != NULL; l2 = list_item_next(l2)) {
-        if(l2->parent == l) {
-          break;
-        }
-      }
-      /* No child found, deallocate node */
-      list_remove(nodelist, l);
-      memb_free(&nodememb, l);
-      num_nodes--;
-    }
+  if(usage == NULL) {
+    return;
   }
+  usage->num_nodes = num_nodes;
+  usage->node_size = sizeof(rpl_ns_node_t);
+#if RPL_NS_DYNAMIC_STORAGE
+  usage->capacity = num_chunks * RPL_NS_CHUNK_SIZE;
+  usage->bytes = usage->capacity * sizeof(rpl_ns_node_t) +
+    max_chunks * sizeof(*chunks) + hash_size * sizeof(rpl_ns_index_t);
+#else /* RPL_NS_DYNAMIC_STORAGE */
+  usage->capacity = RPL_NS_LINK_NUM;
+  usage->bytes = sizeof(nodestore) + sizeof(nodehash);
+#endif /* RPL_NS_DYNAMIC_STORAGE */
 }
-
 #endif /* RPL_WITH_NON_STORING */
@@ -49,15 +49,88 @@
 #define RPL_NS_LINK_NUM 32
 #endif /* RPL_NS_CONF_LINK_NUM */
 
+/* Grow the node storage at run time instead of using a fixed pool of
+   RPL_NS_LINK_NUM nodes. Needs malloc, i.e. a Linux-hosted root. */
+#ifdef RPL_NS_CONF_DYNAMIC_STORAGE
+#define RPL_NS_DYNAMIC_STORAGE RPL_NS_CONF_DYNAMIC_STORAGE
+#else /* RPL_NS_CONF_DYNAMIC_STORAGE */
+#define RPL_NS_DYNAMIC_STORAGE 0
+#endif /* RPL_NS_CONF_DYNAMIC_STORAGE */
+
+/* Number of node records allocated at once with dynamic storage */
+#ifdef RPL_NS_CONF_CHUNK_SIZE
+#define RPL_NS_CHUNK_SIZE RPL_NS_CONF_CHUNK_SIZE
+#else /* RPL_NS_CONF_CHUNK_SIZE */
+#define RPL_NS_CHUNK_SIZE 256
+#endif /* RPL_NS_CONF_CHUNK_SIZE */
+
+/* Upper bound on the number of nodes with dynamic storage */
+#ifdef RPL_NS_CONF_MAX_NODES
+#define RPL_NS_MAX_NODES RPL_NS_CONF_MAX_NODES
+#else /* RPL_NS_CONF_MAX_NODES */
+#define RPL_NS_MAX_NODES 65536UL
+#endif /* RPL_NS_CONF_MAX_NODES */
+
+/* Number of buckets of the node hash table, must be a power of two. With
+   dynamic storage this is the initial size. */
+#ifdef RPL_NS_CONF_HASH_SIZE
+#define RPL_NS_HASH_SIZE RPL_NS_CONF_HASH_SIZE
+#else /* RPL_NS_CONF_HASH_SIZE */
+#define RPL_NS_HASH_SIZE 64
+#endif /* RPL_NS_CONF_HASH_SIZE */
+
+/* Number of encoded source routing headers cached at the root, must be a
+   power of two. Set to 0 to build every header from the node table. */
+#ifdef RPL_NS_CONF_SRH_CACHE_SIZE
+#define RPL_NS_SRH_CACHE_SIZE RPL_NS_CONF_SRH_CACHE_SIZE
+#else /* RPL_NS_CONF_SRH_CACHE_SIZE */
+#define RPL_NS_SRH_CACHE_SIZE 16
+#endif /* RPL_NS_CONF_SRH_CACHE_SIZE */
+
+/* Longer headers are not cached */
+#ifdef RPL_NS_CONF_SRH_CACHE_MAX_LEN
+#define RPL_NS_SRH_CACHE_MAX_LEN RPL_NS_CONF_SRH_CACHE_MAX_LEN
+#else /* RPL_NS_CONF_SRH_CACHE_MAX_LEN */
+#define RPL_NS_SRH_CACHE_MAX_LEN 128
+#endif /* RPL_NS_CONF_SRH_CACHE_MAX_LEN */
+
+/* Nodes refer to each other by index in the node storage */
+typedef uint32_t rpl_ns_index_t;
+#define RPL_NS_NODE_NONE 0xffffffffUL
+
+#define RPL_NS_NODE_ROOT      0x01
+#define RPL_NS_NODE_REACHABLE 0x02
+
 typedef struct rpl_ns_node {
-  struct rpl_ns_node *next;
   uint32_t lifetime;
-  rpl_dag_t *dag;
+  struct rpl_lifetime_timer timer;
+  rpl_ns_index_t next;
+  rpl_ns_index_t prev;
+  rpl_ns_index_t hash_next;
+  rpl_ns_index_t parent;
+  /* Children of this node, linked through next_sibling/prev_sibling */
+  rpl_ns_index_t first_child;
+  rpl_ns_index_t next_sibling;
+  rpl_ns_index_t prev_sibling;
+  /* Number of nodes using this node as parent */
+  uint16_t num_children;
+  /* Hops to the root, valid when RPL_NS_NODE_REACHABLE is set */
+  uint16_t depth;
+  /* Position of the node's DAG in the RPL instance table */
+  uint8_t dag;
+  uint8_t flags;
   /* Store only IPv6 link identifiers as all nodes in the DAG share the same prefix */
   unsigned char link_identifier[8];
-  struct rpl_ns_node *parent;
 } rpl_ns_node_t;
 
+typedef struct rpl_ns_memory {
+  uint32_t num_nodes;
+  uint32_t capacity;
+  /* Node records plus hash and chunk tables, in bytes */
+  uint32_t bytes;
+  uint16_t node_size;
+} rpl_ns_memory_t;
+
 int rpl_ns_num_nodes(void);
 void rpl_ns_expire_parent(rpl_dag_t *dag, const uip_ipaddr_t *child, const uip_ipaddr_t *parent);
 rpl_ns_node_t *rpl_ns_update_node(rpl_dag_t *dag, const uip_ipaddr_t *child, const uip_ipaddr_t *parent, uint32_t lifetime);
@@ -65,8 +138,10 @@ void rpl_ns_init(void);
 rpl_ns_node_t *rpl_ns_node_head(void);
 rpl_ns_node_t *rpl_ns_node_next(rpl_ns_node_t *item);
 rpl_ns_node_t *rpl_ns_get_node(const rpl_dag_t *dag, const uip_ipaddr_t *addr);
+rpl_ns_node_t *rpl_ns_node_parent(const rpl_ns_node_t *node);
 int rpl_ns_is_node_reachable(const rpl_dag_t *dag, const uip_ipaddr_t *addr);
 void rpl_ns_get_node_global_addr(uip_ipaddr_t *addr, rpl_ns_node_t *node);
-void rpl_ns_periodic(void);
+uint32_t rpl_ns_generation(void);
+void rpl_ns_memory_usage(rpl_ns_memory_t *usage);
 
 #endif /* RPL_NS_H */
@@ -46,6 +46,8 @@
 #include "net/ipv6/uip-ds6.h"
 #include "net/ipv6/uip-ds6-route.h"
 #include "net/rpl/rpl-ns.h"
+#include "net/rpl/rpl-counters.h"
+#include "net/rpl/rpl-trace.h"
 #include "net/ipv6/multicast/uip-mcast6.h"
 
 /*---------------------------------------------------------------------------*/
@@ -95,6 +97,11 @@
 #define RPL_OPTION_PREFIX_INFO           8
 #define RPL_OPTION_TARGET_DESC           9
 
+/* Solicited Information option flags: predicates present */
+#define RPL_DIS_SOLICITED_V_FLAG         0x80 /* Version */
+#define RPL_DIS_SOLICITED_I_FLAG         0x40 /* Instance ID */
+#define RPL_DIS_SOLICITED_D_FLAG         0x20 /* DODAG ID */
+
 #define RPL_DAO_K_FLAG                   0x80 /* DAO ACK requested */
 #define RPL_DAO_D_FLAG                   0x40 /* DODAG ID present */
 
@@ -105,6 +112,9 @@
 
 #define RPL_DAO_ACK_TIMEOUT              -1
 
+#define RPL_DCO_ACK_UNCONDITIONAL_ACCEPT 0
+#define RPL_DCO_ACK_NO_ROUTE             234 /* no route for any target */
+
 /*---------------------------------------------------------------------------*/
 /* RPL IPv6 extension header option. */
 #define RPL_HDR_OPT_LEN			4
@@ -147,6 +157,54 @@
 #define RPL_DAO_RETRANSMISSION_TIMEOUT  (5 * CLOCK_SECOND)
 #endif /* RPL_CONF_DAO_RETRANSMISSION_TIMEOUT */
 
+/* DCOs towards the same next hop are collected for RPL_DCO_BATCH_DELAY
+   and sent as one message carrying up to RPL_DCO_MAX_TARGETS targets */
+#ifdef RPL_CONF_DCO_BATCH_DELAY
+#define RPL_DCO_BATCH_DELAY RPL_CONF_DCO_BATCH_DELAY
+#else
+#define RPL_DCO_BATCH_DELAY             (CLOCK_SECOND / 8)
+#endif /* RPL_CONF_DCO_BATCH_DELAY */
+
+#ifdef RPL_CONF_DCO_MAX_TARGETS
+#define RPL_DCO_MAX_TARGETS RPL_CONF_DCO_MAX_TARGETS
+#else
+#define RPL_DCO_MAX_TARGETS             8
+#endif /* RPL_CONF_DCO_MAX_TARGETS */
+
+/* Number of DCOs that can be batching or waiting for a DCO-ACK */
+#ifdef RPL_CONF_DCO_MAX_PENDING
+#define RPL_DCO_MAX_PENDING RPL_CONF_DCO_MAX_PENDING
+#else
+#define RPL_DCO_MAX_PENDING             8
+#endif /* RPL_CONF_DCO_MAX_PENDING */
+
+#ifdef RPL_CONF_DCO_MAX_RETRANSMISSIONS
+#define RPL_DCO_MAX_RETRANSMISSIONS RPL_CONF_DCO_MAX_RETRANSMISSIONS
+#else
+#define RPL_DCO_MAX_RETRANSMISSIONS     4
+#endif /* RPL_CONF_DCO_MAX_RETRANSMISSIONS */
+
+/* Initial DCO retransmission timeout, used until a DCO-ACK round trip has
+   been measured. Later timeouts follow the smoothed round trip time and are
+   kept within the MIN/MAX bounds. */
+#ifdef RPL_CONF_DCO_RETRANSMISSION_TIMEOUT
+#define RPL_DCO_RETRANSMISSION_TIMEOUT RPL_CONF_DCO_RETRANSMISSION_TIMEOUT
+#else
+#define RPL_DCO_RETRANSMISSION_TIMEOUT  (2 * CLOCK_SECOND)
+#endif /* RPL_CONF_DCO_RETRANSMISSION_TIMEOUT */
+
+#ifdef RPL_CONF_DCO_MIN_RETRANSMISSION_TIMEOUT
+#define RPL_DCO_MIN_RETRANSMISSION_TIMEOUT RPL_CONF_DCO_MIN_RETRANSMISSION_TIMEOUT
+#else
+#define RPL_DCO_MIN_RETRANSMISSION_TIMEOUT  (CLOCK_SECOND / 4)
+#endif /* RPL_CONF_DCO_MIN_RETRANSMISSION_TIMEOUT */
+
+#ifdef RPL_CONF_DCO_MAX_RETRANSMISSION_TIMEOUT
+#define RPL_DCO_MAX_RETRANSMISSION_TIMEOUT RPL_CONF_DCO_MAX_RETRANSMISSION_TIMEOUT
+#else
+#define RPL_DCO_MAX_RETRANSMISSION_TIMEOUT  (16 * CLOCK_SECOND)
+#endif /* RPL_CONF_DCO_MAX_RETRANSMISSION_TIMEOUT */
+
 /* Special value indicating immediate removal. */
 #define RPL_ZERO_LIFETIME               0
 
@@ -310,6 +368,7 @@ struct rpl_dio {
   uint8_t version;
   uint8_t instance_id;
   uint8_t dtsn;
+  uint8_t detached; /* the sender is looking for a new parent */
   uint8_t dag_intdoubl;
   uint8_t dag_intmin;
   uint8_t dag_redund;
@@ -349,6 +408,33 @@ struct rpl_stats {
   uint32_t dco_forwarded;
   uint32_t dco_ignored;
   uint32_t dco_recvd;
+  uint32_t dco_targets_sent;
+  uint32_t dco_retransmits;
+  uint32_t dco_failures;
+  uint32_t dco_acked;
+  uint32_t dco_nacked;
+  uint32_t hbh_cache_hits;
+  uint32_t hbh_cache_misses;
+  uint32_t repair_dio_suppressed;
+  uint32_t repair_reset_suppressed;
+  uint32_t repair_coalesced;
+  uint32_t nbr_evict_dio;
+  uint32_t nbr_evict_dao;
+  uint32_t nbr_evict_dis;
+  uint32_t nbr_evict_unused;
+  uint32_t nbr_evict_parent;
+  uint32_t nbr_admit_refused;
+  uint32_t nbr_relearned;
+  uint32_t dio_resets_filtered;
+  uint32_t dio_resets_throttled;
+  uint32_t probes_sent;
+  uint32_t probes_over_budget;
+  uint32_t probes_hopeless;
+  uint32_t dis_filtered;
+  uint32_t detaches;
+  uint32_t bounded_repairs;
+  uint32_t root_syncs;
+  uint32_t root_takeovers;
 };
 typedef struct rpl_stats rpl_stats_t;
 
@@ -364,6 +450,31 @@ extern rpl_stats_t rpl_stats;
 #else
 #define RPL_STAT(code)
 #endif /* RPL_CONF_STATS */
+
+/*
+ * Orders the stores to memory that collectors read while we write it,
+ * see rpl_map_shared(). There is a single writer, so this is enough.
+ */
+#ifdef __GNUC__
+#define RPL_SHARED_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define RPL_SHARED_BARRIER()
+#endif
+
+/* Always-on control plane counters, see rpl-counters.h */
+extern struct rpl_counters *rpl_counters;
+#define RPL_COUNT(field) (rpl_counters->field++)
+
+/* Tracepoints, see rpl-trace.h */
+#if RPL_TRACE
+#define RPL_TRACE_EVENT(event, a, b, c) rpl_trace((event), (a), (b), (c))
+#else
+#define RPL_TRACE_EVENT(event, a, b, c)
+#endif /* RPL_TRACE */
+/* The last four bytes of an address, enough to tell the nodes apart */
+#define RPL_TRACE_ADDR(addr) ((addr) == NULL ? 0 :             \
+    (uint32_t)(addr)->u8[12] << 24 | (uint32_t)(addr)->u8[13] << 16 | \
+    (uint32_t)(addr)->u8[14] << 8 | (addr)->u8[15])
 /*---------------------------------------------------------------------------*/
 /* Instances */
 extern rpl_instance_t instance_table[];
@@ -372,11 +483,19 @@ extern uint8_t path_sequence;
 
 /* ICMPv6 functions for RPL. */
 void dis_output(uip_ipaddr_t *addr);
+void dis_output_solicited(uip_ipaddr_t *addr, uint8_t instance_id,
+                          const uip_ipaddr_t *dag_id);
 void dio_output(rpl_instance_t *, uip_ipaddr_t *uc_addr);
 void dao_output(rpl_parent_t *, uint8_t lifetime);
 void dao_output_target(rpl_parent_t *, uip_ipaddr_t *, uint8_t lifetime);
 void dao_ack_output(rpl_instance_t *, uip_ipaddr_t *, uint8_t, uint8_t);
+void dco_output(rpl_instance_t *, uip_ipaddr_t *target, uip_ipaddr_t *dest,
+                uint8_t path_sequence);
+void dco_ack_output(rpl_instance_t *, uip_ipaddr_t *, uint8_t, uint8_t);
+void rpl_icmp6_dco_flush(rpl_instance_t *);
 void rpl_icmp6_register_handlers(void);
+uint8_t rpl_icmp6_dao_sequence(void);
+void rpl_icmp6_set_dao_sequence(uint8_t sequence);
 uip_ds6_nbr_t *rpl_icmp6_update_nbr_table(uip_ipaddr_t *from,
                                           nbr_table_reason_t r, void *data);
 
@@ -392,7 +511,8 @@ rpl_dag_t *rpl_alloc_dag(uint8_t, uip_ipaddr_t *);
 rpl_instance_t *rpl_alloc_instance(uint8_t);
 void rpl_free_dag(rpl_dag_t *);
 void rpl_free_instance(rpl_instance_t *);
-void rpl_purge_dags(void);
+void rpl_schedule_dag_expiry(rpl_dag_t *dag);
+void rpl_cancel_dag_expiry(rpl_dag_t *dag);
 
 /* DAG parent management function. */
 rpl_parent_t *rpl_add_parent(rpl_dag_t *, rpl_dio_t *dio, uip_ipaddr_t *);
@@ -404,13 +524,17 @@ void rpl_move_parent(rpl_dag_t *dag_src, rpl_dag_t *dag_dst, rpl_parent_t *paren
 rpl_parent_t *rpl_select_parent(rpl_dag_t *dag);
 rpl_dag_t *rpl_select_dag(rpl_instance_t *instance,rpl_parent_t *parent);
 void rpl_recalculate_ranks(void);
+void rpl_queue_parent_update(rpl_parent_t *p);
 
 /* RPL routing table functions. */
 void rpl_remove_routes(rpl_dag_t *dag);
 void rpl_remove_routes_by_nexthop(uip_ipaddr_t *nexthop, rpl_dag_t *dag);
 uip_ds6_route_t *rpl_add_route(rpl_dag_t *dag, uip_ipaddr_t *prefix,
                                int prefix_len, uip_ipaddr_t *next_hop);
-void rpl_purge_routes(void);
+void rpl_set_route_lifetime(uip_ds6_route_t *r, uint32_t lifetime);
+#if RPL_WITH_MULTICAST
+void rpl_set_mcast_route_lifetime(uip_mcast6_route_t *r, uint32_t lifetime);
+#endif
 
 /* Objective function. */
 rpl_of_t *rpl_find_of(rpl_ocp_t);
@@ -419,11 +543,79 @@ rpl_of_t *rpl_find_of(rpl_ocp_t);
 void rpl_schedule_dao(rpl_instance_t *);
 void rpl_schedule_dao_immediately(rpl_instance_t *);
 void rpl_schedule_unicast_dio_immediately(rpl_instance_t *instance);
+void rpl_schedule_loop_repair(rpl_instance_t *instance, rpl_parent_t *sender);
+void rpl_request_loop_repair_reset(rpl_instance_t *instance);
 void rpl_cancel_dao(rpl_instance_t *instance);
 void rpl_schedule_probing(rpl_instance_t *instance);
 
 void rpl_reset_dio_timer(rpl_instance_t *);
+void rpl_schedule_rank_recalculation(void);
+
+/*
+ * Lifetimes of DAGs, routes and NS nodes are stored as the clock_seconds()
+ * value at which they expire, RPL_ROUTE_INFINITE_LIFETIME for never, and
+ * expire through a lifetime timer.
+ */
+uint32_t rpl_lifetime_to_expiry(uint32_t lifetime);
+uint32_t rpl_lifetime_remaining(uint32_t expiry);
+
+/*
+ * Users of the lifetime wheel. A user keeps its timers in a table of its
+ * own, below RPL_LIFETIME_MAX_INDEX entries, and the wheel knows a timer by
+ * the user and its index in that table only.
+ */
+#define RPL_LIFETIME_ROUTE     0
+#define RPL_LIFETIME_DAG       1
+#define RPL_LIFETIME_NS        2
+#define RPL_LIFETIME_NUM_USERS 3
+
+#define RPL_LIFETIME_MAX_INDEX 0x1000000UL
+
+typedef struct rpl_lifetime_user {
+  /* The timer at an index of the table */
+  struct rpl_lifetime_timer *(*timer)(uint32_t index);
+  /* Called once the timer at an index expires */
+  void (*expired)(uint32_t index);
+} rpl_lifetime_user_t;
+
+void rpl_lifetime_register(uint8_t user, const rpl_lifetime_user_t *u);
+void rpl_lifetime_timer_set(uint8_t user, uint32_t index, uint32_t expiry);
+void rpl_lifetime_timer_stop(uint8_t user, uint32_t index);
+void rpl_reset_dio_timer_on_change(rpl_instance_t *instance, rpl_rank_t old_rank,
+                                   rpl_rank_t new_rank, int parent_changed);
 void rpl_reset_periodic_timer(void);
+void rpl_joined_dag(rpl_dag_t *dag);
+void rpl_lost_dag(void);
+
+/* Warm start from a snapshot of the RPL state, see RPL_SNAPSHOT */
+void rpl_snapshot_save(void);
+void rpl_snapshot_confirm(rpl_dag_t *dag);
+
+/* Control plane counters */
+void rpl_counters_init(void);
+void rpl_counters_input(uint8_t code);
+void rpl_counters_output(uint8_t code, uip_ipaddr_t *dest, uint16_t len);
+void *rpl_map_shared(const char *path_format, size_t size);
+
+/* Tracepoints */
+void rpl_trace_init(void);
+void rpl_trace(uint16_t event, uint16_t a, uint32_t b, uint32_t c);
+uint32_t rpl_trace_parent(rpl_parent_t *p);
+
+/* Outcome of the DIO transmission of a Trickle interval. */
+#define RPL_DIO_OUTCOME_NONE       0
+#define RPL_DIO_OUTCOME_SENT       1
+#define RPL_DIO_OUTCOME_SUPPRESSED 2
+
+/* Extension header lookup caches. */
+void rpl_ext_header_init(void);
+void rpl_ext_header_flush_parent_cache(void);
+
+/* Neighbor policy accounting. */
+void rpl_nbr_policy_init(void);
+void rpl_nbr_policy_parent_added(rpl_parent_t *parent);
+void rpl_nbr_policy_parent_removed(rpl_parent_t *parent);
+void rpl_nbr_policy_parent_updated(rpl_parent_t *parent);
 
 /* Route poisoning. */
 void rpl_poison_routes(rpl_dag_t *, rpl_parent_t *);
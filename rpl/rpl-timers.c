@@ -57,6 +57,12 @@
 void RPL_CALLBACK_NEW_DIO_INTERVAL(uint8_t dio_interval);
 #endif /* RPL_CALLBACK_NEW_DIO_INTERVAL */
 
+/* A configurable function called with the DIO counts of each ended interval */
+#ifdef RPL_CALLBACK_DIO_INTERVAL_STATS
+void RPL_CALLBACK_DIO_INTERVAL_STATS(rpl_instance_t *instance, uint8_t sent,
+                                     uint8_t heard, uint8_t suppressed);
+#endif /* RPL_CALLBACK_DIO_INTERVAL_STATS */
+
 #ifdef RPL_PROBING_SELECT_FUNC
 rpl_parent_t *RPL_PROBING_SELECT_FUNC(rpl_dag_t *dag);
 #endif /* RPL_PROBING_SELECT_FUNC */
@@ -67,68 +73,558 @@ clock_time_t RPL_PROBING_DELAY_FUNC(rpl_dag_t *dag);
 
 /*---------------------------------------------------------------------------*/
 static struct ctimer periodic_timer;
+static struct ctimer rank_timer;
+static struct ctimer wheel_timer;
 
 static void handle_periodic_timer(void *ptr);
 static void new_dio_interval(rpl_instance_t *instance);
 static void handle_dio_timer(void *ptr);
 
+/* Fast join only applies to nodes that send DIS */
+#define DIS_FAST_JOIN (RPL_DIS_SEND && RPL_DIS_FAST_JOIN)
+
+#if !DIS_FAST_JOIN
 static uint16_t next_dis;
+#endif /* !DIS_FAST_JOIN */
 
 /* dio_send_ok is true if the node is ready to send DIOs */
 static uint8_t dio_send_ok;
 
 extern uint8_t rpl_leaf;
 
+/* Start of the current search for a DAG, while joining is set */
+static clock_time_t join_start;
+static uint8_t joining;
+
+#if DIS_FAST_JOIN
+/* Upper bound of the next fast join DIS delay, in milliseconds */
+static uint32_t dis_backoff;
+
+static clock_time_t ms_to_ticks(uint32_t ms);
+#endif /* DIS_FAST_JOIN */
+
+/*---------------------------------------------------------------------------*/
+#if DIS_FAST_JOIN
+/* Picks the delay of the next DIS in [backoff/2, backoff) and doubles the
+   backoff, up to RPL_DIS_INTERVAL. */
+static clock_time_t
+next_fast_join_delay(void)
+{
+  uint32_t delay;
+
+  delay = dis_backoff / 2 +
+    (uint32_t)(((uint64_t)dis_backoff / 2 * random_rand()) / RANDOM_RAND_MAX);
+  if(dis_backoff < (uint32_t)RPL_DIS_INTERVAL * 1000 / 2) {
+    dis_backoff *= 2;
+  } else {
+    dis_backoff = (uint32_t)RPL_DIS_INTERVAL * 1000;
+  }
+  return ms_to_ticks(delay);
+}
+#endif /* DIS_FAST_JOIN */
 /*---------------------------------------------------------------------------*/
 static void
 handle_periodic_timer(void *ptr)
 {
-  rpl_dag_t *dag = rpl_get_any_dag();
+#if RPL_DIS_SEND
+  clock_time_t delay = RPL_DIS_INTERVAL * CLOCK_SECOND;
+#endif /* RPL_DIS_SEND */
 
-  rpl_purge_dags();
-  if(dag != NULL) {
-    if(RPL_IS_STORING(dag->instance)) {
-      rpl_purge_routes();
-    }
-    if(RPL_IS_NON_STORING(dag->instance)) {
-      rpl_ns_periodic();
-    }
+  if(rpl_get_any_dag() == NULL) {
+    /* In case the last DAG went without a call to rpl_lost_dag() */
+    rpl_lost_dag();
   }
-  rpl_recalculate_ranks();
 
-  /* handle DIS */
+  if(joining) {
+    /* handle DIS */
 #if RPL_DIS_SEND
-  next_dis++;
-  if(dag == NULL && next_dis >= RPL_DIS_INTERVAL) {
-    next_dis = 0;
     dis_output(NULL);
+#if DIS_FAST_JOIN
+    delay = next_fast_join_delay();
+#endif /* DIS_FAST_JOIN */
+#endif /* RPL_DIS_SEND */
   }
-#endif
-  ctimer_reset(&periodic_timer);
+#if RPL_DIS_SEND
+  ctimer_set(&periodic_timer, delay, handle_periodic_timer, NULL);
+#endif /* RPL_DIS_SEND */
+}
+/*---------------------------------------------------------------------------*/
+/* Called when the node drops its last DAG, or its rank in it, to start
+   looking for a DAG right away rather than at the next periodic timer */
+void
+rpl_lost_dag(void)
+{
+  if(joining) {
+    return;
+  }
+  joining = 1;
+  join_start = clock_time();
+#if DIS_FAST_JOIN
+  dis_backoff = RPL_DIS_FAST_JOIN_MIN;
+  ctimer_set(&periodic_timer, next_fast_join_delay(),
+             handle_periodic_timer, NULL);
+#endif /* DIS_FAST_JOIN */
+}
+/*---------------------------------------------------------------------------*/
+/* Called when the node joins a DAG, or gets a parent again in a DAG it
+   had lost its rank in, to account for the time it took. A root ends the
+   search without a join time. */
+void
+rpl_joined_dag(rpl_dag_t *dag)
+{
+  clock_time_t elapsed;
+  int bucket;
+
+  if(!joining) {
+    return;
+  }
+  joining = 0;
+  if(dag->rank == ROOT_RANK(dag->instance)) {
+    return;
+  }
+  elapsed = clock_time() - join_start;
+  for(bucket = 0; bucket < RPL_COUNTER_JOIN_TIME_NUM - 1; bucket++) {
+    if(elapsed < ((clock_time_t)CLOCK_SECOND << bucket) / 2) {
+      break;
+    }
+  }
+  RPL_COUNT(joins);
+  RPL_COUNT(join_time[bucket]);
+  PRINTF("RPL: Joined a DAG after %lu ms\n",
+         (unsigned long)elapsed * 1000 / CLOCK_SECOND);
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_rank_timer(void *ptr)
+{
+  rpl_recalculate_ranks();
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_schedule_rank_recalculation(void)
+{
+  if(ctimer_expired(&rank_timer)) {
+    ctimer_set(&rank_timer, RPL_RANK_RECALC_DELAY, handle_rank_timer, NULL);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Lifetime wheel. Level l has WHEEL_SLOTS slots of WHEEL_SLOTS^l seconds
+ * each; a timer goes to the lowest level whose span covers its expiry and
+ * moves down a level whenever the wheel reaches its slot ("cascade"). The
+ * wheel only wakes up for slots that hold timers, so its cost depends on the
+ * number of expiries and not on the number of timers.
+ *
+ * Slots are lists of timers linked by handle, the user of the timer plus
+ * one in the top 8 bits and its index below; handle 0 ends a list.
+ */
+#define WHEEL_BITS  RPL_LIFETIME_WHEEL_SLOT_BITS
+#define WHEEL_SLOTS (1UL << WHEEL_BITS)
+#define WHEEL_MASK  (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN  (1UL << (WHEEL_BITS * RPL_LIFETIME_WHEEL_LEVELS))
+
+#define WHEEL_HANDLE(user, index) ((((uint32_t)(user) + 1) << 24) | (index))
+#define WHEEL_USER(handle)        (((handle) >> 24) - 1)
+#define WHEEL_INDEX(handle)       ((handle) & (RPL_LIFETIME_MAX_INDEX - 1))
+
+/* Slot of the timers taken out of a wheel slot for processing */
+#define WHEEL_TAKEN (RPL_LIFETIME_WHEEL_LEVELS * WHEEL_SLOTS + 1)
+
+static uint32_t wheel[RPL_LIFETIME_WHEEL_LEVELS][WHEEL_SLOTS];
+static uint32_t wheel_count[RPL_LIFETIME_WHEEL_LEVELS];
+static uint32_t wheel_taken;
+static const rpl_lifetime_user_t *wheel_users[RPL_LIFETIME_NUM_USERS];
+/* Next second the wheel has to process */
+static uint32_t wheel_next;
+/* Second at which wheel_timer fires, when set */
+static uint32_t wheel_wakeup;
+
+static void wheel_add(uint32_t handle, struct rpl_lifetime_timer *t);
+static void handle_wheel_timer(void *ptr);
+/*---------------------------------------------------------------------------*/
+static struct rpl_lifetime_timer *
+wheel_timer_at(uint32_t handle)
+{
+  return wheel_users[WHEEL_USER(handle)]->timer(WHEEL_INDEX(handle));
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t *
+wheel_head(uint16_t slot)
+{
+  if(slot == WHEEL_TAKEN) {
+    return &wheel_taken;
+  }
+  return &wheel[(slot - 1) >> WHEEL_BITS][(slot - 1) & WHEEL_MASK];
+}
+/*---------------------------------------------------------------------------*/
+static void
+wheel_unlink(struct rpl_lifetime_timer *t)
+{
+  if(t->next != 0) {
+    wheel_timer_at(t->next)->prev = t->prev;
+  }
+  if(t->prev != 0) {
+    wheel_timer_at(t->prev)->next = t->next;
+  } else {
+    *wheel_head(t->slot) = t->next;
+  }
+  t->next = 0;
+  t->prev = 0;
+  t->slot = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+wheel_insert(uint16_t slot, uint32_t handle, struct rpl_lifetime_timer *t)
+{
+  uint32_t *head = wheel_head(slot);
+
+  t->next = *head;
+  if(t->next != 0) {
+    wheel_timer_at(t->next)->prev = handle;
+  }
+  t->prev = 0;
+  t->slot = slot;
+  *head = handle;
+}
+/*---------------------------------------------------------------------------*/
+static void
+wheel_remove(struct rpl_lifetime_timer *t)
+{
+  if(t->slot != 0) {
+    if(t->slot != WHEEL_TAKEN) {
+      wheel_count[(t->slot - 1) >> WHEEL_BITS]--;
+    }
+    wheel_unlink(t);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Empties a slot into wheel_taken, where the callbacks can safely modify it */
+static void
+wheel_take_slot(unsigned level, unsigned slot)
+{
+  struct rpl_lifetime_timer *t;
+  uint32_t handle;
+
+  wheel_taken = wheel[level][slot];
+  wheel[level][slot] = 0;
+  for(handle = wheel_taken; handle != 0; handle = t->next) {
+    t = wheel_timer_at(handle);
+    t->slot = WHEEL_TAKEN;
+    wheel_count[level]--;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+wheel_is_empty(void)
+{
+  unsigned level;
+
+  if(wheel_taken != 0) {
+    return 0;
+  }
+  for(level = 0; level < RPL_LIFETIME_WHEEL_LEVELS; level++) {
+    if(wheel_count[level] > 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* The earliest second at which a slot needs to be processed */
+static uint32_t
+wheel_next_event(void)
+{
+  uint32_t event = wheel_next + WHEEL_SPAN;
+  uint32_t unit;
+  uint32_t when;
+  unsigned level;
+  unsigned i;
+
+  for(level = 0; level < RPL_LIFETIME_WHEEL_LEVELS; level++) {
+    if(wheel_count[level] == 0) {
+      continue;
+    }
+    for(i = 0; i < WHEEL_SLOTS; i++) {
+      unit = (wheel_next >> (WHEEL_BITS * level)) + i;
+      if(wheel[level][unit & WHEEL_MASK] != 0) {
+        when = unit << (WHEEL_BITS * level);
+        if((int32_t)(when - wheel_next) < 0) {
+          /* The current slot of an upper level was cascaded already */
+          when = (unit + WHEEL_SLOTS) << (WHEEL_BITS * level);
+        }
+        if((int32_t)(when - event) < 0) {
+          event = when;
+        }
+      }
+    }
+  }
+  return event;
+}
+/*---------------------------------------------------------------------------*/
+static void
+wheel_arm(uint32_t when)
+{
+  uint32_t now = (uint32_t)clock_seconds();
+  uint32_t delay;
+
+  if(!ctimer_expired(&wheel_timer) && (int32_t)(wheel_wakeup - when) <= 0) {
+    return;
+  }
+  delay = (int32_t)(when - now) > 0 ? when - now : 1;
+  wheel_wakeup = now + delay;
+  ctimer_set(&wheel_timer, (clock_time_t)delay * CLOCK_SECOND,
+             handle_wheel_timer, NULL);
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_wheel_timer(void *ptr)
+{
+  struct rpl_lifetime_timer *t;
+  uint32_t now = (uint32_t)clock_seconds();
+  uint32_t handle;
+  uint32_t second;
+  uint32_t event;
+  int level;
+
+  while((int32_t)(now - wheel_next) >= 0) {
+    second = wheel_next;
+    for(level = RPL_LIFETIME_WHEEL_LEVELS - 1; level > 0; level--) {
+      if((second & ((1UL << (WHEEL_BITS * level)) - 1)) == 0 &&
+         wheel_count[level] > 0) {
+        wheel_take_slot(level, (second >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        while((handle = wheel_taken) != 0) {
+          t = wheel_timer_at(handle);
+          wheel_unlink(t);
+          wheel_add(handle, t);
+        }
+      }
+    }
+
+    wheel_take_slot(0, second & WHEEL_MASK);
+    /* Timers the callbacks set for this second or earlier go to the next */
+    wheel_next = second + 1;
+    while((handle = wheel_taken) != 0) {
+      t = wheel_timer_at(handle);
+      wheel_unlink(t);
+      if((int32_t)(t->expiry - second) > 0) {
+        /* Parked beyond the span of the wheel */
+        wheel_add(handle, t);
+      } else {
+        wheel_users[WHEEL_USER(handle)]->expired(WHEEL_INDEX(handle));
+      }
+    }
+
+    /* Skip the seconds with nothing to do */
+    event = wheel_next_event();
+    if((int32_t)(event - wheel_next) > 0) {
+      wheel_next = (int32_t)(event - now) > 0 ? now + 1 : event;
+    }
+  }
+
+  event = wheel_next_event();
+  if(event != wheel_next + WHEEL_SPAN) {
+    wheel_arm(event);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+wheel_add(uint32_t handle, struct rpl_lifetime_timer *t)
+{
+  uint32_t delta;
+  uint32_t expiry;
+  unsigned level;
+
+  expiry = t->expiry;
+  if((int32_t)(expiry - wheel_next) < 0) {
+    expiry = wheel_next;
+  }
+  delta = expiry - wheel_next;
+  if(delta >= WHEEL_SPAN) {
+    delta = WHEEL_SPAN - 1;
+    expiry = wheel_next + delta;
+  }
+  for(level = 0; level < RPL_LIFETIME_WHEEL_LEVELS - 1; level++) {
+    if(delta < (1UL << (WHEEL_BITS * (level + 1)))) {
+      break;
+    }
+  }
+  wheel_insert(level * WHEEL_SLOTS +
+               ((expiry >> (WHEEL_BITS * level)) & WHEEL_MASK) + 1, handle, t);
+  wheel_count[level]++;
+}
+/*---------------------------------------------------------------------------*/
+/* Sets the timer table and the expiry callback of a user of the wheel */
+void
+rpl_lifetime_register(uint8_t user, const rpl_lifetime_user_t *u)
+{
+  wheel_users[user] = u;
+}
+/*---------------------------------------------------------------------------*/
+/* Calls the expiry callback of the user on index once clock_seconds()
+   reaches expiry. Setting a running timer again moves it, in constant time. */
+void
+rpl_lifetime_timer_set(uint8_t user, uint32_t index, uint32_t expiry)
+{
+  struct rpl_lifetime_timer *t = wheel_users[user]->timer(index);
+
+  wheel_remove(t);
+  if(expiry == RPL_ROUTE_INFINITE_LIFETIME) {
+    return;
+  }
+  if(wheel_is_empty()) {
+    /* Nothing to process before now, don't cascade from an old second */
+    wheel_next = (uint32_t)clock_seconds();
+  }
+  t->expiry = expiry;
+  wheel_add(WHEEL_HANDLE(user, index), t);
+  /* The wheel is processed up to the current second whenever it runs */
+  wheel_arm(expiry);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_lifetime_timer_stop(uint8_t user, uint32_t index)
+{
+  wheel_remove(wheel_users[user]->timer(index));
+}
+/*---------------------------------------------------------------------------*/
+uint32_t
+rpl_lifetime_to_expiry(uint32_t lifetime)
+{
+  if(lifetime == RPL_ROUTE_INFINITE_LIFETIME) {
+    return lifetime;
+  }
+  return (uint32_t)clock_seconds() + lifetime;
+}
+/*---------------------------------------------------------------------------*/
+uint32_t
+rpl_lifetime_remaining(uint32_t expiry)
+{
+  int32_t remaining;
+
+  if(expiry == RPL_ROUTE_INFINITE_LIFETIME) {
+    return expiry;
+  }
+  remaining = (int32_t)(expiry - (uint32_t)clock_seconds());
+  return remaining > 0 ? remaining : 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Convert from milliseconds to CLOCK_TICKS, rounding to the nearest tick. */
+static clock_time_t
+ms_to_ticks(uint32_t ms)
+{
+  clock_time_t ticks;
+
+  ticks = ((uint64_t)ms * CLOCK_SECOND + 500) / 1000;
+  return ticks > 0 ? ticks : 1;
+}
+/*---------------------------------------------------------------------------*/
+#if RPL_TRICKLE_ADAPTIVE
+static void
+update_adaptive_redundancy(rpl_instance_t *instance)
+{
+  rpl_parent_t *p;
+  unsigned neighbors;
+  unsigned consistent;
+  unsigned k;
+
+  neighbors = 0;
+  for(p = nbr_table_head(rpl_parents); p != NULL;
+      p = nbr_table_next(rpl_parents, p)) {
+    if(p->dag != NULL && p->dag->instance == instance) {
+      neighbors++;
+    }
+  }
+
+  /* Fold the consistent share of the ended interval into the average */
+  if(instance->dio_heard > 0) {
+    consistent = instance->dio_counter < instance->dio_heard ?
+      instance->dio_counter : instance->dio_heard;
+    consistent = (100 * consistent) / instance->dio_heard;
+    instance->dio_consistency = (3 * instance->dio_consistency + consistent) / 4;
+  }
+
+  if(neighbors <= RPL_TRICKLE_ADAPTIVE_SPARSE) {
+    /* Few listeners may depend on our DIO alone: never suppress it */
+    k = 0;
+  } else {
+    k = (RPL_TRICKLE_ADAPTIVE_K_MAX * RPL_TRICKLE_ADAPTIVE_SPARSE) / neighbors;
+    if(instance->dio_consistency < RPL_TRICKLE_ADAPTIVE_CONSISTENT) {
+      /* The neighborhood disagrees, let more DIOs through to converge */
+      k *= 2;
+    }
+    if(k < RPL_TRICKLE_ADAPTIVE_K_MIN) {
+      k = RPL_TRICKLE_ADAPTIVE_K_MIN;
+    } else if(k > RPL_TRICKLE_ADAPTIVE_K_MAX) {
+      k = RPL_TRICKLE_ADAPTIVE_K_MAX;
+    }
+  }
+
+  if(k != instance->dio_adaptive_k) {
+    PRINTF("RPL: Adaptive DIO redundancy %u (%u neighbors, %u%% consistent)\n",
+           k, neighbors, instance->dio_consistency);
+  }
+  instance->dio_adaptive_k = k;
+}
+#endif /* RPL_TRICKLE_ADAPTIVE */
+/*---------------------------------------------------------------------------*/
+static uint8_t
+dio_redundancy(rpl_instance_t *instance)
+{
+#if RPL_TRICKLE_ADAPTIVE
+  return instance->dio_adaptive_k;
+#else /* RPL_TRICKLE_ADAPTIVE */
+  return instance->dio_redundancy;
+#endif /* RPL_TRICKLE_ADAPTIVE */
 }
 /*---------------------------------------------------------------------------*/
 static void
 new_dio_interval(rpl_instance_t *instance)
 {
   uint32_t time;
+  uint32_t offset;
   clock_time_t ticks;
 
-  /* TODO: too small timer intervals for many cases */
-  time = 1UL << instance->dio_intcurrent;
+  PRINTF("RPL: DIO interval ended: sent %u, heard %u, suppressed %u\n",
+         instance->dio_outcome == RPL_DIO_OUTCOME_SENT, instance->dio_heard,
+         instance->dio_outcome == RPL_DIO_OUTCOME_SUPPRESSED);
+#ifdef RPL_CALLBACK_DIO_INTERVAL_STATS
+  RPL_CALLBACK_DIO_INTERVAL_STATS(instance,
+                                  instance->dio_outcome == RPL_DIO_OUTCOME_SENT,
+                                  instance->dio_heard,
+                                  instance->dio_outcome == RPL_DIO_OUTCOME_SUPPRESSED);
+#endif /* RPL_CALLBACK_DIO_INTERVAL_STATS */
+  RPL_COUNT(dio_intervals);
+  if(instance->dio_outcome == RPL_DIO_OUTCOME_SENT) {
+    RPL_COUNT(dio_intervals_sent);
+  } else if(instance->dio_outcome == RPL_DIO_OUTCOME_SUPPRESSED) {
+    RPL_COUNT(dio_intervals_suppressed);
+  }
+#if RPL_TRICKLE_ADAPTIVE
+  update_adaptive_redundancy(instance);
+#endif /* RPL_TRICKLE_ADAPTIVE */
 
-  /* Convert from milliseconds to CLOCK_TICKS. */
-  ticks = (time * CLOCK_SECOND) / 1000;
-  instance->dio_next_delay = ticks;
+  /*
+   * Pick the transmission point between I/2 and I in milliseconds and
+   * only then convert to clock ticks, so that small Imin values keep
+   * their resolution instead of being truncated to whole ticks.
+   */
+  time = 1UL << instance->dio_intcurrent;
+  offset = time / 2 +
+    (uint32_t)(((uint64_t)(time / 2) * random_rand()) / RANDOM_RAND_MAX);
 
-  /* random number between I/2 and I */
-  ticks = ticks / 2 + (ticks / 2 * (uint32_t)random_rand()) / RANDOM_RAND_MAX;
+  ticks = ms_to_ticks(offset);
+  instance->dio_next_delay = ms_to_ticks(time);
 
   /*
    * The intervals must be equally long among the nodes for Trickle to
    * operate efficiently. Therefore we need to calculate the delay between
    * the randomized time and the start time of the next interval.
    */
-  instance->dio_next_delay -= ticks;
+  if(instance->dio_next_delay > ticks) {
+    instance->dio_next_delay -= ticks;
+  } else {
+    instance->dio_next_delay = 1;
+  }
   instance->dio_send = 1;
 
 #if RPL_CONF_STATS
@@ -146,6 +642,8 @@ new_dio_interval(rpl_instance_t *instance)
 
   /* reset the redundancy counter */
   instance->dio_counter = 0;
+  instance->dio_heard = 0;
+  instance->dio_outcome = RPL_DIO_OUTCOME_NONE;
 
   /* schedule the timer */
   PRINTF("RPL: Scheduling DIO timer %lu ticks in future (Interval)\n", ticks);
@@ -176,14 +674,20 @@ handle_dio_timer(void *ptr)
 
   if(instance->dio_send) {
     /* send DIO if counter is less than desired redundancy */
-    if(instance->dio_redundancy == 0 || instance->dio_counter < instance->dio_redundancy) {
+    if(dio_redundancy(instance) == 0 ||
+       instance->dio_counter < dio_redundancy(instance)) {
 #if RPL_CONF_STATS
       instance->dio_totsend++;
 #endif /* RPL_CONF_STATS */
+      instance->dio_outcome = RPL_DIO_OUTCOME_SENT;
       dio_output(instance, NULL);
     } else {
+#if RPL_CONF_STATS
+      instance->dio_totsupp++;
+#endif /* RPL_CONF_STATS */
+      instance->dio_outcome = RPL_DIO_OUTCOME_SUPPRESSED;
       PRINTF("RPL: Suppressing DIO transmission (%d >= %d)\n",
-             instance->dio_counter, instance->dio_redundancy);
+             instance->dio_counter, dio_redundancy(instance));
     }
     instance->dio_send = 0;
     PRINTF("RPL: Scheduling DIO timer %lu ticks in future (sent)\n",
@@ -206,10 +710,24 @@ handle_dio_timer(void *ptr)
 void
 rpl_reset_periodic_timer(void)
 {
+  joining = 1;
+  join_start = clock_time();
+#if DIS_FAST_JOIN
+  dis_backoff = RPL_DIS_FAST_JOIN_MIN;
+  ctimer_set(&periodic_timer, next_fast_join_delay(),
+             handle_periodic_timer, NULL);
+#else /* DIS_FAST_JOIN */
   next_dis = RPL_DIS_INTERVAL / 2 +
     ((uint32_t)RPL_DIS_INTERVAL * (uint32_t)random_rand()) / RANDOM_RAND_MAX -
     RPL_DIS_START_DELAY;
-  ctimer_set(&periodic_timer, CLOCK_SECOND, handle_periodic_timer, NULL);
+#if RPL_DIS_SEND
+  /* The first DIS goes out once next_dis would have reached the interval */
+  ctimer_set(&periodic_timer,
+             next_dis < RPL_DIS_INTERVAL ?
+             (clock_time_t)(RPL_DIS_INTERVAL - next_dis) * CLOCK_SECOND : CLOCK_SECOND,
+             handle_periodic_timer, NULL);
+#endif /* RPL_DIS_SEND */
+#endif /* DIS_FAST_JOIN */
 }
 /*---------------------------------------------------------------------------*/
 /* Resets the DIO timer in the instance to its minimal interval. */
@@ -222,6 +740,7 @@ rpl_reset_dio_timer(rpl_instance_t *instance)
   if(instance->dio_intcurrent > instance->dio_intmin) {
     instance->dio_counter = 0;
     instance->dio_intcurrent = instance->dio_intmin;
+    instance->dio_reset_time = clock_time();
     new_dio_interval(instance);
   }
 #if RPL_CONF_STATS
@@ -230,6 +749,45 @@ rpl_reset_dio_timer(rpl_instance_t *instance)
 #endif /* RPL_LEAF_ONLY */
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * Resets the DIO timer after a change of our rank or preferred parent,
+ * unless the change is too small to matter to the neighbors or the timer
+ * was reset very recently.
+ */
+void
+rpl_reset_dio_timer_on_change(rpl_instance_t *instance, rpl_rank_t old_rank,
+                              rpl_rank_t new_rank, int parent_changed)
+{
+  rpl_rank_t delta;
+  int significant;
+
+  delta = old_rank > new_rank ? old_rank - new_rank : new_rank - old_rank;
+  if(old_rank == INFINITE_RANK || new_rank == INFINITE_RANK) {
+    significant = 1;
+  } else if(parent_changed && RPL_TRICKLE_RESET_ON_PARENT_SWITCH) {
+    significant = 1;
+  } else {
+    significant = (uint32_t)delta * 100 >=
+      (uint32_t)instance->min_hoprankinc * RPL_TRICKLE_SIGNIFICANT_RANK_DELTA;
+  }
+
+  if(!significant) {
+    PRINTF("RPL: Rank change %u -> %u too small for a DIO timer reset\n",
+           (unsigned)old_rank, (unsigned)new_rank);
+    RPL_STAT(rpl_stats.dio_resets_filtered++);
+    return;
+  }
+
+  if(instance->dio_intcurrent > instance->dio_intmin &&
+     clock_time() - instance->dio_reset_time < RPL_TRICKLE_MIN_RESET_INTERVAL) {
+    PRINTF("RPL: DIO timer reset too soon after the previous one\n");
+    RPL_STAT(rpl_stats.dio_resets_throttled++);
+    return;
+  }
+
+  rpl_reset_dio_timer(instance);
+}
+/*---------------------------------------------------------------------------*/
 static void handle_dao_timer(void *ptr);
 static void
 set_dao_lifetime_timer(rpl_instance_t *instance)
@@ -364,10 +922,25 @@ static void
 handle_unicast_dio_timer(void *ptr)
 {
   rpl_instance_t *instance = (rpl_instance_t *)ptr;
-  uip_ipaddr_t *target_ipaddr = rpl_get_parent_ipaddr(instance->unicast_dio_target);
+  rpl_parent_t *p;
+  uip_ipaddr_t *target_ipaddr;
 
-  if(target_ipaddr != NULL) {
-    dio_output(instance, target_ipaddr);
+  if(instance->unicast_dio_target != NULL) {
+    instance->unicast_dio_target->flags |= RPL_PARENT_FLAG_REPAIR_DIO;
+    instance->unicast_dio_target = NULL;
+  }
+
+  /* Send one DIO to every neighbor that asked for one since the timer
+     was set */
+  for(p = nbr_table_head(rpl_parents); p != NULL; p = nbr_table_next(rpl_parents, p)) {
+    if((p->flags & RPL_PARENT_FLAG_REPAIR_DIO) &&
+       p->dag != NULL && p->dag->instance == instance) {
+      p->flags &= ~RPL_PARENT_FLAG_REPAIR_DIO;
+      target_ipaddr = rpl_get_parent_ipaddr(p);
+      if(target_ipaddr != NULL) {
+        dio_output(instance, target_ipaddr);
+      }
+    }
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -378,96 +951,285 @@ rpl_schedule_unicast_dio_immediately(rpl_instance_t *instance)
                   handle_unicast_dio_timer, instance);
 }
 /*---------------------------------------------------------------------------*/
+static int
+take_token(uint8_t *tokens, clock_time_t *last, clock_time_t interval,
+                  uint8_t burst)
+{
+  clock_time_t now;
+  clock_time_t elapsed;
+
+  now = clock_time();
+  elapsed = now - *last;
+  if(elapsed >= interval) {
+    if(elapsed / interval >= burst - *tokens) {
+      *tokens = burst;
+      *last = now;
+    } else {
+      *tokens += elapsed / interval;
+      *last += (elapsed / interval) * interval;
+    }
+  }
+
+  if(*tokens == 0) {
+    return 0;
+  }
+  (*tokens)--;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_schedule_loop_repair(rpl_instance_t *instance, rpl_parent_t *sender)
+{
+  if(sender->flags & RPL_PARENT_FLAG_REPAIR_DIO) {
+    /* A DIO to this neighbor is already on its way */
+    RPL_STAT(rpl_stats.repair_coalesced++);
+    return;
+  }
+  if(!take_token(&sender->repair_tokens, &sender->repair_time,
+                        RPL_LOOP_REPAIR_DIO_INTERVAL, RPL_LOOP_REPAIR_DIO_BURST)) {
+    PRINTF("RPL: Loop repair DIO suppressed\n");
+    RPL_STAT(rpl_stats.repair_dio_suppressed++);
+    return;
+  }
+  sender->flags |= RPL_PARENT_FLAG_REPAIR_DIO;
+  if(ctimer_expired(&instance->unicast_dio_timer)) {
+    ctimer_set(&instance->unicast_dio_timer, RPL_LOOP_REPAIR_DELAY,
+               handle_unicast_dio_timer, instance);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_request_loop_repair_reset(rpl_instance_t *instance)
+{
+  if(instance->dio_intcurrent <= instance->dio_intmin) {
+    /* Trickle is already running at Imin, a reset would change nothing */
+    RPL_STAT(rpl_stats.repair_coalesced++);
+    return;
+  }
+  if(!take_token(&instance->repair_tokens, &instance->repair_time,
+                        RPL_LOOP_REPAIR_RESET_INTERVAL, RPL_LOOP_REPAIR_RESET_BURST)) {
+    PRINTF("RPL: Loop repair trickle reset suppressed\n");
+    RPL_STAT(rpl_stats.repair_reset_suppressed++);
+    return;
+  }
+  rpl_reset_dio_timer(instance);
+}
+/*---------------------------------------------------------------------------*/
 #if RPL_WITH_PROBING
+/* Node-wide probing budget */
+static uint8_t probing_tokens = RPL_PROBING_BUDGET;
+static clock_time_t probing_time;
+/*---------------------------------------------------------------------------*/
+/*
+ * Expected benefit of probing a parent: how close it is to beating our
+ * current rank, times how stale its link estimate is. Zero when the link
+ * estimate is fresh or when the parent cannot become preferred even over
+ * a perfect link.
+ */
+static uint32_t
+probing_benefit(rpl_dag_t *dag, rpl_parent_t *p, clock_time_t now)
+{
+  const struct link_stats *stats;
+  rpl_rank_t hoprankinc;
+  int32_t gap;
+  uint32_t closeness;
+  uint32_t staleness;
+
+  if(rpl_parent_is_fresh(p)) {
+    return 0;
+  }
+
+  hoprankinc = dag->instance->min_hoprankinc;
+  if(p != dag->preferred_parent) {
+    if(p->rank == INFINITE_RANK ||
+       (uint32_t)p->rank + hoprankinc >= dag->rank) {
+      /* Counted once, until the parent could win again */
+      if(!(p->flags & RPL_PARENT_FLAG_HOPELESS)) {
+        p->flags |= RPL_PARENT_FLAG_HOPELESS;
+        RPL_STAT(rpl_stats.probes_hopeless++);
+      }
+      return 0;
+    }
+    p->flags &= ~RPL_PARENT_FLAG_HOPELESS;
+    /* Rank gap to what we have now, negative when the parent already wins */
+    gap = (int32_t)rpl_rank_via_parent(p) - dag->rank;
+    if(gap < -(int32_t)hoprankinc) {
+      gap = -(int32_t)hoprankinc;
+    } else if(gap > 2 * (int32_t)hoprankinc) {
+      gap = 2 * hoprankinc;
+    }
+    closeness = 2 * hoprankinc - gap + 1;
+  } else {
+    /* The estimate we rely on most */
+    closeness = 4 * hoprankinc;
+  }
+
+  stats = rpl_get_parent_link_stats(p);
+  if(stats == NULL) {
+    staleness = RPL_PROBING_INTERVAL / CLOCK_SECOND;
+  } else {
+    staleness = (now - stats->last_tx_time) / CLOCK_SECOND;
+    if(staleness > RPL_PROBING_INTERVAL / CLOCK_SECOND) {
+      staleness = RPL_PROBING_INTERVAL / CLOCK_SECOND;
+    }
+  }
+
+  return closeness * (staleness + 1);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * One pass over the parent table, keeping the best candidates in order.
+ * The target and the delay of a probe both ask for a fill; when the
+ * first found no candidate, the second is skipped.
+ */
+static void
+fill_probing_queue(rpl_dag_t *dag)
+{
+  rpl_instance_t *instance = dag->instance;
+  uint32_t benefit[RPL_PROBING_QUEUE_SIZE];
+  clock_time_t now = clock_time();
+  rpl_parent_t *p;
+  uint32_t b;
+  int i;
+
+  instance->probing_queue_len = 0;
+  if(instance->probing_empty_time == now) {
+    return;
+  }
+  for(p = nbr_table_head(rpl_parents); p != NULL;
+      p = nbr_table_next(rpl_parents, p)) {
+    if(p->dag != dag) {
+      continue;
+    }
+    b = probing_benefit(dag, p, now);
+    if(b == 0) {
+      continue;
+    }
+    /* Insertion into the short sorted queue */
+    i = instance->probing_queue_len;
+    if(i == RPL_PROBING_QUEUE_SIZE) {
+      if(b <= benefit[i - 1]) {
+        continue;
+      }
+      i--;
+    } else {
+      instance->probing_queue_len++;
+    }
+    for(; i > 0 && benefit[i - 1] < b; i--) {
+      benefit[i] = benefit[i - 1];
+      linkaddr_copy(&instance->probing_queue[i], &instance->probing_queue[i - 1]);
+    }
+    benefit[i] = b;
+    linkaddr_copy(&instance->probing_queue[i], rpl_get_parent_lladdr(p));
+  }
+  if(instance->probing_queue_len == 0) {
+    instance->probing_empty_time = now;
+  }
+}
+/*---------------------------------------------------------------------------*/
 clock_time_t
 get_probing_delay(rpl_dag_t *dag)
 {
+  clock_time_t spacing;
+
   if(dag != NULL && dag->instance != NULL
       && dag->instance->urgent_probing_target != NULL) {
     /* Urgent probing needed (to find out if a neighbor may become preferred parent) */
     return random_rand() % (CLOCK_SECOND * 10);
-  } else {
-    /* Else, use normal probing interval */
-    return ((RPL_PROBING_INTERVAL) / 2) + random_rand() % (RPL_PROBING_INTERVAL);
   }
+
+  if(dag != NULL && dag->instance != NULL) {
+    if(dag->instance->probing_queue_len == 0) {
+      fill_probing_queue(dag);
+    }
+    if(dag->instance->probing_queue_len > 0) {
+      /* Contenders are waiting: probe as fast as the budget allows */
+      spacing = (60 * CLOCK_SECOND) / RPL_PROBING_BUDGET;
+      if(spacing < RPL_PROBING_INTERVAL) {
+        return spacing + random_rand() % (spacing / 2 + 1);
+      }
+    }
+  }
+
+  /* Else, use normal probing interval */
+  return ((RPL_PROBING_INTERVAL) / 2) + random_rand() % (RPL_PROBING_INTERVAL);
 }
 /*---------------------------------------------------------------------------*/
 rpl_parent_t *
 get_probing_target(rpl_dag_t *dag)
 {
-  /* Returns the next probing target. The current implementation probes the urgent
-   * probing target if any, or the preferred parent if its link statistics need refresh.
-   * Otherwise, it picks at random between:
-   * (1) selecting the best parent with non-fresh link statistics
-   * (2) selecting the least recently updated parent
+  /* Returns the next probing target: the urgent probing target if any,
+   * otherwise the queued parent with the highest expected benefit that is
+   * still in this DAG and still has non-fresh link statistics. The queue
+   * is refilled with one scan of the parent table when it runs empty.
    */
 
+  rpl_instance_t *instance;
   rpl_parent_t *p;
-  rpl_parent_t *probing_target = NULL;
-  rpl_rank_t probing_target_rank = INFINITE_RANK;
-  clock_time_t probing_target_age = 0;
-  clock_time_t clock_now = clock_time();
+  int refilled;
 
   if(dag == NULL ||
       dag->instance == NULL) {
     return NULL;
   }
+  instance = dag->instance;
 
   /* There is an urgent probing target */
-  if(dag->instance->urgent_probing_target != NULL) {
-    return dag->instance->urgent_probing_target;
-  }
-
-  /* The preferred parent needs probing */
-  if(dag->preferred_parent != NULL && !rpl_parent_is_fresh(dag->preferred_parent)) {
-    return dag->preferred_parent;
-  }
-
-  /* With 50% probability: probe best non-fresh parent */
-  if(random_rand() % 2 == 0) {
-    p = nbr_table_head(rpl_parents);
-    while(p != NULL) {
-      if(p->dag == dag && !rpl_parent_is_fresh(p)) {
-        /* p is in our dag and needs probing */
-        rpl_rank_t p_rank = rpl_rank_via_parent(p);
-        if(probing_target == NULL
-            || p_rank < probing_target_rank) {
-          probing_target = p;
-          probing_target_rank = p_rank;
-        }
-      }
-      p = nbr_table_next(rpl_parents, p);
-    }
+  if(instance->urgent_probing_target != NULL) {
+    return instance->urgent_probing_target;
   }
 
-  /* If we still do not have a probing target: pick the least recently updated parent */
-  if(probing_target == NULL) {
-    p = nbr_table_head(rpl_parents);
-    while(p != NULL) {
-      const struct link_stats *stats =rpl_get_parent_link_stats(p);
-      if(p->dag == dag && stats != NULL) {
-        if(probing_target == NULL
-            || clock_now - stats->last_tx_time > probing_target_age) {
-          probing_target = p;
-          probing_target_age = clock_now - stats->last_tx_time;
-        }
+  for(refilled = 0; refilled < 2; refilled++) {
+    if(instance->probing_queue_len == 0) {
+      if(refilled) {
+        break;
+      }
+      fill_probing_queue(dag);
+    }
+    while(instance->probing_queue_len > 0) {
+      p = rpl_get_parent((uip_lladdr_t *)&instance->probing_queue[0]);
+      instance->probing_queue_len--;
+      memmove(&instance->probing_queue[0], &instance->probing_queue[1],
+              instance->probing_queue_len * sizeof(linkaddr_t));
+      if(p != NULL && p->dag == dag && !rpl_parent_is_fresh(p)) {
+        return p;
       }
-      p = nbr_table_next(rpl_parents, p);
     }
   }
 
-  return probing_target;
+  return NULL;
 }
 /*---------------------------------------------------------------------------*/
 static void
 handle_probing_timer(void *ptr)
 {
   rpl_instance_t *instance = (rpl_instance_t *)ptr;
-  rpl_parent_t *probing_target = RPL_PROBING_SELECT_FUNC(instance->current_dag);
-  uip_ipaddr_t *target_ipaddr = rpl_get_parent_ipaddr(probing_target);
+  rpl_parent_t *probing_target;
+  uip_ipaddr_t *target_ipaddr;
+  int urgent;
+
+  /* Urgent probes are not budgeted. The others take their token before
+     a target leaves the queue, so that a refused one keeps its place. */
+  urgent = instance->urgent_probing_target != NULL;
+  if(!urgent &&
+     !take_token(&probing_tokens, &probing_time,
+                 (60 * CLOCK_SECOND) / RPL_PROBING_BUDGET, RPL_PROBING_BUDGET)) {
+    PRINTF("RPL: probing budget exhausted\n");
+    RPL_STAT(rpl_stats.probes_over_budget++);
+    rpl_schedule_probing(instance);
+    return;
+  }
+
+  probing_target = RPL_PROBING_SELECT_FUNC(instance->current_dag);
+  target_ipaddr = rpl_get_parent_ipaddr(probing_target);
+  if(target_ipaddr == NULL && !urgent) {
+    /* Nothing to probe, give the token back */
+    probing_tokens++;
+  }
 
   /* Perform probing */
   if(target_ipaddr != NULL) {
+    RPL_STAT(rpl_stats.probes_sent++);
     const struct link_stats *stats = rpl_get_parent_link_stats(probing_target);
     (void)stats;
     PRINTF("RPL: probing %u %s last tx %u min ago\n",
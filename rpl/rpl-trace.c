@@ -0,0 +1,97 @@
+/**
+ * \addtogroup uip6
+ * @{
+ */
+/**
+ * \file
+ *         RPL tracepoints: a ring of binary records, see rpl-trace.h.
+ *         Writing a record costs a few stores, so the tracepoints can
+ *         stay enabled where PRINTF would change the timing.
+ */
+
+#include "net/rpl/rpl-private.h"
+
+#include <string.h>
+
+#if RPL_TRACE
+
+#if (RPL_TRACE_RECORDS & (RPL_TRACE_RECORDS - 1)) != 0
+#error "RPL_TRACE_RECORDS must be a power of two"
+#endif
+
+struct trace_ring {
+  struct rpl_trace_header h;
+  struct rpl_trace_record records[RPL_TRACE_RECORDS];
+};
+
+/* Records go to static memory until rpl_trace_init() maps the ring */
+static struct trace_ring ring_memory;
+static struct trace_ring *ring = &ring_memory;
+/*---------------------------------------------------------------------------*/
+void
+rpl_trace(uint16_t event, uint16_t a, uint32_t b, uint32_t c)
+{
+  struct rpl_trace_record *r;
+  uint32_t head;
+
+  head = ring->h.head;
+  r = &ring->records[head & (RPL_TRACE_RECORDS - 1)];
+  r->time = (uint32_t)clock_time();
+  r->event = event;
+  r->a = a;
+  r->b = b;
+  r->c = c;
+  RPL_SHARED_BARRIER();
+  ring->h.head = head + 1;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * The trace address of a parent, 0 for none. Made from the link-layer
+ * address of the parent table entry, the interface identifier its
+ * addresses have, rather than by a lookup in the neighbor table.
+ */
+uint32_t
+rpl_trace_parent(rpl_parent_t *p)
+{
+  const linkaddr_t *lladdr;
+  uip_ipaddr_t addr;
+
+  if(p == NULL) {
+    return 0;
+  }
+  lladdr = rpl_get_parent_lladdr(p);
+  if(lladdr == NULL) {
+    return 0;
+  }
+  uip_ds6_set_addr_iid(&addr, (uip_lladdr_t *)lladdr);
+  return RPL_TRACE_ADDR(&addr);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_trace_init(void)
+{
+  struct trace_ring *p;
+
+  if(ring == &ring_memory) {
+    p = rpl_map_shared(RPL_TRACE_PATH, sizeof(struct trace_ring));
+    if(p != NULL) {
+      ring = p;
+    }
+  }
+
+  memset(ring, 0, sizeof(struct trace_ring));
+  ring->h.version = RPL_TRACE_VERSION;
+  ring->h.record_size = sizeof(struct rpl_trace_record);
+  ring->h.num_records = RPL_TRACE_RECORDS;
+  ring->h.ticks_per_second = CLOCK_SECOND;
+  ring->h.start_time = (uint32_t)clock_time();
+  memcpy(ring->h.lladdr, &linkaddr_node_addr,
+         MIN(LINKADDR_SIZE, sizeof(ring->h.lladdr)));
+  /* A decoder trusts the layout once it sees the magic */
+  RPL_SHARED_BARRIER();
+  ring->h.magic = RPL_TRACE_MAGIC;
+}
+/*---------------------------------------------------------------------------*/
+#endif /* RPL_TRACE */
+
+/** @}*/
@@ -0,0 +1,58 @@
+/**
+ * \file
+ *         RPL tracepoints. The hot paths log fixed-size binary records to a
+ *         ring mapped at RPL_TRACE_PATH; this is the layout a decoder
+ *         finds there, so this header depends on nothing but stdint.
+ */
+
+#ifndef RPL_TRACE_H
+#define RPL_TRACE_H
+
+#include <stdint.h>
+
+#define RPL_TRACE_MAGIC   0x52504c54 /* "RPLT" */
+#define RPL_TRACE_VERSION 1
+
+/*
+ * Events, with their arguments. Addresses are the last four bytes of
+ * an IPv6 address, 0 for none or for multicast.
+ */
+#define RPL_TRACE_DIS_INPUT      1 /* -, sender, - */
+#define RPL_TRACE_DIO_INPUT      2 /* rank, sender, version << 8 | instance */
+#define RPL_TRACE_DIO_OUTPUT     3 /* rank, destination, version << 8 | instance */
+#define RPL_TRACE_DAO_INPUT      4 /* lifetime, sender, target */
+#define RPL_TRACE_DAO_OUTPUT     5 /* lifetime, parent, target */
+#define RPL_TRACE_BEST_PARENT    6 /* its rank, best parent, current parent */
+#define RPL_TRACE_RANK           7 /* new rank, parent, base rank */
+#define RPL_TRACE_METRIC_UPDATE  8 /* rank, preferred parent, objects */
+#define RPL_TRACE_PARENT_SWITCH  9 /* new rank, new parent, old parent */
+#define RPL_TRACE_LOCAL_REPAIR  10 /* rank, -, - */
+#define RPL_TRACE_GLOBAL_REPAIR 11 /* rank, -, version */
+
+struct rpl_trace_record {
+  uint32_t time; /* clock_time(), truncated */
+  uint16_t event;
+  uint16_t a;
+  uint32_t b;
+  uint32_t c;
+};
+
+/*
+ * The ring starts with this header, followed by num_records records.
+ * Record i, counting from the start of the node, is in slot
+ * i % num_records. The node writes a record before incrementing head, so
+ * a reader that takes head before (h1) and after (h2) copying the ring
+ * has intact records from max(h2 - num_records + 1, 0) up to h1.
+ */
+struct rpl_trace_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t num_records;
+  uint32_t ticks_per_second; /* CLOCK_SECOND */
+  uint32_t start_time;       /* clock_time() when the ring started */
+  uint32_t head;             /* records written */
+  uint8_t lladdr[8];
+};
+
+#endif /* RPL_TRACE_H */
@@ -49,18 +49,70 @@
 #include "net/rpl/rpl-private.h"
 #include "net/rpl/rpl-ns.h"
 #include "net/ipv6/multicast/uip-mcast6.h"
+#include "lib/memb.h"
+#include "net/packetbuf.h"
 
 #define DEBUG DEBUG_PRINT
 #include "net/ip/uip-debug.h"
 
 #include <limits.h>
 #include <string.h>
+#if RPL_SNAPSHOT || RPL_COUNTERS_SHM || RPL_TRACE
+#include <stdio.h>
+#endif /* RPL_SNAPSHOT || RPL_COUNTERS_SHM || RPL_TRACE */
+#if RPL_COUNTERS_SHM || RPL_TRACE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif /* RPL_COUNTERS_SHM || RPL_TRACE */
 
 #if RPL_CONF_STATS
 rpl_stats_t rpl_stats;
 #endif
 
+/* Counters go to static memory until rpl_counters_init() maps them */
+static struct rpl_counters counters_memory;
+struct rpl_counters *rpl_counters = &counters_memory;
+
 static enum rpl_mode mode = RPL_MODE_MESH;
+
+/*
+ * The route entries belong to uip-ds6-route and uip-mcast6-route, so their
+ * lifetime timers live in a pool of their own, hashed on the route address.
+ * Routes are unique per address in those tables.
+ */
+#define RPL_WITH_ROUTE_TIMERS ((UIP_CONF_MAX_ROUTES != 0) || RPL_WITH_MULTICAST)
+
+#if RPL_WITH_ROUTE_TIMERS
+struct route_timer {
+  struct route_timer *hash_next;
+  struct rpl_lifetime_timer timer;
+  void *route;
+  uip_ipaddr_t addr;
+  uint8_t mcast;
+};
+
+#if (UIP_CONF_MAX_ROUTES != 0)
+#define ROUTE_TIMER_NUM_ROUTES UIP_DS6_ROUTE_NB
+#else /* (UIP_CONF_MAX_ROUTES != 0) */
+#define ROUTE_TIMER_NUM_ROUTES 0
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+#if RPL_WITH_MULTICAST
+#define ROUTE_TIMER_NUM_MCAST UIP_MCAST6_ROUTE_NB
+#else /* RPL_WITH_MULTICAST */
+#define ROUTE_TIMER_NUM_MCAST 0
+#endif /* RPL_WITH_MULTICAST */
+
+MEMB(route_timer_memb, struct route_timer,
+     ROUTE_TIMER_NUM_ROUTES + ROUTE_TIMER_NUM_MCAST);
+static struct route_timer *route_timers[RPL_ROUTE_TIMER_HASH_SIZE];
+#endif /* RPL_WITH_ROUTE_TIMERS */
+
+#if (UIP_CONF_MAX_ROUTES != 0)
+static struct uip_ds6_notification route_notification;
+/* Second in which the last No-Path DAO for an expired route was sent */
+static uint32_t nopath_time;
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
 /*---------------------------------------------------------------------------*/
 enum rpl_mode
 rpl_get_mode(void)
@@ -108,70 +160,231 @@ rpl_set_mode(enum rpl_mode m)
   return oldmode;
 }
 /*---------------------------------------------------------------------------*/
-void
-rpl_purge_routes(void)
+#if RPL_WITH_ROUTE_TIMERS
+static unsigned
+route_timer_hash(const uip_ipaddr_t *addr)
 {
-  uip_ds6_route_t *r;
+  /* FNV-1a over the interface identifier or group ID */
+  uint32_t h = 2166136261UL;
+  int i;
+
+  for(i = 8; i < 16; i++) {
+    h = (h ^ addr->u8[i]) * 16777619UL;
+  }
+  return h & (RPL_ROUTE_TIMER_HASH_SIZE - 1);
+}
+/*---------------------------------------------------------------------------*/
+/* Route timers are known to the lifetime wheel by their index in the pool */
+static uint32_t
+route_timer_index(const struct route_timer *rt)
+{
+  return rt - (struct route_timer *)route_timer_memb.mem;
+}
+/*---------------------------------------------------------------------------*/
+static struct rpl_lifetime_timer *
+route_timer_at(uint32_t index)
+{
+  return &((struct route_timer *)route_timer_memb.mem)[index].timer;
+}
+/*---------------------------------------------------------------------------*/
+static struct route_timer *
+route_timer_lookup(const uip_ipaddr_t *addr, uint8_t mcast)
+{
+  struct route_timer *rt;
+
+  for(rt = route_timers[route_timer_hash(addr)]; rt != NULL; rt = rt->hash_next) {
+    if(rt->mcast == mcast && uip_ipaddr_cmp(&rt->addr, addr)) {
+      return rt;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static struct route_timer *
+route_timer_get(void *route, const uip_ipaddr_t *addr, uint8_t mcast)
+{
+  struct route_timer *rt;
+  unsigned h;
+
+  rt = route_timer_lookup(addr, mcast);
+  if(rt == NULL) {
+    rt = memb_alloc(&route_timer_memb);
+    if(rt == NULL) {
+      PRINTF("RPL: No route timer left\n");
+      return NULL;
+    }
+    memset(rt, 0, sizeof(*rt));
+    uip_ipaddr_copy(&rt->addr, addr);
+    rt->mcast = mcast;
+    h = route_timer_hash(addr);
+    rt->hash_next = route_timers[h];
+    route_timers[h] = rt;
+  }
+  rt->route = route;
+  return rt;
+}
+/*---------------------------------------------------------------------------*/
+static void
+route_timer_free(struct route_timer *rt)
+{
+  struct route_timer **p;
+
+  for(p = &route_timers[route_timer_hash(&rt->addr)]; *p != NULL; p = &(*p)->hash_next) {
+    if(*p == rt) {
+      *p = rt->hash_next;
+      break;
+    }
+  }
+  rpl_lifetime_timer_stop(RPL_LIFETIME_ROUTE, route_timer_index(rt));
+  memb_free(&route_timer_memb, rt);
+}
+#endif /* RPL_WITH_ROUTE_TIMERS */
+/*---------------------------------------------------------------------------*/
+#if (UIP_CONF_MAX_ROUTES != 0)
+static void
+route_expired(struct route_timer *rt)
+{
+  uip_ds6_route_t *r = rt->route;
   uip_ipaddr_t prefix;
   rpl_dag_t *dag;
-#if RPL_WITH_MULTICAST
-  uip_mcast6_route_t *mcast_route;
-#endif
 
-  /* First pass, decrement lifetime */
-  r = uip_ds6_route_head();
+  if(rpl_lifetime_remaining(r->state.lifetime) > 0) {
+    /* Refreshed without going through rpl_set_route_lifetime */
+    rpl_lifetime_timer_set(RPL_LIFETIME_ROUTE, route_timer_index(rt),
+                           r->state.lifetime);
+    return;
+  }
 
-  while(r != NULL) {
-    if(r->state.lifetime >= 1 && r->state.lifetime != RPL_ROUTE_INFINITE_LIFETIME) {
-      /*
-       * If a route is at lifetime == 1, set it to 0, scheduling it for
-       * immediate removal below. This achieves the same as the original code,
-       * which would delete lifetime <= 1
-       */
-      r->state.lifetime--;
-    }
-    r = uip_ds6_route_next(r);
+  dag = default_instance != NULL ? default_instance->current_dag : NULL;
+  if(dag != NULL && dag->rank != ROOT_RANK(default_instance) &&
+     nopath_time == (uint32_t)clock_seconds()) {
+    /* Don't send more than 1 No-Path DAO per second, expire this one next */
+    rpl_lifetime_timer_set(RPL_LIFETIME_ROUTE, route_timer_index(rt),
+                           nopath_time + 1);
+    return;
   }
 
-  /* Second pass, remove dead routes */
-  r = uip_ds6_route_head();
+  uip_ipaddr_copy(&prefix, &r->ipaddr);
+  /* Frees rt through the route notification */
+  uip_ds6_route_rm(r);
+  PRINTF("RPL: No more routes to ");
+  PRINT6ADDR(&prefix);
+  /* Propagate this information with a No-Path DAO to preferred parent if we are not a RPL Root */
+  if(dag != NULL && dag->rank != ROOT_RANK(default_instance)) {
+    PRINTF(" -> generate No-Path DAO\n");
+    dao_output_target(dag->preferred_parent, &prefix, RPL_ZERO_LIFETIME);
+    nopath_time = (uint32_t)clock_seconds();
+    return;
+  }
+  PRINTF("\n");
+}
+/*---------------------------------------------------------------------------*/
+static void
+route_callback(int event, uip_ipaddr_t *route, uip_ipaddr_t *nexthop,
+               int num_routes)
+{
+  struct route_timer *rt;
 
-  while(r != NULL) {
-    if(r->state.lifetime < 1) {
-      /* Routes with lifetime == 1 have only just been decremented from 2 to 1,
-       * thus we want to keep them. Hence < and not <= */
-      uip_ipaddr_copy(&prefix, &r->ipaddr);
-      uip_ds6_route_rm(r);
-      r = uip_ds6_route_head();
-      PRINTF("RPL: No more routes to ");
-      PRINT6ADDR(&prefix);
-      dag = default_instance->current_dag;
-      /* Propagate this information with a No-Path DAO to preferred parent if we are not a RPL Root */
-      if(dag->rank != ROOT_RANK(default_instance)) {
-        PRINTF(" -> generate No-Path DAO\n");
-        dao_output_target(dag->preferred_parent, &prefix, RPL_ZERO_LIFETIME);
-        /* Don't schedule more than 1 No-Path DAO, let next iteration handle that */
-        return;
-      }
-      PRINTF("\n");
-    } else {
-      r = uip_ds6_route_next(r);
+  if(event == UIP_DS6_NOTIFICATION_ROUTE_RM) {
+    rt = route_timer_lookup(route, 0);
+    if(rt != NULL) {
+      route_timer_free(rt);
     }
   }
+}
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+/*---------------------------------------------------------------------------*/
+/* Sets the lifetime of a route, in seconds, and schedules its expiry */
+void
+rpl_set_route_lifetime(uip_ds6_route_t *r, uint32_t lifetime)
+{
+#if (UIP_CONF_MAX_ROUTES != 0)
+  struct route_timer *rt;
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
 
+  r->state.lifetime = rpl_lifetime_to_expiry(lifetime);
+#if (UIP_CONF_MAX_ROUTES != 0)
+  rt = route_timer_get(r, &r->ipaddr, 0);
+  if(rt != NULL) {
+    rpl_lifetime_timer_set(RPL_LIFETIME_ROUTE, route_timer_index(rt),
+                           r->state.lifetime);
+  }
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+}
+/*---------------------------------------------------------------------------*/
 #if RPL_WITH_MULTICAST
-  mcast_route = uip_mcast6_route_list_head();
+static void
+mcast_route_rm(uip_mcast6_route_t *r)
+{
+  struct route_timer *rt;
 
-  while(mcast_route != NULL) {
-    if(mcast_route->lifetime <= 1) {
-      uip_mcast6_route_rm(mcast_route);
-      mcast_route = uip_mcast6_route_list_head();
-    } else {
-      mcast_route->lifetime--;
-      mcast_route = list_item_next(mcast_route);
-    }
+  rt = route_timer_lookup(&r->group, 1);
+  if(rt != NULL) {
+    route_timer_free(rt);
   }
-#endif
+  uip_mcast6_route_rm(r);
+}
+/*---------------------------------------------------------------------------*/
+static void
+mcast_route_expired(struct route_timer *rt)
+{
+  uip_mcast6_route_t *r = rt->route;
+
+  if(rpl_lifetime_remaining(r->lifetime) > 0) {
+    rpl_lifetime_timer_set(RPL_LIFETIME_ROUTE, route_timer_index(rt),
+                           r->lifetime);
+    return;
+  }
+  mcast_route_rm(r);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_set_mcast_route_lifetime(uip_mcast6_route_t *r, uint32_t lifetime)
+{
+  struct route_timer *rt;
+
+  r->lifetime = rpl_lifetime_to_expiry(lifetime);
+  rt = route_timer_get(r, &r->group, 1);
+  if(rt != NULL) {
+    rpl_lifetime_timer_set(RPL_LIFETIME_ROUTE, route_timer_index(rt),
+                           r->lifetime);
+  }
+}
+#endif /* RPL_WITH_MULTICAST */
+/*---------------------------------------------------------------------------*/
+#if RPL_WITH_ROUTE_TIMERS
+static void
+route_timer_expired(uint32_t index)
+{
+  struct route_timer *rt = &((struct route_timer *)route_timer_memb.mem)[index];
+
+#if RPL_WITH_MULTICAST
+  if(rt->mcast) {
+    mcast_route_expired(rt);
+    return;
+  }
+#endif /* RPL_WITH_MULTICAST */
+#if (UIP_CONF_MAX_ROUTES != 0)
+  route_expired(rt);
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
+}
+
+static const rpl_lifetime_user_t route_lifetime_user = {
+  route_timer_at, route_timer_expired
+};
+#endif /* RPL_WITH_ROUTE_TIMERS */
+/*---------------------------------------------------------------------------*/
+static void
+route_timers_init(void)
+{
+#if RPL_WITH_ROUTE_TIMERS
+  memb_init(&route_timer_memb);
+  memset(route_timers, 0, sizeof(route_timers));
+  rpl_lifetime_register(RPL_LIFETIME_ROUTE, &route_lifetime_user);
+#endif /* RPL_WITH_ROUTE_TIMERS */
+#if (UIP_CONF_MAX_ROUTES != 0)
+  uip_ds6_notification_add(&route_notification, route_callback);
+#endif /* (UIP_CONF_MAX_ROUTES != 0) */
 }
 /*---------------------------------------------------------------------------*/
 void
@@ -198,7 +411,7 @@ rpl_remove_routes(rpl_dag_t *dag)
 
   while(mcast_route != NULL) {
     if(mcast_route->dag == dag) {
-      uip_mcast6_route_rm(mcast_route);
+      mcast_route_rm(mcast_route);
       mcast_route = uip_mcast6_route_list_head();
     } else {
       mcast_route = list_item_next(mcast_route);
@@ -217,7 +430,7 @@ rpl_remove_routes_by_nexthop(uip_ipaddr_t *nexthop, rpl_dag_t *dag)
   while(r != NULL) {
     if(uip_ipaddr_cmp(uip_ds6_route_nexthop(r), nexthop) &&
         r->state.dag == dag) {
-      r->state.lifetime = 0;
+      rpl_set_route_lifetime(r, 0);
     }
     r = uip_ds6_route_next(r);
   }
@@ -236,7 +449,8 @@ rpl_add_route(rpl_dag_t *dag, uip_ipaddr_t *prefix, int prefix_len,
   }
 
   rep->state.dag = dag;
-  rep->state.lifetime = RPL_LIFETIME(dag->instance, dag->instance->default_lifetime);
+  rpl_set_route_lifetime(rep,
+    RPL_LIFETIME(dag->instance, dag->instance->default_lifetime));
   /* always clear state flags for the no-path received when adding/refreshing */
   RPL_ROUTE_CLEAR_NOPATH_RECEIVED(rep);
 
@@ -266,7 +480,7 @@ rpl_link_neighbor_callback(const linkaddr_t *addr, int status, int numtx)
       if(parent != NULL) {
         /* Trigger DAG rank recalculation. */
         PRINTF("RPL: rpl_link_neighbor_callback triggering update\n");
-        parent->updated = 1;
+        rpl_queue_parent_update(parent);
       }
     }
   }
@@ -291,40 +505,527 @@ rpl_ipv6_neighbor_callback(uip_ds6_nbr_t *nbr)
       p = rpl_find_parent_any_dag(instance, &nbr->ipaddr);
       if(p != NULL) {
         p->rank = INFINITE_RANK;
+        rpl_nbr_policy_parent_updated(p);
         /* Trigger DAG rank recalculation. */
         PRINTF("RPL: rpl_ipv6_neighbor_callback infinite rank\n");
-        p->updated = 1;
+        rpl_queue_parent_update(p);
       }
     }
   }
 }
 /*---------------------------------------------------------------------------*/
+/* DAGs are known to the lifetime wheel by their position in the instance
+   table */
+static uint32_t
+dag_index(const rpl_dag_t *dag)
+{
+  return (dag->instance - instance_table) * RPL_MAX_DAG_PER_INSTANCE +
+    (dag - dag->instance->dag_table);
+}
+/*---------------------------------------------------------------------------*/
+static rpl_dag_t *
+dag_at(uint32_t index)
+{
+  return &instance_table[index / RPL_MAX_DAG_PER_INSTANCE].
+    dag_table[index % RPL_MAX_DAG_PER_INSTANCE];
+}
+/*---------------------------------------------------------------------------*/
+static struct rpl_lifetime_timer *
+dag_timer_at(uint32_t index)
+{
+  return &dag_at(index)->lifetime_timer;
+}
+/*---------------------------------------------------------------------------*/
+/* Removes a DAG whose lifetime ran out, unless we are part of it */
+static void
+dag_expired(uint32_t index)
+{
+  rpl_dag_t *dag = dag_at(index);
+
+  if(dag->used && !dag->joined) {
+    PRINTF("RPL: Removing dag ");
+    PRINT6ADDR(&dag->dag_id);
+    PRINTF("\n");
+    rpl_free_dag(dag);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Schedules the removal of a DAG at the end of its lifetime. A DAG that
+   expires while joined is removed once it is left. */
+void
+rpl_schedule_dag_expiry(rpl_dag_t *dag)
+{
+  rpl_lifetime_timer_set(RPL_LIFETIME_DAG, dag_index(dag), dag->lifetime);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_cancel_dag_expiry(rpl_dag_t *dag)
+{
+  rpl_lifetime_timer_stop(RPL_LIFETIME_DAG, dag_index(dag));
+}
+
+static const rpl_lifetime_user_t dag_lifetime_user = {
+  dag_timer_at, dag_expired
+};
+#if RPL_SNAPSHOT
+/*---------------------------------------------------------------------------*/
+/*
+ * Warm start. The state of the default instance goes to a file: a header,
+ * followed by the parents in the current DAG, the preferred parent first.
+ * The file is only read back by the same build on the same node.
+ */
+#define SNAPSHOT_MAGIC  0x52504c53 /* "RPLS" */
+#define SNAPSHOT_FORMAT 1
+
+struct snapshot_header {
+  uint32_t magic;
+  uint8_t format;
+  uint8_t num_parents;
+  linkaddr_t lladdr;
+  /* the instance */
+  rpl_metric_container_t mc;
+  rpl_ocp_t ocp;
+  rpl_rank_t max_rankinc;
+  rpl_rank_t min_hoprankinc;
+  uint16_t lifetime_unit;
+  uint8_t instance_id;
+  uint8_t mop;
+  uint8_t dio_intdoubl;
+  uint8_t dio_intmin;
+  uint8_t dio_redundancy;
+  uint8_t default_lifetime;
+  uint8_t dtsn_out;
+  uint8_t dao_sequence;
+  uint8_t path_sequence;
+  /* the current DAG */
+  uip_ipaddr_t dag_id;
+  rpl_prefix_t prefix_info;
+  uint8_t version;
+  uint8_t grounded;
+  uint8_t preference;
+};
+
+struct snapshot_parent {
+  uip_ipaddr_t ipaddr;
+  linkaddr_t lladdr;
+  rpl_rank_t rank;
+  uint16_t etx;
+  uint8_t link_metric;
+  uint8_t dtsn;
+};
+
+static struct ctimer snapshot_timer;
+/* A DAG restored from the snapshot and not confirmed by a DIO yet */
+static rpl_dag_t *unconfirmed_dag;
+/*---------------------------------------------------------------------------*/
+static void
+snapshot_file_name(char *name, size_t len)
+{
+  snprintf(name, len, RPL_SNAPSHOT_FILE,
+           linkaddr_node_addr.u8[LINKADDR_SIZE - 2],
+           linkaddr_node_addr.u8[LINKADDR_SIZE - 1]);
+}
+/*---------------------------------------------------------------------------*/
+static int
+write_parent(FILE *f, rpl_parent_t *p)
+{
+  struct snapshot_parent sp;
+
+  memset(&sp, 0, sizeof(sp));
+  uip_ipaddr_copy(&sp.ipaddr, rpl_get_parent_ipaddr(p));
+  linkaddr_copy(&sp.lladdr, rpl_get_parent_lladdr(p));
+  sp.rank = p->rank;
+  sp.etx = p->etx;
+  sp.link_metric = p->link_metric;
+  sp.dtsn = p->dtsn;
+  return fwrite(&sp, sizeof(sp), 1, f) == 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_snapshot_save(void)
+{
+  struct snapshot_header h;
+  rpl_instance_t *instance;
+  rpl_dag_t *dag;
+  rpl_parent_t *p;
+  char name[64];
+  char tmp_name[68];
+  FILE *f;
+  int left;
+  int ok;
+
+  instance = default_instance;
+  if(instance == NULL || !instance->current_dag->joined ||
+     instance->current_dag->preferred_parent == NULL ||
+     instance->current_dag->preferred_parent->rank == INFINITE_RANK ||
+     instance->current_dag == unconfirmed_dag) {
+    /* Only routers with a confirmed parent have a state worth keeping */
+    return;
+  }
+  dag = instance->current_dag;
+
+  memset(&h, 0, sizeof(h));
+  h.magic = SNAPSHOT_MAGIC;
+  h.format = SNAPSHOT_FORMAT;
+  linkaddr_copy(&h.lladdr, &linkaddr_node_addr);
+  memcpy(&h.mc, &instance->mc, sizeof(h.mc));
+  h.ocp = instance->of->ocp;
+  h.max_rankinc = instance->max_rankinc;
+  h.min_hoprankinc = instance->min_hoprankinc;
+  h.lifetime_unit = instance->lifetime_unit;
+  h.instance_id = instance->instance_id;
+  h.mop = instance->mop;
+  h.dio_intdoubl = instance->dio_intdoubl;
+  h.dio_intmin = instance->dio_intmin;
+  h.dio_redundancy = instance->dio_redundancy;
+  h.default_lifetime = instance->default_lifetime;
+  h.dtsn_out = instance->dtsn_out;
+  h.dao_sequence = rpl_icmp6_dao_sequence();
+#if RPL_WITH_DCO
+  h.path_sequence = path_sequence;
+#endif /* RPL_WITH_DCO */
+  uip_ipaddr_copy(&h.dag_id, &dag->dag_id);
+  memcpy(&h.prefix_info, &dag->prefix_info, sizeof(h.prefix_info));
+  h.version = dag->version;
+  h.grounded = dag->grounded;
+  h.preference = dag->preference;
+
+  for(p = nbr_table_head(rpl_parents); p != NULL; p = nbr_table_next(rpl_parents, p)) {
+    if(p->dag == dag && p->rank != INFINITE_RANK && h.num_parents < 0xff) {
+      h.num_parents++;
+    }
+  }
+
+  snapshot_file_name(name, sizeof(name));
+  snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name);
+  f = fopen(tmp_name, "wb");
+  if(f == NULL) {
+    PRINTF("RPL: Could not open %s\n", tmp_name);
+    return;
+  }
+
+  ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+    write_parent(f, dag->preferred_parent);
+  left = h.num_parents - 1;
+  for(p = nbr_table_head(rpl_parents);
+      ok && left > 0 && p != NULL;
+      p = nbr_table_next(rpl_parents, p)) {
+    if(p->dag == dag && p->rank != INFINITE_RANK && p != dag->preferred_parent) {
+      ok = write_parent(f, p);
+      left--;
+    }
+  }
+
+  /* Replace the previous snapshot only with a complete one */
+  if(fclose(f) != 0 || !ok || rename(tmp_name, name) != 0) {
+    PRINTF("RPL: Could not write %s\n", name);
+    remove(tmp_name);
+    return;
+  }
+  PRINTF("RPL: Saved the state to %s\n", name);
+}
+/*---------------------------------------------------------------------------*/
+static void
+snapshot_periodic(void *ptr)
+{
+  rpl_snapshot_save();
+  ctimer_set(&snapshot_timer, RPL_SNAPSHOT_INTERVAL, snapshot_periodic, NULL);
+}
+/*---------------------------------------------------------------------------*/
+static void
+snapshot_unconfirmed(void *ptr)
+{
+  char name[64];
+
+  if(unconfirmed_dag != NULL && unconfirmed_dag->used) {
+    PRINTF("RPL: No DIO confirmed the restored DAG, leaving it\n");
+    rpl_free_instance(unconfirmed_dag->instance);
+    /* Do not warm start from it again */
+    snapshot_file_name(name, sizeof(name));
+    remove(name);
+  }
+  unconfirmed_dag = NULL;
+  ctimer_set(&snapshot_timer, RPL_SNAPSHOT_INTERVAL, snapshot_periodic, NULL);
+}
+/*---------------------------------------------------------------------------*/
+static void
+snapshot_solicit(void *ptr)
+{
+  rpl_dag_t *dag = unconfirmed_dag;
+
+  /* A unicast DIS gets a DIO from the parent without waiting for Trickle */
+  if(dag != NULL && dag->used && dag->preferred_parent != NULL) {
+    dis_output(rpl_get_parent_ipaddr(dag->preferred_parent));
+  }
+  ctimer_set(&snapshot_timer, RPL_SNAPSHOT_VALIDATION_TIME, snapshot_unconfirmed, NULL);
+}
+/*---------------------------------------------------------------------------*/
 void
-rpl_purge_dags(void)
+rpl_snapshot_confirm(rpl_dag_t *dag)
 {
+  if(dag == unconfirmed_dag) {
+    PRINTF("RPL: The restored DAG is confirmed\n");
+    unconfirmed_dag = NULL;
+    ctimer_set(&snapshot_timer, RPL_SNAPSHOT_INTERVAL, snapshot_periodic, NULL);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Rejoins the DAG of the snapshot, returns 1 if it did */
+static int
+snapshot_restore(void)
+{
+  struct snapshot_header h;
+  struct snapshot_parent sp;
+  rpl_dio_t dio;
   rpl_instance_t *instance;
-  rpl_instance_t *end;
+  rpl_dag_t *dag;
+  rpl_parent_t *p;
+  char name[64];
+  FILE *f;
   int i;
 
-  for(instance = &instance_table[0], end = instance + RPL_MAX_INSTANCES;
-      instance < end; ++instance) {
-    if(instance->used) {
-      for(i = 0; i < RPL_MAX_DAG_PER_INSTANCE; i++) {
-        if(instance->dag_table[i].used) {
-          if(instance->dag_table[i].lifetime == 0) {
-            if(!instance->dag_table[i].joined) {
-              PRINTF("RPL: Removing dag ");
-              PRINT6ADDR(&instance->dag_table[i].dag_id);
-              PRINTF("\n");
-              rpl_free_dag(&instance->dag_table[i]);
-            }
-          } else {
-            instance->dag_table[i].lifetime--;
-          }
-        }
+  snapshot_file_name(name, sizeof(name));
+  f = fopen(name, "rb");
+  if(f == NULL) {
+    return 0;
+  }
+
+  if(fread(&h, sizeof(h), 1, f) != 1 || h.magic != SNAPSHOT_MAGIC ||
+     h.format != SNAPSHOT_FORMAT || !linkaddr_cmp(&h.lladdr, &linkaddr_node_addr)) {
+    PRINTF("RPL: Ignoring the invalid snapshot %s\n", name);
+    fclose(f);
+    return 0;
+  }
+
+  /* Rejoin the way a DIO from the preferred parent would have us join */
+  memset(&dio, 0, sizeof(dio));
+  memcpy(&dio.mc, &h.mc, sizeof(dio.mc));
+  dio.ocp = h.ocp;
+  dio.dag_max_rankinc = h.max_rankinc;
+  dio.dag_min_hoprankinc = h.min_hoprankinc;
+  dio.lifetime_unit = h.lifetime_unit;
+  dio.instance_id = h.instance_id;
+  dio.mop = h.mop;
+  dio.dag_intdoubl = h.dio_intdoubl;
+  dio.dag_intmin = h.dio_intmin;
+  dio.dag_redund = h.dio_redundancy;
+  dio.default_lifetime = h.default_lifetime;
+  uip_ipaddr_copy(&dio.dag_id, &h.dag_id);
+  memcpy(&dio.prefix_info, &h.prefix_info, sizeof(dio.prefix_info));
+  dio.version = h.version;
+  dio.grounded = h.grounded;
+  dio.preference = h.preference;
+
+  instance = NULL;
+  dag = NULL;
+  for(i = 0; i < h.num_parents && fread(&sp, sizeof(sp), 1, f) == 1; i++) {
+    dio.rank = sp.rank;
+    dio.dtsn = sp.dtsn;
+    if(uip_ds6_nbr_lookup(&sp.ipaddr) == NULL &&
+       uip_ds6_nbr_add(&sp.ipaddr, (uip_lladdr_t *)&sp.lladdr, 0, NBR_REACHABLE,
+                       NBR_TABLE_REASON_RPL_DIO, &dio) == NULL) {
+      continue;
+    }
+    if(instance == NULL) {
+      rpl_join_instance(&sp.ipaddr, &dio);
+      instance = rpl_get_instance(h.instance_id);
+      if(instance == NULL) {
+        break;
       }
+      dag = instance->current_dag;
+      p = dag->preferred_parent;
+    } else {
+      p = rpl_add_parent(dag, &dio, &sp.ipaddr);
+    }
+    if(p != NULL) {
+      p->etx = sp.etx;
+      p->link_metric = sp.link_metric;
     }
   }
+  fclose(f);
+
+  if(instance == NULL) {
+    PRINTF("RPL: Could not rejoin from %s\n", name);
+    return 0;
+  }
+
+  instance->dtsn_out = h.dtsn_out;
+  rpl_icmp6_set_dao_sequence(h.dao_sequence);
+#if RPL_WITH_DCO
+  path_sequence = h.path_sequence;
+#endif /* RPL_WITH_DCO */
+
+  /* The rank with the link metrics we had */
+  dag->rank = rpl_rank_via_parent(dag->preferred_parent);
+  dag->min_rank = dag->rank;
+
+  PRINTF("RPL: Restored DAG ");
+  PRINT6ADDR(&dag->dag_id);
+  PRINTF(" from %s, rank %u, %u parents\n", name, dag->rank, i);
+
+  unconfirmed_dag = dag;
+  ctimer_set(&snapshot_timer, CLOCK_SECOND, snapshot_solicit, NULL);
+  return 1;
+}
+#endif /* RPL_SNAPSHOT */
+#if RPL_COUNTERS_SHM || RPL_TRACE
+/*---------------------------------------------------------------------------*/
+/*
+ * Maps a file of size bytes, named after the link address of the node,
+ * for the collectors to read while we write. Returns NULL on failure.
+ */
+void *
+rpl_map_shared(const char *path_format, size_t size)
+{
+  char name[64];
+  void *p;
+  int fd;
+
+  snprintf(name, sizeof(name), path_format,
+           linkaddr_node_addr.u8[LINKADDR_SIZE - 2],
+           linkaddr_node_addr.u8[LINKADDR_SIZE - 1]);
+  p = NULL;
+  fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd >= 0) {
+    if(ftruncate(fd, size) == 0) {
+      p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if(p == MAP_FAILED) {
+        p = NULL;
+      }
+    }
+    close(fd);
+  }
+
+  if(p == NULL) {
+    PRINTF("RPL: Cannot map %s\n", name);
+  } else {
+    PRINTF("RPL: Mapped %s\n", name);
+  }
+  return p;
+}
+#endif /* RPL_COUNTERS_SHM || RPL_TRACE */
+/*---------------------------------------------------------------------------*/
+/*
+ * Neighbor counters, found by link address. When all slots are taken, the
+ * slot of the neighbor heard from the longest ago is given to the new one.
+ */
+static struct rpl_nbr_counters *
+nbr_counters(const linkaddr_t *lladdr)
+{
+  struct rpl_nbr_counters *n;
+  struct rpl_nbr_counters *oldest;
+  int len;
+  int i;
+
+  if(lladdr == NULL || linkaddr_cmp(lladdr, &linkaddr_null)) {
+    return NULL;
+  }
+
+  len = MIN(LINKADDR_SIZE, sizeof(n->lladdr));
+  oldest = NULL;
+  for(i = 0; i < RPL_COUNTERS_NBR_NUM; i++) {
+    n = &rpl_counters->nbr[i];
+    if(n->seq == 0) {
+      /* Never used */
+      if(oldest == NULL || oldest->seq != 0) {
+        oldest = n;
+      }
+      continue;
+    }
+    if(memcmp(n->lladdr, lladdr, len) == 0) {
+      return n;
+    }
+    if(oldest == NULL ||
+       (oldest->seq != 0 && n->last_seen < oldest->last_seen)) {
+      oldest = n;
+    }
+  }
+
+  n = oldest;
+  if(n->seq != 0) {
+    RPL_COUNT(nbr_evictions);
+  }
+  n->seq++;
+  RPL_SHARED_BARRIER();
+  memset(n->lladdr, 0, sizeof(n->lladdr));
+  memcpy(n->lladdr, lladdr, len);
+  memset(n->msg, 0, sizeof(n->msg));
+  n->last_seen = clock_seconds();
+  RPL_SHARED_BARRIER();
+  n->seq++;
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+/* Counts a received RPL message, the one in uip_buf */
+void
+rpl_counters_input(uint8_t code)
+{
+  struct rpl_nbr_counters *n;
+  uint16_t len;
+
+  if(code >= RPL_COUNTER_MSG_NUM) {
+    return;
+  }
+
+  len = uip_len - uip_l3_icmp_hdr_len;
+  rpl_counters->msg[code].in++;
+  rpl_counters->msg[code].bytes_in += len;
+
+  n = nbr_counters(packetbuf_addr(PACKETBUF_ADDR_SENDER));
+  if(n != NULL) {
+    n->msg[code].in++;
+    n->msg[code].bytes_in += len;
+    n->last_seen = clock_seconds();
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Counts an RPL message about to be sent, to a neighbor unless multicast */
+void
+rpl_counters_output(uint8_t code, uip_ipaddr_t *dest, uint16_t len)
+{
+  struct rpl_nbr_counters *n;
+  const uip_lladdr_t *lladdr;
+
+  if(code >= RPL_COUNTER_MSG_NUM) {
+    return;
+  }
+
+  rpl_counters->msg[code].out++;
+  rpl_counters->msg[code].bytes_out += len;
+
+  if(dest == NULL || uip_is_addr_mcast(dest)) {
+    return;
+  }
+  lladdr = uip_ds6_nbr_lladdr_from_ipaddr(dest);
+  n = nbr_counters((const linkaddr_t *)lladdr);
+  if(n != NULL) {
+    n->msg[code].out++;
+    n->msg[code].bytes_out += len;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_counters_init(void)
+{
+#if RPL_COUNTERS_SHM
+  void *p;
+
+  if(rpl_counters == &counters_memory) {
+    p = rpl_map_shared(RPL_COUNTERS_SHM_PATH, sizeof(struct rpl_counters));
+    if(p != NULL) {
+      rpl_counters = p;
+    }
+  }
+#endif /* RPL_COUNTERS_SHM */
+
+  memset(rpl_counters, 0, sizeof(struct rpl_counters));
+  rpl_counters->version = RPL_COUNTERS_VERSION;
+  rpl_counters->num_nbrs = RPL_COUNTERS_NBR_NUM;
+  rpl_counters->size = sizeof(struct rpl_counters);
+  rpl_counters->start_time = clock_seconds();
+  /* A collector trusts the layout once it sees the magic */
+  RPL_SHARED_BARRIER();
+  rpl_counters->magic = RPL_COUNTERS_MAGIC;
 }
 /*---------------------------------------------------------------------------*/
 void
@@ -334,9 +1035,17 @@ rpl_init(void)
   PRINTF("RPL: RPL started\n");
   default_instance = NULL;
 
+  rpl_counters_init();
+#if RPL_TRACE
+  rpl_trace_init();
+#endif /* RPL_TRACE */
   rpl_dag_init();
+  rpl_lifetime_register(RPL_LIFETIME_DAG, &dag_lifetime_user);
+  route_timers_init();
   rpl_reset_periodic_timer();
   rpl_icmp6_register_handlers();
+  rpl_ext_header_init();
+  rpl_nbr_policy_init();
 
   /* add rpl multicast address */
   uip_create_linklocal_rplnodes_mcast(&rplmaddr);
@@ -349,6 +1058,12 @@ rpl_init(void)
 #if RPL_WITH_NON_STORING
   rpl_ns_init();
 #endif /* RPL_WITH_NON_STORING */
+
+#if RPL_SNAPSHOT
+  if(!snapshot_restore()) {
+    ctimer_set(&snapshot_timer, RPL_SNAPSHOT_INTERVAL, snapshot_periodic, NULL);
+  }
+#endif /* RPL_SNAPSHOT */
 }
 /*---------------------------------------------------------------------------*/
 
@@ -144,6 +144,9 @@ struct rpl_dag;
 /*---------------------------------------------------------------------------*/
 #define RPL_PARENT_FLAG_UPDATED           0x1
 #define RPL_PARENT_FLAG_LINK_METRIC_VALID 0x2
+#define RPL_PARENT_FLAG_REPAIR_DIO        0x4 /* loop repair DIO pending */
+#define RPL_PARENT_FLAG_DETACHED          0x8 /* looking for a new parent */
+#define RPL_PARENT_FLAG_HOPELESS          0x10 /* cannot win, not probed */
 
 	struct rpl_parent {
 	  struct rpl_parent *next;
@@ -166,6 +169,9 @@ struct rpl_dag;
 	  uint8_t dtsn;
 	  uint8_t updated;
           uint8_t flags;
+	  /* token bucket limiting loop repair DIOs to this neighbor */
+	  uint8_t repair_tokens;
+	  clock_time_t repair_time;
 	};
 	typedef struct rpl_parent rpl_parent_t;
 /*---------------------------------------------------------------------------*/
@@ -178,6 +184,17 @@ struct rpl_prefix {
 };
 typedef struct rpl_prefix rpl_prefix_t;
 /*---------------------------------------------------------------------------*/
+/* Expiry of a lifetime, kept on the lifetime wheel of rpl-timers.c. Timers
+   are linked by handle rather than by pointer and carry no callback, see
+   rpl_lifetime_user_t. */
+struct rpl_lifetime_timer {
+  uint32_t next;
+  uint32_t prev;
+  uint32_t expiry;
+  /* Wheel slot plus one, 0 when not on the wheel */
+  uint16_t slot;
+};
+/*---------------------------------------------------------------------------*/
 /* Directed Acyclic Graph */
 struct rpl_dag {
   uip_ipaddr_t dag_id;
@@ -194,6 +211,7 @@ struct rpl_dag {
   LIST_STRUCT(parents);
   rpl_prefix_t prefix_info;
   uint32_t lifetime;
+  struct rpl_lifetime_timer lifetime_timer;
 };
 typedef struct rpl_dag rpl_dag_t;
 typedef struct rpl_instance rpl_instance_t;
@@ -289,6 +307,13 @@ struct rpl_instance {
   uint8_t dio_intcurrent;
   uint8_t dio_send; /* for keeping track of which mode the timer is in */
   uint8_t dio_counter;
+  uint8_t dio_heard; /* DIOs heard during the current interval, up to 255 */
+  uint8_t dio_outcome; /* DIO sent or suppressed during the current interval */
+  clock_time_t dio_reset_time; /* time of the last reset to Imin */
+#if RPL_TRICKLE_ADAPTIVE
+  uint8_t dio_consistency; /* averaged share of consistent DIOs, percent */
+  uint8_t dio_adaptive_k; /* redundancy used in place of dio_redundancy */
+#endif /* RPL_TRICKLE_ADAPTIVE */
   /* my last registered DAO that I might be waiting for ACK on */
   uint8_t my_dao_seqno;
   uint8_t my_dao_transmissions;
@@ -301,17 +326,31 @@ struct rpl_instance {
   uint16_t dio_totint;
   uint16_t dio_totsend;
   uint16_t dio_totrecv;
+  uint16_t dio_totsupp;
 #endif /* RPL_CONF_STATS */
   clock_time_t dio_next_delay; /* delay for completion of dio interval */
 #if RPL_WITH_PROBING
   struct ctimer probing_timer;
   rpl_parent_t *urgent_probing_target;
+  /* next probing targets, best first */
+  linkaddr_t probing_queue[RPL_PROBING_QUEUE_SIZE];
+  uint8_t probing_queue_len;
+  clock_time_t probing_empty_time; /* of the last fill that found none */
 #endif /* RPL_WITH_PROBING */
   struct ctimer dio_timer;
   struct ctimer dao_timer;
   struct ctimer dao_lifetime_timer;
   struct ctimer unicast_dio_timer;
   rpl_parent_t *unicast_dio_target;
+  /* token bucket limiting trickle resets triggered by data-path errors */
+  uint8_t repair_tokens;
+  clock_time_t repair_time;
+#if RPL_LOCAL_REPAIR_BOUNDED
+  /* bounded local repair: the rank held while detached from the DAG */
+  uint8_t detached;
+  rpl_rank_t detached_rank;
+  struct ctimer detach_timer;
+#endif /* RPL_LOCAL_REPAIR_BOUNDED */
 #if RPL_WITH_DAO_ACK
   struct ctimer dao_retransmit_timer;
 #endif /* RPL_WITH_DAO_ACK */